@@ -280,6 +280,13 @@ void ClassifierDialog::doClassificationExt()
   settings.setValue( "doGeneralization", generalizeCheckBox->isChecked() );
   settings.setValue( "kernelSize", spnKernelSize->value() );
 
+  settings.setValue( "maxDepth", spnMaxDepth->value() );
+  settings.setValue( "minSamples", spnMinSamples->value() );
+  settings.setValue( "treesCount", spnTreesCount->value() );
+  settings.setValue( "targetSpeed", spnTargetSpeed->value() );
+  settings.setValue( "cascadeDepth", spnCascadeDepth->value() );
+  settings.setValue( "cascadePurity", spnCascadePurity->value() );
+
   QgsDebugMsg(QString("ClassifierDialog::doClassificationExt"));
 
   for (int i = 0; i < mInputRasters.size(); ++i )
@@ -312,11 +319,19 @@ void ClassifierDialog::doClassificationExt()
   config.do_generalization = generalizeCheckBox->isChecked();
   config.kernel_size = spnKernelSize->value();
 
+  config.max_depth = spnMaxDepth->value();
+  config.min_sample_count = spnMinSamples->value();
+  config.trees_count = spnTreesCount->value();
+  config.target_pixels_per_second = spnTargetSpeed->value();
+  config.cascade_depth = spnCascadeDepth->value();
+  config.cascade_purity = spnCascadePurity->value();
+
   worker = new ClassifierWorker(config);
   connect( worker, SIGNAL( stepCount(int) ), this, SLOT( setStepProgress(int) ) );
   connect( worker, SIGNAL( progressStep(int) ), totalProgress, SLOT( setValue(int) ) );
   connect( worker, SIGNAL( subStepCount(int) ), this, SLOT( setSubStepProgress(int) ) );
   connect( worker, SIGNAL( progressSubStep(int) ), stepProgress, SLOT( setValue(int) ) );
+  connect( worker, SIGNAL( messageReported(QString) ), this, SLOT( showMessage(QString) ) );
   connect( worker, SIGNAL( finished() ), this, SLOT( finishedProcess() ) );
   QgsDebugMsg(QString("worker"));
   
@@ -355,6 +370,12 @@ void ClassifierDialog::finishedProcess()
   buttonBox->button(QDialogButtonBox::Ok)->setEnabled(true);
 }
 
+void ClassifierDialog::showMessage(QString msg)
+{
+  // latency tuner choice and prediction cache statistics go to the log panel
+  QgsMessageLog::logMessage( msg, tr( "DTclassifier" ), QgsMessageLog::INFO );
+}
+
 void ClassifierDialog::setStepProgress(int count)
 {
   totalProgress->setRange(0, count);
@@ -399,6 +420,14 @@ void ClassifierDialog::manageGui()
     discreteLabelsCheckBox->setEnabled( false );
   }
   discreteLabelsCheckBox->setChecked( settings.value( "discreteClasses", true ).toBool() );
+  spnTreesCount->setEnabled( rbRandomTrees->isChecked() );
+
+  spnMaxDepth->setValue( settings.value( "maxDepth", 0 ).toInt() );
+  spnMinSamples->setValue( settings.value( "minSamples", 10 ).toInt() );
+  spnTreesCount->setValue( settings.value( "treesCount", 50 ).toInt() );
+  spnTargetSpeed->setValue( settings.value( "targetSpeed", 0 ).toInt() );
+  spnCascadeDepth->setValue( settings.value( "cascadeDepth", 0 ).toInt() );
+  spnCascadePurity->setValue( settings.value( "cascadePurity", 0.95 ).toDouble() );
 
   // populate vector layers comboboxes
   QMap<QString, QgsMapLayer*> mapLayers = QgsMapLayerRegistry::instance()->mapLayers();
@@ -460,6 +489,7 @@ void ClassifierDialog::toggleDiscreteLabelsCheckBoxState( bool checked )
   {
     discreteLabelsCheckBox->setEnabled( false );
   }
+  spnTreesCount->setEnabled( !checked );
 }
 
 void ClassifierDialog::toggleKernelSizeSpinState( int state )
@@ -101,6 +101,7 @@ class ClassifierDialog : public QDialog, private Ui::ClassifierDialogBase
 
   private slots:
     void finishedProcess();
+    void showMessage(QString msg);
 };
 
 #endif // CLASSIFIERDIALOG_H
@@ -125,6 +125,20 @@ QgsRasterLayer* rasterLayerByName( const QString& name )
   return 0;
 }
 
+bool pixelInShard( int col, int row, int index, int count )
+{
+  if ( count <= 1 )
+    return true;
+
+  // tiles are scattered among shards, so every shard gets a similar share of
+  // large training polygons and no shard depends on raster size
+  quint64 h = ( ( quint64 )( col >> 8 ) * 0x9E3779B97F4A7C15ULL ) ^ ( ( quint64 )( row >> 8 ) * 0xC2B2AE3D27D4EB4FULL );
+  h ^= h >> 31;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  h ^= h >> 29;
+  return ( int )( h % ( quint64 )count ) == index;
+}
+
 /*
 QStringList* ClassifierDialog::getVectorLayerNames()
 {
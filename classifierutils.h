@@ -35,4 +35,7 @@ QgsVectorLayer* vectorLayerByName( const QString& name );
 //! get raster layer by it's name
 QgsRasterLayer* rasterLayerByName( const QString& name );
 
+//! true when pixel belongs to shard index of count, pixels are split into shards by 256x256 tiles
+bool pixelInShard( int col, int row, int index, int count );
+
 #endif // CLASSIFIERUTILS_H
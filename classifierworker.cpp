@@ -16,13 +16,23 @@
  *   (at your option) any later version.                                   *
  *                                                                         *
  ***************************************************************************/
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
 #include <vector>
 
+#include <QFile>
 #include <QProcess>
+#include <QScopedPointer>
+#include <QSharedPointer>
+#include <QTextStream>
 #include <QUuid>
 #include "gdal.h"
 #include "gdal_priv.h"
 #include "cpl_conv.h"
+#include "ogrsf_frmts.h"
+#include "ogr_spatialref.h"
 
 #include "qgscontexthelp.h"
 #include "qgsgeometry.h"
@@ -36,6 +46,22 @@
 
 #include "classifierutils.h"
 #include "classifierworker.h"
+#include "featureexpr.h"
+#include "foresttrainer.h"
+#include "histogramtrainer.h"
+#include "hypersearch.h"
+#include "latencytuner.h"
+#include "predictioncache.h"
+#include "prunedtree.h"
+#include "quantizedmodel.h"
+#include "ograrrowsampler.h"
+#include "pixelmask.h"
+#include "segmentation.h"
+#include "streamtrainer.h"
+#include "texturefeatures.h"
+#include "timeseries.h"
+#include "trainset.h"
+#include "treemodel.h"
 
 ClassifierWorker::ClassifierWorker(ClassifierWorkerConfig config)
     : QObject(),
@@ -57,6 +83,8 @@ void ClassifierWorker::process()
     QgsDebugMsg( QString("mConfig mOutputRaster: %1").arg(mConfig.mOutputRaster) );
     QgsDebugMsg( QString("mConfig mOutputModel: %1").arg(mConfig.mOutputModel) );
     QgsDebugMsg( QString("mConfig mInputModel: %1").arg(mConfig.mInputModel) );
+    QgsDebugMsg( QString("mConfig mExtraInputModels: %1").arg(mConfig.mExtraInputModels.join("; ")) );
+    QgsDebugMsg( QString("mConfig mExtraOutputRasters: %1").arg(mConfig.mExtraOutputRasters.join("; ")) );
     QgsDebugMsg( QString("mConfig mInputRasters: %1").arg(mConfig.mInputRasters.join("; ")) );
     QgsDebugMsg( QString("mConfig mPresence: %1").arg(mConfig.mPresence.join("; ")) );
     QgsDebugMsg( QString("mConfig mAbsence: %1").arg(mConfig.mAbsence.join("; ")) );
@@ -65,6 +93,40 @@ void ClassifierWorker::process()
     QgsDebugMsg( QString("mConfig discrete_classes: %1").arg(mConfig.discrete_classes) );
     QgsDebugMsg( QString("mConfig do_generalization: %1").arg(mConfig.do_generalization) );
     QgsDebugMsg( QString("mConfig kernel_size: %1").arg(mConfig.do_generalization) );
+    QgsDebugMsg( QString("mConfig use_arrow_stream: %1").arg(mConfig.use_arrow_stream) );
+    QgsDebugMsg( QString("mConfig threads_count: %1").arg(mConfig.threads_count) );
+    QgsDebugMsg( QString("mConfig random_seed: %1").arg(mConfig.random_seed) );
+    QgsDebugMsg( QString("mConfig use_histogram_split: %1").arg(mConfig.use_histogram_split) );
+    QgsDebugMsg( QString("mConfig cv_folds: %1").arg(mConfig.cv_folds) );
+    QgsDebugMsg( QString("mConfig max_depth: %1").arg(mConfig.max_depth) );
+    QgsDebugMsg( QString("mConfig min_sample_count: %1").arg(mConfig.min_sample_count) );
+    QgsDebugMsg( QString("mConfig max_categories: %1").arg(mConfig.max_categories) );
+    QgsDebugMsg( QString("mConfig trees_count: %1").arg(mConfig.trees_count) );
+    QgsDebugMsg( QString("mConfig forest_accuracy: %1").arg(mConfig.forest_accuracy) );
+    QgsDebugMsg( QString("mConfig active_vars: %1").arg(mConfig.active_vars) );
+    QgsDebugMsg( QString("mConfig target_pixels_per_second: %1").arg(mConfig.target_pixels_per_second) );
+    QgsDebugMsg( QString("mConfig mSearch: %1").arg(mConfig.mSearch) );
+    QgsDebugMsg( QString("mConfig search_random: %1").arg(mConfig.search_random) );
+    QgsDebugMsg( QString("mConfig mInputTrainSets: %1").arg(mConfig.mInputTrainSets.join(", ")) );
+    QgsDebugMsg( QString("mConfig mOutputTrainSet: %1").arg(mConfig.mOutputTrainSet) );
+    QgsDebugMsg( QString("mConfig memory_budget_mb: %1").arg(mConfig.memory_budget_mb) );
+    QgsDebugMsg( QString("mConfig shard: %1/%2").arg(mConfig.shard_index).arg(mConfig.shard_count) );
+    QgsDebugMsg( QString("mConfig update_model: %1").arg(mConfig.update_model) );
+    QgsDebugMsg( QString("mConfig max_trees: %1").arg(mConfig.max_trees) );
+    QgsDebugMsg( QString("mConfig compact_model: %1").arg(mConfig.compact_model) );
+    QgsDebugMsg( QString("mConfig mOutputImportance: %1").arg(mConfig.mOutputImportance) );
+    QgsDebugMsg( QString("mConfig prediction_cache: %1").arg(mConfig.prediction_cache) );
+    QgsDebugMsg( QString("mConfig vote_margin: %1").arg(mConfig.vote_margin) );
+    QgsDebugMsg( QString("mConfig cascade: depth %1, purity %2").arg(mConfig.cascade_depth).arg(mConfig.cascade_purity) );
+    QgsDebugMsg( QString("mConfig write_confidence: %1").arg(mConfig.write_confidence) );
+    QgsDebugMsg( QString("mConfig mFeatures: %1").arg(mConfig.mFeatures.join("; ")) );
+    QgsDebugMsg( QString("mConfig mTimeSeries: %1").arg(mConfig.mTimeSeries.join("; ")) );
+    QgsDebugMsg( QString("mConfig mAggregates: %1").arg(mConfig.mAggregates.join(",")) );
+    QgsDebugMsg( QString("mConfig segments: size %1, compactness %2").arg(mConfig.segment_size).arg(mConfig.segment_compactness) );
+    QgsDebugMsg( QString("mConfig mMask: %1").arg(mConfig.mMask) );
+    QgsDebugMsg( QString("mConfig nodata_class: %1").arg(mConfig.nodata_class) );
+    QgsDebugMsg( QString("mConfig mWindow: %1").arg(mConfig.mWindow) );
+    QgsDebugMsg( QString("mConfig mAoi: %1").arg(mConfig.mAoi) );
     
     mEnv = new ClassifierWorkerEnv();
 
@@ -78,10 +140,12 @@ void ClassifierWorker::process()
 
     if (mConfig.needToPrepareModel())
     {
-        if (mConfig.mInputModel.isEmpty())
+        if (mConfig.needToTrain())
             steps.push_back(new CreateTrainData(&mConfig, mEnv));
         steps.push_back(new PrepareModel(&mConfig, mEnv));
     }
+    else if (!mConfig.mOutputTrainSet.isEmpty())
+        steps.push_back(new CreateTrainData(&mConfig, mEnv));
 
     if (!mConfig.mOutputRaster.isEmpty())
         steps.push_back(new Classify(&mConfig, mEnv));
@@ -95,6 +159,7 @@ void ClassifierWorker::process()
         connect( step, SIGNAL( started(size_t) ), this, SLOT( nextStep(size_t) ) );
         connect( step, SIGNAL( nextStep() ), this, SLOT( nextSubStep() ) );
         connect( step, SIGNAL( errorOccured(QString) ), this, SIGNAL( errorOccured(QString) ) );
+        connect( step, SIGNAL( messageReported(QString) ), this, SIGNAL( messageReported(QString) ) );
         
         try
         {
@@ -110,12 +175,16 @@ void ClassifierWorker::process()
 
     if (!mConfig.mOutputRaster.isEmpty())
     {
-      this->saveQgisStyle(mConfig.mOutputRaster, Qt::red);
-      if ( mConfig.do_generalization )
+      QStringList outputRasters = QStringList() << mConfig.mOutputRaster << mConfig.mExtraOutputRasters;
+      for (int i = 0; i < outputRasters.size(); ++i)
       {
-        QString smoothOutputRaster = smoothRaster( mConfig.mOutputRaster );
-        QgsDebugMsg( QString("smoothOutputRaster: %1").arg(smoothOutputRaster) );
-        this->saveQgisStyle(smoothOutputRaster, Qt::blue);
+        this->saveQgisStyle(outputRasters.at(i), Qt::red);
+        if ( mConfig.do_generalization )
+        {
+          QString smoothOutputRaster = smoothRaster( outputRasters.at(i) );
+          QgsDebugMsg( QString("smoothOutputRaster: %1").arg(smoothOutputRaster) );
+          this->saveQgisStyle(smoothOutputRaster, Qt::blue);
+        }
       }
     }
 
@@ -124,6 +193,63 @@ void ClassifierWorker::process()
     emit finished();
 }
 
+namespace
+{
+  //! add (sign 1) or remove (sign -1) valid pixels of column rows y0..y1 to the histogram
+  void histogramColumn( const CvMat* img, int col, int y0, int y1, unsigned char nodata, int sign,
+                        std::vector<int>& histogram, int& count )
+  {
+    for ( int y = y0; y <= y1; ++y )
+    {
+      unsigned char value = img->data.ptr[ y * img->step + col ];
+      if ( value == nodata )
+        continue;
+      histogram[ value ] += sign;
+      count += sign;
+    }
+  }
+
+  /** median of the valid pixels in size x size window (clipped at the
+    edges) of every valid pixel, nodata pixels stay nodata. The window
+    slides along the row with a histogram of byte values
+    */
+  void maskedMedian( const CvMat* img, CvMat* out, int size, unsigned char nodata )
+  {
+    int radius = size / 2;
+    std::vector<int> histogram( 256 );
+    for ( int y = 0; y < img->rows; ++y )
+    {
+      int y0 = qMax( 0, y - radius );
+      int y1 = qMin( img->rows - 1, y + radius );
+      std::fill( histogram.begin(), histogram.end(), 0 );
+      int count = 0;
+      for ( int col = 0; col < qMin( radius, img->cols ); ++col )
+        histogramColumn( img, col, y0, y1, nodata, 1, histogram, count );
+
+      const unsigned char* in = img->data.ptr + y * img->step;
+      unsigned char* line = out->data.ptr + y * out->step;
+      for ( int x = 0; x < img->cols; ++x )
+      {
+        if ( x + radius < img->cols )
+          histogramColumn( img, x + radius, y0, y1, nodata, 1, histogram, count );
+        if ( x - radius - 1 >= 0 )
+          histogramColumn( img, x - radius - 1, y0, y1, nodata, -1, histogram, count );
+
+        if ( in[ x ] == nodata || count == 0 )
+        {
+          line[ x ] = in[ x ];
+          continue;
+        }
+        int half = ( count + 1 ) / 2;
+        int value = 0;
+        for ( int sum = histogram[ 0 ]; sum < half; sum += histogram[ value ] )
+          ++value;
+        line[ x ] = ( unsigned char )value;
+      }
+    }
+  }
+}
+
 QString ClassifierWorker::smoothRaster( const QString& path )
 {
     QgsDebugMsg(QString("ClassifierWorker::smoothRaster: %1").arg(path));
@@ -133,7 +259,9 @@ QString ClassifierWorker::smoothRaster( const QString& path )
   CvMat* outImg = cvCreateMat( img->rows, img->cols, CV_8UC1 );
     QgsDebugMsg(QString("ClassifierWorker::smoothRaster img->cols: %1").arg(img->cols));
 
-  cvSmooth( img, outImg, CV_MEDIAN, mConfig.kernel_size );
+  // median of valid neighbours only, masked pixels stay nodata and
+  // don't pull classified ones towards the nodata class
+  maskedMedian( img, outImg, mConfig.kernel_size, (unsigned char)mConfig.nodata_class );
     QgsDebugMsg(QString("ClassifierWorker::smoothRaster mConfig.kernel_size: %1").arg(mConfig.kernel_size));
 
 /*
@@ -153,24 +281,26 @@ QString ClassifierWorker::smoothRaster( const QString& path )
     QString smoothFileName;
     smoothFileName = fi.absoluteDir().absolutePath() + "/" + fi.baseName() + "_smooth.tif";
 
-    // create output file
+    // create output file, georeferenced as the classified window
     GDALDriver *driver;
     driver = GetGDALDriverManager()->GetDriverByName( "GTiff" );
     GDALDataset *outRaster;
     outRaster = driver->Create(
         smoothFileName.toUtf8(),
-        mEnv->mResultInputRasterFileInfo->xSize(),
-        mEnv->mResultInputRasterFileInfo->ySize(),
+        outImg->cols,
+        outImg->rows,
         1, GDT_Byte, NULL
     );
 
+    RasterFileInfo classified( path );
     double geotransform[6];
-    mEnv->mResultInputRasterFileInfo->geoTransform( geotransform );
+    classified.geoTransform( geotransform );
 
     outRaster->SetGeoTransform( geotransform );
-    outRaster->SetProjection( mEnv->mResultInputRasterFileInfo->projection().toUtf8() );
+    outRaster->SetProjection( classified.projection().toUtf8() );
+    outRaster->GetRasterBand( 1 )->SetNoDataValue( mConfig.nodata_class );
 
-    outRaster->RasterIO( GF_Write, 0, 0, mEnv->mResultInputRasterFileInfo->xSize(), mEnv->mResultInputRasterFileInfo->ySize(), (void*)outImg->data.ptr, mEnv->mResultInputRasterFileInfo->xSize(), mEnv->mResultInputRasterFileInfo->ySize(), GDT_Byte, 1, 0, 0, 0, 0 );
+    outRaster->RasterIO( GF_Write, 0, 0, outImg->cols, outImg->rows, (void*)outImg->data.ptr, outImg->cols, outImg->rows, GDT_Byte, 1, 0, 0, 0, 0 );
 
     cvReleaseMat( &img );
     cvReleaseMat( &outImg );
@@ -280,7 +410,9 @@ void ClassifierWorkerStep::process()
 }
 
 PrepareInputRaster::PrepareInputRaster(ClassifierWorkerConfig* config, ClassifierWorkerEnv* env)
-    : ClassifierWorkerStep(config, env)
+    : ClassifierWorkerStep(config, env),
+      mFeatures(NULL),
+      mTimeSeries(NULL)
 {
     QgsDebugMsg( QString("PrepareInputRaster::PrepareInputRaster") );
 }
@@ -291,6 +423,9 @@ PrepareInputRaster::~PrepareInputRaster()
 
     mEnv->mResultInputRasterFileInfo = NULL;
     mEnv->mInRaster = NULL;
+    mEnv->mFeatures = NULL;
+    delete mFeatures;
+    delete mTimeSeries;
 
     QgsDebugMsg( QString("PrepareInputRaster::~PrepareInputRaster 1") );
     GDALClose( (GDALDatasetH) mInRaster );
@@ -339,6 +474,9 @@ void PrepareInputRaster::validate()
 void PrepareInputRaster::doWork()
 {
     QgsDebugMsg( QString("ClassifierWorker::prepareInputRaster") );
+
+    // band count of every input raster, tK.bN of derived features counts on it
+    QVector<int> rasterBands;
     
     if (mConfig->mInputRasters.size() == 1)
     {
@@ -409,6 +547,7 @@ void PrepareInputRaster::doWork()
             }
 
             bandCount = raster->GetRasterCount();
+            rasterBands << bandCount;
             GDALClose( (GDALDatasetH)raster );
 
             // iterate over bands
@@ -484,6 +623,24 @@ void PrepareInputRaster::doWork()
         throw std::runtime_error(msg.toStdString());
         }
         QgsDebugMsg( QString("Result input raster opened") );
+
+        QStringList features = mConfig->mFeatures;
+        if (!mConfig->mTimeSeries.isEmpty())
+        {
+            mTimeSeries = new TimeSeriesStack(mConfig->mTimeSeries, mResultInputRasterFileInfo.xSize(), mResultInputRasterFileInfo.ySize());
+            for (int i = 0; i < mConfig->mAggregates.size(); ++i)
+                for (int b = 0; b < mTimeSeries->bandCount(); ++b)
+                    features << QString("%1(ts.b%2)").arg(mConfig->mAggregates.at(i)).arg(b + 1);
+            QgsDebugMsg( QString("Time series: %1 scenes of %2 bands").arg(mTimeSeries->sceneCount()).arg(mTimeSeries->bandCount()) );
+        }
+        if (!features.isEmpty())
+        {
+            if (rasterBands.isEmpty())
+                rasterBands << mResultInputRasterFileInfo.bandCount();
+            mFeatures = new DerivedFeatures(features, rasterBands, mTimeSeries);
+            QgsDebugMsg( QString("Derived features: %1").arg(features.join("; ")) );
+        }
+        mEnv->mWindow = classificationWindow();
     }
     catch (std::runtime_error& e)
     {
@@ -494,6 +651,130 @@ void PrepareInputRaster::doWork()
 
     mEnv->mResultInputRasterFileInfo = &mResultInputRasterFileInfo;
     mEnv->mInRaster = mInRaster;
+    mEnv->mFeatures = mFeatures;
+}
+
+QRect PrepareInputRaster::classificationWindow()
+{
+    QRect raster( 0, 0, (int)mResultInputRasterFileInfo.xSize(), (int)mResultInputRasterFileInfo.ySize() );
+    QRect window = raster;
+    if (!mConfig->mWindow.isEmpty())
+    {
+        QString text = mConfig->mWindow.trimmed();
+        bool pixels = text.startsWith("px:");
+        QStringList parts = text.mid(pixels ? 3 : 0).split(",");
+        double values[4];
+        bool ok = parts.size() == 4;
+        for (int i = 0; i < parts.size() && ok; ++i)
+            values[i] = parts.at(i).toDouble(&ok);
+        if (!ok)
+            throw std::runtime_error(QString("Bad window \"%1\", expected minx,miny,maxx,maxy or px:col,row,width,height").arg(mConfig->mWindow).toStdString());
+        window = pixels ? QRect( (int)values[0], (int)values[1], (int)values[2], (int)values[3] )
+                        : mapWindow( values[0], values[1], values[2], values[3] );
+    }
+    if (!mConfig->mAoi.isEmpty())
+        window &= aoiWindow(mConfig->mAoi);
+
+    window &= raster;
+    if (window.isEmpty())
+        throw std::runtime_error("Region of interest doesn't intersect the input raster");
+    QgsDebugMsg( QString("Classification window: %1,%2 %3x%4").arg(window.x()).arg(window.y()).arg(window.width()).arg(window.height()) );
+    return window;
+}
+
+QRect PrepareInputRaster::mapWindow( double minX, double minY, double maxX, double maxY )
+{
+    // RasterFileInfo::mapToPixel rounds to the nearest pixel, the window
+    // needs fractional pixel coordinates to cover partly touched pixels
+    double geoTransform[6], invGeoTransform[6];
+    mResultInputRasterFileInfo.geoTransform( geoTransform );
+    if (!GDALInvGeoTransform( geoTransform, invGeoTransform ))
+        throw std::runtime_error("Input raster geotransform is not invertible");
+
+    // corners of rotated rasters are not on the pixel axes, all four are taken
+    double xs[4] = { minX, maxX, minX, maxX };
+    double ys[4] = { minY, minY, maxY, maxY };
+    double left = 0, top = 0, right = 0, bottom = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        double col, row;
+        GDALApplyGeoTransform( invGeoTransform, xs[i], ys[i], &col, &row );
+        left = i == 0 ? col : qMin( left, col );
+        right = i == 0 ? col : qMax( right, col );
+        top = i == 0 ? row : qMin( top, row );
+        bottom = i == 0 ? row : qMax( bottom, row );
+    }
+    return QRect( QPoint( (int)floor( left ), (int)floor( top ) ), QPoint( (int)ceil( right ) - 1, (int)ceil( bottom ) - 1 ) );
+}
+
+QRect PrepareInputRaster::aoiWindow( const QString& path )
+{
+    GDALDataset* aoi = (GDALDataset*) GDALOpenEx( path.toUtf8(), GDAL_OF_VECTOR, NULL, NULL, NULL );
+    if (aoi == NULL)
+        throw std::runtime_error(QString("Can't open AOI %1").arg(path).toStdString());
+
+    OGRSpatialReference rasterSRS;
+    QByteArray wkt = mResultInputRasterFileInfo.projection().toUtf8();
+    bool hasRasterSRS = !wkt.isEmpty() && rasterSRS.importFromWkt( wkt.constData() ) == OGRERR_NONE;
+#if GDAL_VERSION_NUM >= 3000000
+    // GDAL 3 follows the axis order of the CRS definition, extents are x/y
+    rasterSRS.SetAxisMappingStrategy( OAMS_TRADITIONAL_GIS_ORDER );
+#endif
+
+    QRect window;
+    for (int i = 0; i < aoi->GetLayerCount(); ++i)
+    {
+        OGRLayer* layer = aoi->GetLayer(i);
+        OGREnvelope extent;
+        if (layer->GetExtent( &extent, TRUE ) != OGRERR_NONE)
+            continue;
+
+        // extent in other CRS is densified along the edges while transformed,
+        // by hand since OGRCoordinateTransformation::TransformBounds needs GDAL 3.4
+        OGRSpatialReference* layerSRS = layer->GetSpatialRef();
+        if (hasRasterSRS && layerSRS && !layerSRS->IsSame( &rasterSRS ))
+        {
+            OGRSpatialReference src( *layerSRS );
+#if GDAL_VERSION_NUM >= 3000000
+            src.SetAxisMappingStrategy( OAMS_TRADITIONAL_GIS_ORDER );
+#endif
+            const int edgePoints = 21;
+            double xs[4 * edgePoints], ys[4 * edgePoints];
+            for (int k = 0; k < edgePoints; ++k)
+            {
+                double t = (double)k / (edgePoints - 1);
+                double x = extent.MinX + t * (extent.MaxX - extent.MinX);
+                double y = extent.MinY + t * (extent.MaxY - extent.MinY);
+                xs[k] = x;
+                ys[k] = extent.MinY;
+                xs[edgePoints + k] = x;
+                ys[edgePoints + k] = extent.MaxY;
+                xs[2 * edgePoints + k] = extent.MinX;
+                ys[2 * edgePoints + k] = y;
+                xs[3 * edgePoints + k] = extent.MaxX;
+                ys[3 * edgePoints + k] = y;
+            }
+            OGRCoordinateTransformation* transform = OGRCreateCoordinateTransformation( &src, &rasterSRS );
+            bool ok = transform && transform->Transform( 4 * edgePoints, xs, ys );
+            if (transform)
+                OCTDestroyCoordinateTransformation( (OGRCoordinateTransformationH) transform );
+            if (!ok)
+            {
+                GDALClose( (GDALDatasetH) aoi );
+                throw std::runtime_error(QString("Can't transform AOI %1 to the raster CRS").arg(path).toStdString());
+            }
+            extent.MinX = *std::min_element( xs, xs + 4 * edgePoints );
+            extent.MaxX = *std::max_element( xs, xs + 4 * edgePoints );
+            extent.MinY = *std::min_element( ys, ys + 4 * edgePoints );
+            extent.MaxY = *std::max_element( ys, ys + 4 * edgePoints );
+        }
+        window |= mapWindow( extent.MinX, extent.MinY, extent.MaxX, extent.MaxY );
+    }
+    GDALClose( (GDALDatasetH) aoi );
+
+    if (window.isNull())
+        throw std::runtime_error(QString("AOI %1 has no features").arg(path).toStdString());
+    return window;
 }
 
 CreateTrainLayer::CreateTrainLayer(ClassifierWorkerConfig* config, ClassifierWorkerEnv* env)
@@ -541,6 +822,10 @@ void CreateTrainLayer::doWork()
       QgsField* field = new QgsField( QString( "Band_%1").arg( i + 1 ), QVariant::Double );
       attrList.append( *field );
       }
+      // derived features follow the bands
+      int featureCount = mEnv->mFeatures ? mEnv->mFeatures->count() : 0;
+      for ( int i = 0; i < featureCount; ++i )
+        attrList.append( QgsField( QString( "Feature_%1" ).arg( i + 1 ), QVariant::Double ) );
       attrList.append( QgsField( "Class", QVariant::Int ) );
 
       provider->addAttributes( attrList );
@@ -585,15 +870,43 @@ void CreateTrainLayer::doWork()
     emit nextStep();
 }
 
+bool CreateTrainLayer::inShard( double col, double row ) const
+{
+  return pixelInShard( (int)col, (int)row, mConfig->shard_index, mConfig->shard_count );
+}
+
 void CreateTrainLayer::mergeLayers( QgsVectorLayer *outLayer, const QStringList& layers, GDALDataset* raster, int layerType )
 {
   QgsDebugMsg( QString("ClassifierWorker::mergeLayers"));
   QgsVectorLayer *vl;
+
+  bool useArrow = mConfig->use_arrow_stream && OgrArrowSampler::isAvailable();
+  OgrArrowSampler arrowSampler( raster, mEnv->mResultInputRasterFileInfo );
+  arrowSampler.setShard( mConfig->shard_index, mConfig->shard_count );
+  arrowSampler.setDerivedFeatures( mEnv->mFeatures );
+
   // iterate over layers
   for (int i = 0; i < layers.size(); ++i )
   {
     // vl = vectorLayerByName( layers.at( i ) );
     QgsDebugMsg( QString("layers.at( i ): %1").arg(layers.at( i )));
+
+    // columnar WKB batches go straight to the sampler, QGIS iterators are the fallback
+    if ( useArrow )
+    {
+      QgsFeatureList lstFeatures;
+      if ( arrowSampler.sample( layers.at( i ), layerType, lstFeatures ) )
+      {
+        outLayer->dataProvider()->addFeatures( lstFeatures );
+        outLayer->updateExtents();
+        // workaround to save added fetures
+        outLayer->startEditing();
+        outLayer->commitChanges();
+        continue;
+      }
+      QgsDebugMsg( QString("Arrow stream is not available for %1, use QGIS iterator").arg(layers.at( i )) );
+    }
+
     QgsVectorLayer* vl = new QgsVectorLayer(layers.at( i ), "tmp", "ogr");
     QgsDebugMsg( QString("vl->wkbType(): %1").arg(vl->wkbType()));
   
@@ -650,6 +963,13 @@ void CreateTrainLayer::pointsFromPolygons( QgsVectorLayer* src, QgsVectorLayer*
   QgsFeatureList lstFeatures;
 
   QVector<float> rasterData( mEnv->mResultInputRasterFileInfo->xSize() * bandCount );
+
+  // derived features of the pixel
+  int featureCount = mEnv->mFeatures ? mEnv->mFeatures->count() : 0;
+  QVector<float> featureData( featureCount );
+  QVector<const float*> bandRows( bandCount );
+  for ( int i = 0; i < bandCount; ++i )
+    bandRows[ i ] = rasterData.constData() + i;
     
   QgsCoordinateReferenceSystem srcCRS;
   srcCRS = src->crs();
@@ -685,6 +1005,9 @@ void CreateTrainLayer::pointsFromPolygons( QgsVectorLayer* src, QgsVectorLayer*
     {
       for ( int col = startCol; col < endCol + 1; col++ )
       {
+        // pixels of other shards are not tested
+        if ( !inShard( row - 0.5, col - 0.5 ) )
+          continue;
         // create point and test
         mEnv->mResultInputRasterFileInfo->pixelToMap( row - 0.5, col - 0.5, x, y );
         pnt->setX( x );
@@ -693,7 +1016,7 @@ void CreateTrainLayer::pointsFromPolygons( QgsVectorLayer* src, QgsVectorLayer*
         {
           newFeat = new QgsFeature();
           newFeat->setGeometry( QgsGeometry::fromPoint( *pnt ) );
-          newFeat->initAttributes(bandCount + 1);
+          newFeat->initAttributes(bandCount + featureCount + 1);
           // get pixel value
           raster->RasterIO(
             GF_Read,
@@ -714,8 +1037,16 @@ void CreateTrainLayer::pointsFromPolygons( QgsVectorLayer* src, QgsVectorLayer*
             //newFeat->addAttribute( i, QVariant( (double)rasterData[ i ] ) );
         newFeat->setAttribute( i, QVariant( (double)rasterData[ i ] ) );
           }
+          if ( featureCount > 0 )
+          {
+            mEnv->mFeatures->evaluate( bandRows.constData(), 1, featureData.data(), 1 );
+            if ( mEnv->mFeatures->readsRaster() )
+              mEnv->mFeatures->evaluateAt( raster, row - 0.5, col - 0.5, featureData.data(), 1 );
+            for ( int i = 0; i < featureCount; ++i )
+              newFeat->setAttribute( bandCount + i, QVariant( (double)featureData[ i ] ) );
+          }
           //newFeat->addAttribute( bandCount, QVariant( layerType ) );
-      newFeat->setAttribute( bandCount, QVariant( layerType ) );
+      newFeat->setAttribute( bandCount + featureCount, QVariant( layerType ) );
           lstFeatures.append( *newFeat );
         }
       }
@@ -748,6 +1079,13 @@ void CreateTrainLayer::copyPoints( QgsVectorLayer* src, QgsVectorLayer* dst, GDA
 
   QVector<float> rasterData( mEnv->mResultInputRasterFileInfo->xSize() * bandCount );
 
+  // derived features of the pixel
+  int featureCount = mEnv->mFeatures ? mEnv->mFeatures->count() : 0;
+  QVector<float> featureData( featureCount );
+  QVector<const float*> bandRows( bandCount );
+  for ( int i = 0; i < bandCount; ++i )
+    bandRows[ i ] = rasterData.constData() + i;
+
   QgsCoordinateReferenceSystem srcCRS;
   srcCRS = src->crs();
   
@@ -768,20 +1106,31 @@ void CreateTrainLayer::copyPoints( QgsVectorLayer* src, QgsVectorLayer* dst, GDA
   {
     geom = inFeat.geometry();
     geom->transform(*xform);
+
+    mEnv->mResultInputRasterFileInfo->mapToPixel( geom->asPoint().x(), geom->asPoint().y(), row, col );
+    if ( !inShard( row - 0.5, col - 0.5 ) )
+      continue;
     
     outFeat = new QgsFeature();
     outFeat->setGeometry( geom );
-    outFeat->initAttributes(bandCount + 1);
+    outFeat->initAttributes(bandCount + featureCount + 1);
     
-    mEnv->mResultInputRasterFileInfo->mapToPixel( geom->asPoint().x(), geom->asPoint().y(), row, col );
     raster->RasterIO( GF_Read, row - 0.5, col - 0.5, 1, 1, (void*)rasterData.data(), 1, 1, GDT_Float32, bandCount, 0, 0, 0, 0 );
     for ( int i = 0; i < bandCount; ++i )
     {
       //outFeat->addAttribute( i, QVariant( (double)rasterData[ i ] ) );
     outFeat->setAttribute( i, QVariant( (double)rasterData[ i ] ) );
     }
+    if ( featureCount > 0 )
+    {
+      mEnv->mFeatures->evaluate( bandRows.constData(), 1, featureData.data(), 1 );
+      if ( mEnv->mFeatures->readsRaster() )
+        mEnv->mFeatures->evaluateAt( raster, row - 0.5, col - 0.5, featureData.data(), 1 );
+      for ( int i = 0; i < featureCount; ++i )
+        outFeat->setAttribute( bandCount + i, QVariant( (double)featureData[ i ] ) );
+    }
 //    outFeat->addAttribute( bandCount, QVariant( layerType ) );
-  outFeat->setAttribute( bandCount, QVariant( layerType ) );
+  outFeat->setAttribute( bandCount + featureCount, QVariant( layerType ) );
 
     lstFeatures.append( *outFeat );
   }
@@ -832,7 +1181,10 @@ QgsVectorLayer* CreateTrainLayer::createBuffer( QgsVectorLayer* src )
 }
 
 CreateTrainData::CreateTrainData(ClassifierWorkerConfig* config, ClassifierWorkerEnv* env)
-    : ClassifierWorkerStep(config, env)
+    : ClassifierWorkerStep(config, env),
+      mTrainData(NULL),
+      mTrainResponses(NULL),
+      mTrainSetFileNameIsTemp(false)
 {
     QgsDebugMsg( QString("CreateTrainData::CreateTrainData") );
 }
@@ -842,16 +1194,24 @@ CreateTrainData::~CreateTrainData()
     QgsDebugMsg( QString("CreateTrainData::~CreateTrainData") );
     mEnv->mTrainData = NULL;
     mEnv->mTrainResponses = NULL;
+    mEnv->mTrainSetFile.clear();
+    if (mTrainSetFileNameIsTemp)
+        QFile::remove(mTrainSetFileName);
 }
 
 size_t CreateTrainData::stepCount()
 {
+    if (!mConfig->mInputTrainSets.isEmpty())
+        return 1;
+
     QgsVectorDataProvider *provider = mEnv->mTrainLayer->dataProvider();
     return provider->featureCount();
 }
 
 void CreateTrainData::validate()
 {
+    if (!mConfig->mInputTrainSets.isEmpty())
+        return;
     if (!mEnv->mTrainLayer)
         throw std::runtime_error("There is no train layer in ClassifierWorkerEnv");
 }
@@ -860,6 +1220,38 @@ void CreateTrainData::doWork()
 {
     QgsDebugMsg(QString("ClassifierWorker::generateTrainData"));
 
+    if (!mConfig->mInputTrainSets.isEmpty())
+    {
+        QString trainSetFile = mConfig->mInputTrainSets.at(0);
+
+        // shards are merged into the requested training set or a temporary one
+        if (mConfig->mInputTrainSets.size() > 1 || !mConfig->mOutputTrainSet.isEmpty())
+        {
+            if (!mConfig->mOutputTrainSet.isEmpty())
+            {
+                mTrainSetFileName = mConfig->mOutputTrainSet;
+            }
+            else
+            {
+                mTrainSetFileName = tempTrainSetFileName();
+                mTrainSetFileNameIsTemp = true;
+            }
+            qint64 merged = mergeTrainSets(mConfig->mInputTrainSets, mTrainSetFileName);
+            QgsDebugMsg(QString("Merged %1 training sets into %2: %3 samples").arg(mConfig->mInputTrainSets.size()).arg(mTrainSetFileName).arg(merged));
+            trainSetFile = mTrainSetFileName;
+        }
+
+        // streamed by PrepareModel or loaded whole
+        if (mConfig->needToPrepareModel() && mConfig->memory_budget_mb <= 0)
+            readTrainSet(trainSetFile);
+
+        mEnv->mTrainData = mTrainData;
+        mEnv->mTrainResponses = mTrainResponses;
+        mEnv->mTrainSetFile = trainSetFile;
+        nextStep();
+        return;
+    }
+
     long featCount = mEnv->mTrainLayer->featureCount();
     
     //int bc = mResultInputRasterFileInfo.bandCount();
@@ -867,11 +1259,34 @@ void CreateTrainData::doWork()
 
     QgsDebugMsg(QString("Train layer fetures count %1 (%2)").arg(featCount).arg(bc));
 
-    mTrainData = cvCreateMat( featCount, bc, CV_32F );
-    mTrainResponses = cvCreateMat( featCount, 1, CV_32F );
+    // samples go to a training-set file when training is out-of-core or the file is requested
+    QScopedPointer<TrainSetWriter> writer;
+    if (!mConfig->mOutputTrainSet.isEmpty())
+    {
+        mTrainSetFileName = mConfig->mOutputTrainSet;
+    }
+    else if (mConfig->memory_budget_mb > 0)
+    {
+        mTrainSetFileName = tempTrainSetFileName();
+        mTrainSetFileNameIsTemp = true;
+    }
+    // points sampled from the raster keep their pixel, so overlapping shards can be merged
+    RasterFileInfo* rasterInfo = mConfig->mInputPoints.isEmpty() ? mEnv->mResultInputRasterFileInfo : NULL;
+    if (!mTrainSetFileName.isEmpty())
+    {
+        QgsDebugMsg(QString("Training set file: %1").arg(mTrainSetFileName));
+        writer.reset(new TrainSetWriter(mTrainSetFileName, bc, rasterInfo != NULL));
+    }
+
+    if (mConfig->needToPrepareModel() && mConfig->memory_budget_mb <= 0)
+    {
+        mTrainData = cvCreateMat( featCount, bc, CV_32F );
+        mTrainResponses = cvCreateMat( featCount, 1, CV_32F );
+    }
     
     QgsFeature feat;
     int i = 0;
+    std::vector<float> values( bc );
 
     QgsVectorDataProvider *provider = mEnv->mTrainLayer->dataProvider();
     // QgsAttributeList attrList = provider->attributeIndexes();
@@ -889,23 +1304,70 @@ void CreateTrainData::doWork()
       //atMap = feat.attributeMap();
       for (int j = 0; j < bc; j++)
       {
-        cvmSet( mTrainData, i, j, feat.attribute(j).toDouble() );
+        values[ j ] = feat.attribute(j).toDouble();
+      }
+      float response = feat.attribute(bc).toDouble();
+
+      qint64 pixel = -1;
+      if ( rasterInfo )
+      {
+        double col, row;
+        QgsPoint point = feat.geometry()->asPoint();
+        rasterInfo->mapToPixel( point.x(), point.y(), col, row );
+        pixel = (qint64)floor( row ) * rasterInfo->xSize() + (qint64)floor( col );
+      }
+
+      if ( writer )
+        writer->append( &values[ 0 ], response, pixel );
+      if ( mTrainData )
+      {
+        for (int j = 0; j < bc; j++)
+        {
+          cvmSet( mTrainData, i, j, values[ j ] );
+        }
+        cvmSet( mTrainResponses, i, 0, response );
       }
-      cvmSet( mTrainResponses, i, 0, feat.attribute(bc).toDouble() );
       i++;
 
       nextStep();
     }
+    if ( writer )
+      writer->close();
     QgsDebugMsg(QString("cvmSet all"));
     // cvSave( "d:\\data.yaml", data );
     // cvSave( "d:\\resp.yaml", responses );
 
     mEnv->mTrainData = mTrainData;
     mEnv->mTrainResponses = mTrainResponses;
+    mEnv->mTrainSetFile = mTrainSetFileName;
+}
+
+QString CreateTrainData::tempTrainSetFileName()
+{
+    QString tempDir = QDir().tempPath() + "/dtclassifier";
+    if ( !QDir().mkpath( tempDir ) )
+        throw std::runtime_error(QString("Can't create temporary directory %1").arg(tempDir).toStdString());
+    return tempDir + "/train_" + QUuid::createUuid().toString().mid(1, 36) + ".dts";
+}
+
+void CreateTrainData::readTrainSet( const QString& fileName )
+{
+    TrainSetReader reader( fileName );
+    if ( reader.sampleCount() > INT_MAX / reader.varCount() )
+        throw std::runtime_error(QString("Training set %1 does not fit into memory, set memory budget").arg(fileName).toStdString());
+
+    int sampleCount = (int)reader.sampleCount();
+    QgsDebugMsg(QString("Training set %1: %2 samples (%3)").arg(fileName).arg(sampleCount).arg(reader.varCount()));
+
+    mTrainData = cvCreateMat( sampleCount, reader.varCount(), CV_32F );
+    mTrainResponses = cvCreateMat( sampleCount, 1, CV_32F );
+    reader.read( mTrainData->data.fl, mTrainResponses->data.fl, sampleCount );
 }
 
 PrepareModel::PrepareModel(ClassifierWorkerConfig* config, ClassifierWorkerEnv* env)
-    : ClassifierWorkerStep(config, env)
+    : ClassifierWorkerStep(config, env),
+      mModel(NULL),
+      mCascadeModel(NULL)
 {
     QgsDebugMsg( QString("PrepareModel::PrepareModel") );
 }
@@ -915,8 +1377,16 @@ PrepareModel::~PrepareModel()
     QgsDebugMsg( QString("PrepareModel::~PrepareModel") );
     mEnv->mDTree = NULL;
     mEnv->mRTree = NULL;
+    mEnv->mModel = NULL;
+    mEnv->mCascadeModel = NULL;
     mDTree->clear();
     mRTree->clear();
+    mEnv->mExtraModels.clear();
+    mEnv->mExtraCascadeModels.clear();
+    delete mModel;
+    delete mCascadeModel;
+    qDeleteAll(mExtraModels);
+    qDeleteAll(mExtraCascadeModels);
 }
 
 size_t PrepareModel::stepCount()
@@ -926,11 +1396,35 @@ size_t PrepareModel::stepCount()
 
 void PrepareModel::validate()
 {
-    if (mConfig->mInputModel.isEmpty())
+    if (mConfig->update_model)
+    {
+        if (mConfig->mInputModel.isEmpty())
+            throw std::runtime_error("Model update needs an input model");
+        if (mConfig->use_decision_tree)
+            throw std::runtime_error("Only random forest models can be updated");
+        if (mConfig->target_pixels_per_second > 0)
+            throw std::runtime_error("Speed target is not supported for model update");
+    }
+    if (mConfig->needToTrain())
     {
-        if (!mEnv->mTrainData || !mEnv->mTrainResponses)
+        if (mConfig->memory_budget_mb > 0)
+        {
+            if (mEnv->mTrainSetFile.isEmpty())
+                throw std::runtime_error("There is no training set file in ClassifierWorkerEnv");
+            if (!mConfig->mSearch.isEmpty() || mConfig->target_pixels_per_second > 0)
+                throw std::runtime_error("Parameter search and speed target need in-memory train data");
+        }
+        else if (!mEnv->mTrainData || !mEnv->mTrainResponses)
             throw std::runtime_error("There is no train data in ClassifierWorkerEnv");
     }
+    if (!mConfig->mSearch.isEmpty())
+    {
+        if (mConfig->mOutputModel.isEmpty() || !mConfig->mInputModel.isEmpty())
+            throw std::runtime_error("Parameter search needs train data and an output model");
+        // HyperSearch scores OpenCV trees, its winner would not describe histogram trees
+        if (mConfig->use_histogram_split)
+            throw std::runtime_error("Parameter search is not supported for histogram training");
+    }
 }
 
 void PrepareModel::doWork()
@@ -938,79 +1432,719 @@ void PrepareModel::doWork()
     QgsDebugMsg(QString("ClassifierWorker::prepareModel"));
 
     mDTree = new CvDTree();
-    mRTree = new CvRTrees();
+    mRTree = new ParallelRTrees();
     
     if (!mConfig->mInputModel.isEmpty())
     {
-        if ( mConfig->use_decision_tree )
+        if ( TreeModel::isTreeModelFile(mConfig->mInputModel) )
+        {
+            mModel = new TreeModel();
+            mModel->load(mConfig->mInputModel);
+        }
+        else if ( mConfig->use_decision_tree )
             mDTree->load(mConfig->mInputModel.toUtf8());
         else
             mRTree->load(mConfig->mInputModel.toUtf8());
 
-        mEnv->mDTree = mDTree;
-        mEnv->mRTree = mRTree;
+        if (mConfig->cascade_depth > 0 && !mConfig->needToTrain())
+            mCascadeModel = loadCascade(mConfig->mInputModel);
 
-        nextStep();
-        return;
+        for (int i = 0; i < mConfig->mExtraInputModels.size(); ++i)
+        {
+            QgsDebugMsg(QString("Load model %1").arg(mConfig->mExtraInputModels.at(i)));
+            mExtraModels << loadFlatModel(mConfig->mExtraInputModels.at(i));
+            mExtraCascadeModels << (mConfig->cascade_depth > 0 ? loadCascade(mConfig->mExtraInputModels.at(i)) : NULL);
+        }
+
+        if (!mConfig->update_model)
+        {
+            finishModel();
+            return;
+        }
     }
 
-    if ( mConfig->use_decision_tree )
+    // loaded forest is put aside, trees are trained on the new samples as usual
+    // and appended to it before save
+    TreeModel* loadedModel = NULL;
+    ParallelRTrees* loadedForest = NULL;
+    if (mConfig->update_model)
     {
-      CvDTreeParams params( 8,     // max depth
-                            10,    // min sample count
-                            0,     // regression accuracy
-                            true,  // use surrogates
-                            10,    // max number of categories
-                            10,    // prune tree with K fold cross-validation
-                            false, // use 1 rule
-                            false, // throw away the pruned tree branches
-                            0      // the array of priors, the bigger p_weight, the more attention
-                           );
+        if ( mModel )
+        {
+            loadedModel = mModel;
+            mModel = NULL;
+        }
+        else if ( mConfig->use_histogram_split || mConfig->memory_budget_mb > 0 )
+        {
+            throw std::runtime_error(QString("Model %1 is a random forest, update it without histogram and out-of-core training").arg(mConfig->mInputModel).toStdString());
+        }
+        else
+        {
+            loadedForest = mRTree;
+            mRTree = new ParallelRTrees();
+        }
+        QgsDebugMsg( QString("Update model with %1 trees").arg(loadedModel ? loadedModel->treeCount() : loadedForest->get_tree_count()) );
+    }
 
-      // build decision tree classifier
-      if ( mConfig->discrete_classes )
+    int maxDepth = mConfig->max_depth;
+    if ( maxDepth <= 0 )
+      maxDepth = mConfig->use_decision_tree ? 8 : CvRTParams().max_depth;
+
+    if ( mConfig->memory_budget_mb > 0 )
+    {
+      // out-of-core: samples are read from the training-set file chunk by chunk
+      // with the params of the in-memory --histogram path, so both predict the same classes
+      StreamTreeTrainer trainer( mEnv->mTrainSetFile, (qint64)mConfig->memory_budget_mb * 1024 * 1024 );
+      HistogramTreeParams params = histogramParams( maxDepth, mConfig->trees_count, trainer.varCount(), loadedModel );
+      mModel = trainer.train( params, mConfig->threads_count, mConfig->random_seed );
+      if ( mConfig->cascade_depth > 0 )
       {
-        QgsDebugMsg(QString("ClassifierWorker::prepareModel 1"));
-        CvMat* var_type;
-        var_type = cvCreateMat( mEnv->mTrainData->cols + 1, 1, CV_8U );
-        cvSet( var_type, cvScalarAll(CV_VAR_CATEGORICAL) );
-        mDTree->train( mEnv->mTrainData, CV_ROW_SAMPLE, mEnv->mTrainResponses, 0, 0, var_type, 0, params );
-        cvReleaseMat( &var_type );
-        QgsDebugMsg(QString("ClassifierWorker::prepareModel 2"));
+        HistogramTreeParams cascadeParams;
+        cascadeParams.maxDepth = mConfig->cascade_depth;
+        cascadeParams.minSampleCount = mConfig->min_sample_count;
+        mCascadeModel = trainer.train( cascadeParams, mConfig->threads_count, mConfig->random_seed );
       }
-      else
+      if ( mConfig->update_model )
+        appendToLoaded( loadedModel, loadedForest );
+      if ( mConfig->compact_model )
+        compactModel();
+
+      if (!mConfig->mOutputModel.isEmpty())
       {
-        mDTree->train( mEnv->mTrainData, CV_ROW_SAMPLE, mEnv->mTrainResponses, 0, 0, 0, 0, params );
+          QgsDebugMsg(QString("Model save file: %1").arg(mConfig->mOutputModel));
+          mModel->save( mConfig->mOutputModel );
       }
+
+      finishModel();
+      return;
     }
-    else // or random trees
+
+    if ( !mConfig->mSearch.isEmpty() )
+    {
+      HyperSearch search( *mConfig, mEnv->mTrainData, mEnv->mTrainResponses );
+      search.setGrid( mConfig->mSearch, mConfig->search_random, mConfig->random_seed );
+      search.run( mConfig->threads_count, mConfig->random_seed );
+
+      QFileInfo fi( mConfig->mOutputModel );
+      QString reportFileName = fi.absoluteDir().absolutePath() + "/" + fi.baseName() + "_search.csv";
+      QgsDebugMsg( QString("Search report: %1").arg(reportFileName) );
+      search.writeReport( reportFileName );
+
+      // the winner is trained on all samples below
+      search.apply( *mConfig );
+      if ( mConfig->max_depth > 0 )
+        maxDepth = mConfig->max_depth;
+    }
+
+    LatencyTuner* tuner = NULL;
+    if ( mConfig->target_pixels_per_second > 0 )
+      tuner = new LatencyTuner( mEnv->mTrainData );
+
+    // loaded TreeModel forests are extended with histogram trees
+    HistogramTreeTrainer* trainer = NULL;
+    if ( mConfig->use_histogram_split || loadedModel )
+    {
+      trainer = new HistogramTreeTrainer( mEnv->mTrainData, mEnv->mTrainResponses );
+      // quantized copy is all the trainer needs
+      cvReleaseMat( &mEnv->mTrainData );
+      cvReleaseMat( &mEnv->mTrainResponses );
+    }
+
+    if ( mConfig->cascade_depth > 0 )
+      trainCascade( trainer );
+
+    int treesCount = mConfig->trees_count;
+
+    try
+    {
+      // the deepest tree, then the largest forest, that meets the pixel rate.
+      // Histogram trees are cut to the next depth, OpenCV models are retrained
+      train( trainer, maxDepth, treesCount, loadedModel );
+      while ( tuner )
+      {
+        double speed = pixelsPerSecond( *tuner );
+        emit messageReported( QString("Latency tuner: depth %1, %2 trees, %3 pixels/s").arg(maxDepth).arg(treeCount()).arg(speed) );
+        if ( speed >= mConfig->target_pixels_per_second )
+          break;
+
+        if ( !mConfig->use_decision_tree )
+        {
+          // prediction cost grows linearly with the number of trees, the forest
+          // is cut while it keeps at least half of the configured trees
+          int fit = (int)( treeCount() * speed / mConfig->target_pixels_per_second );
+          if ( fit >= ( treeCount() + 1 ) / 2 || ( maxDepth == 1 && fit >= 1 ) )
+          {
+            truncateForest( fit );
+            emit messageReported( QString("Latency tuner: depth %1, %2 trees, %3 pixels/s").arg(maxDepth).arg(treeCount()).arg(pixelsPerSecond( *tuner )) );
+            break;
+          }
+        }
+
+        if ( maxDepth == 1 )
+        {
+          emit messageReported( QString("Latency tuner: target of %1 pixels/s can not be reached").arg(mConfig->target_pixels_per_second) );
+          break;
+        }
+        --maxDepth;
+        if ( mModel )
+          mModel->limitDepth( maxDepth );
+        else
+          train( trainer, maxDepth, treesCount, loadedModel );
+      }
+    }
+    catch ( ... )
     {
-      // build random trees classifier
-      mRTree->train( mEnv->mTrainData, CV_ROW_SAMPLE, mEnv->mTrainResponses );
+      delete tuner;
+      delete trainer;
+      throw;
     }
+    delete tuner;
+    delete trainer;
     
     QgsDebugMsg(QString("prepareModel Finish"));
 
     cvReleaseMat( &mEnv->mTrainData );
     cvReleaseMat( &mEnv->mTrainResponses );
 
+    if ( mConfig->update_model )
+      appendToLoaded( loadedModel, loadedForest );
+    if ( mConfig->compact_model )
+      compactModel();
+
     if (!mConfig->mOutputModel.isEmpty())
     {
         QString treeFileName = mConfig->mOutputModel;
         QgsDebugMsg(QString("Model save file: %1").arg(treeFileName));
 
-        if ( mConfig->use_decision_tree )
+        if ( mModel )
+        {
+            mModel->save( treeFileName );
+        }
+        else if ( TreeModel::isBinaryFileName( treeFileName ) )
+        {
+            // binary models are flat node arrays, OpenCV trees are converted
+            QScopedPointer<TreeModel> flat( mConfig->use_decision_tree ? TreeModel::fromCvDTree( mDTree )
+                                                                        : TreeModel::fromCvRTrees( mRTree ) );
+            flat->save( treeFileName );
+        }
+        else if ( mConfig->use_decision_tree )
             mDTree->save( treeFileName.toUtf8(), "MyTree" );
         else
             mRTree->save( treeFileName.toUtf8(), "MyTree" );
     }
 
+    finishModel();
+}
+
+void PrepareModel::finishModel()
+{
+    if (!mConfig->mOutputImportance.isEmpty())
+    {
+        QgsDebugMsg(QString("Band importance report: %1").arg(mConfig->mOutputImportance));
+        writeImportance( mConfig->mOutputImportance );
+    }
+
+    if (mCascadeModel && !mConfig->mOutputModel.isEmpty())
+    {
+        QString cascadeFile = cascadeFileName(mConfig->mOutputModel);
+        QgsDebugMsg(QString("Cascade model save file: %1").arg(cascadeFile));
+        mCascadeModel->save( cascadeFile );
+    }
+
     mEnv->mDTree = mDTree;
     mEnv->mRTree = mRTree;
+    mEnv->mModel = mModel;
+    mEnv->mCascadeModel = mCascadeModel;
+    mEnv->mExtraModels = mExtraModels;
+    mEnv->mExtraCascadeModels = mExtraCascadeModels;
 
     nextStep();
 }
 
+void PrepareModel::trainCascade( HistogramTreeTrainer* trainer )
+{
+    // purity of leaves is known to histogram trees only, OpenCV trees keep
+    // prior-weighted risks instead of class counts
+    HistogramTreeParams params;
+    params.maxDepth = mConfig->cascade_depth;
+    params.minSampleCount = mConfig->min_sample_count;
+
+    if ( trainer )
+    {
+      mCascadeModel = trainer->train( params, mConfig->threads_count, mConfig->random_seed );
+      return;
+    }
+    HistogramTreeTrainer cascadeTrainer( mEnv->mTrainData, mEnv->mTrainResponses );
+    mCascadeModel = cascadeTrainer.train( params, mConfig->threads_count, mConfig->random_seed );
+}
+
+QString PrepareModel::cascadeFileName( const QString& modelFileName )
+{
+    QFileInfo fi( modelFileName );
+    return fi.absoluteDir().absolutePath() + "/" + fi.baseName() + "_cascade." + fi.suffix();
+}
+
+TreeModel* PrepareModel::loadCascade( const QString& modelFileName )
+{
+    QString cascadeFile = cascadeFileName(modelFileName);
+    if (!QFile::exists(cascadeFile))
+        throw std::runtime_error(QString("There is no cascade model %1 for %2").arg(cascadeFile, modelFileName).toStdString());
+    TreeModel* model = new TreeModel();
+    try
+    {
+        model->load(cascadeFile);
+    }
+    catch ( ... )
+    {
+        delete model;
+        throw;
+    }
+    return model;
+}
+
+TreeModel* PrepareModel::loadFlatModel( const QString& fileName ) const
+{
+    if ( TreeModel::isTreeModelFile(fileName) )
+    {
+        QScopedPointer<TreeModel> model( new TreeModel() );
+        model->load(fileName);
+        return model.take();
+    }
+    if ( mConfig->use_decision_tree )
+    {
+        CvDTree tree;
+        tree.load(fileName.toUtf8());
+        return TreeModel::fromCvDTree(&tree);
+    }
+    CvRTrees forest;
+    forest.load(fileName.toUtf8());
+    return TreeModel::fromCvRTrees(&forest);
+}
+
+void PrepareModel::writeImportance( const QString& fileName ) const
+{
+    QScopedPointer<TreeModel> converted;
+    const TreeModel* model = mModel;
+    if ( !model )
+    {
+      converted.reset( mConfig->use_decision_tree ? TreeModel::fromCvDTree( mDTree ) : TreeModel::fromCvRTrees( mRTree ) );
+      model = converted.data();
+    }
+
+    std::vector<int> primary, surrogate;
+    model->splitCounts( primary, surrogate );
+    int total = 0;
+    for ( int v = 0; v < model->varCount(); ++v )
+      total += primary[ v ];
+
+    QFile file( fileName );
+    if ( !file.open( QIODevice::WriteOnly | QIODevice::Text ) )
+      throw std::runtime_error( QString( "Can't write band importance report %1" ).arg( fileName ).toStdString() );
+
+    // importance is the share of primary splits, bands with no splits are not read by Classify
+    QTextStream out( &file );
+    out << "band,splits,surrogate_splits,importance,used\n";
+    for ( int v = 0; v < model->varCount(); ++v )
+    {
+      out << v + 1 << ","
+          << primary[ v ] << ","
+          << surrogate[ v ] << ","
+          << QString::number( total > 0 ? (double)primary[ v ] / total : 0.0, 'f', 4 ) << ","
+          << ( primary[ v ] > 0 || surrogate[ v ] > 0 ? 1 : 0 ) << "\n";
+    }
+}
+
+void PrepareModel::train( HistogramTreeTrainer* trainer, int maxDepth, int treesCount, const TreeModel* loadedModel )
+{
+    if ( trainer )
+    {
+      HistogramTreeParams params = histogramParams( maxDepth, treesCount, trainer->varCount(), loadedModel );
+      TreeModel* model = trainer->train( params, mConfig->threads_count, mConfig->random_seed );
+      delete mModel;
+      mModel = model;
+      return;
+    }
+
+    if ( mConfig->use_decision_tree )
+    {
+      CvDTreeParams params( maxDepth, // max depth
+                            mConfig->min_sample_count, // min sample count
+                            0,     // regression accuracy
+                            true,  // use surrogates
+                            mConfig->max_categories, // max number of categories
+                            mConfig->cv_folds, // prune tree with K fold cross-validation
+                            false, // use 1 rule
+                            false, // throw away the pruned tree branches
+                            0      // the array of priors, the bigger p_weight, the more attention
+                           );
+
+      // build decision tree classifier, cross-validation folds are trained concurrently
+      CvMat* var_type = 0;
+      if ( mConfig->discrete_classes )
+      {
+        var_type = cvCreateMat( mEnv->mTrainData->cols + 1, 1, CV_8U );
+        cvSet( var_type, cvScalarAll(CV_VAR_CATEGORICAL) );
+      }
+
+      PrunedDTree* tree = new PrunedDTree();
+      try
+      {
+        tree->trainPruned( mEnv->mTrainData, mEnv->mTrainResponses, var_type, params, mConfig->threads_count, mConfig->random_seed );
+      }
+      catch ( ... )
+      {
+        cvReleaseMat( &var_type );
+        delete tree;
+        throw;
+      }
+      cvReleaseMat( &var_type );
+      delete mDTree;
+      mDTree = tree;
+    }
+    else // or random trees
+    {
+      CvRTParams params( maxDepth, // max depth
+                         mConfig->min_sample_count, // min sample count
+                         0,     // regression accuracy
+                         false, // use surrogates
+                         mConfig->max_categories, // max number of categories
+                         0,     // the array of priors
+                         false, // calculate variable importance
+                         mConfig->active_vars, // variables tried at every node, 0 - sqrt of bands count
+                         treesCount, // max number of trees in the forest
+                         (float)mConfig->forest_accuracy, // out-of-bag error to stop at
+                         CV_TERMCRIT_ITER + CV_TERMCRIT_EPS
+                        );
+
+      // build random trees classifier, trees are trained concurrently
+      ParallelRTrees* forest = new ParallelRTrees();
+      try
+      {
+        forest->trainParallel( mEnv->mTrainData, mEnv->mTrainResponses, 0, params, mConfig->threads_count, mConfig->random_seed );
+      }
+      catch ( ... )
+      {
+        delete forest;
+        throw;
+      }
+      delete mRTree;
+      mRTree = forest;
+    }
+}
+
+HistogramTreeParams PrepareModel::histogramParams( int maxDepth, int treesCount, int varCount, const TreeModel* loadedModel ) const
+{
+    if ( loadedModel && loadedModel->varCount() != varCount )
+      throw std::runtime_error( QString("Model %1 uses %2 bands, the train data has %3").arg(mConfig->mInputModel).arg(loadedModel->varCount()).arg(varCount).toStdString() );
+
+    // classifiers with the same tree limits as the OpenCV paths, without CV pruning
+    HistogramTreeParams params;
+    params.maxDepth = maxDepth;
+    params.minSampleCount = mConfig->min_sample_count;
+    if ( !mConfig->use_decision_tree )
+    {
+      params.treeCount = treesCount;
+      params.activeVars = mConfig->active_vars > 0 ? qMin( mConfig->active_vars, varCount )
+                                                   : qMax( 1, (int)sqrt( (double)varCount ) );
+      params.bootstrap = true;
+    }
+    // converted OpenCV forests are classifiers, appendModel() needs the same kind
+    if ( loadedModel )
+      params.classifier = loadedModel->isClassifier();
+    return params;
+}
+
+int PrepareModel::treeCount() const
+{
+    if ( mModel )
+      return mModel->treeCount();
+    if ( mConfig->use_decision_tree )
+      return 1;
+    return mRTree->get_tree_count();
+}
+
+void PrepareModel::truncateForest( int count )
+{
+    if ( mModel )
+      mModel->truncate( count );
+    else
+      mRTree->truncate( count );
+}
+
+void PrepareModel::appendToLoaded( TreeModel* loadedModel, ParallelRTrees* loadedForest )
+{
+    int added = treeCount();
+    try
+    {
+      if ( loadedModel )
+      {
+        loadedModel->appendModel( *mModel );
+        delete mModel;
+        mModel = loadedModel;
+      }
+      else
+      {
+        loadedForest->append( mRTree );
+        delete mRTree;
+        mRTree = loadedForest;
+      }
+    }
+    catch ( ... )
+    {
+      delete loadedModel;
+      delete loadedForest;
+      throw;
+    }
+
+    // the oldest trees go first, they were trained on the oldest samples
+    int excess = mConfig->max_trees > 0 ? treeCount() - mConfig->max_trees : 0;
+    if ( excess > 0 )
+    {
+      if ( mModel )
+        mModel->removeFirst( excess );
+      else
+        mRTree->removeFirst( excess );
+    }
+    QgsDebugMsg( QString("Model update: %1 trees added, %2 removed, %3 trees").arg(added).arg(qMax(excess, 0)).arg(treeCount()) );
+}
+
+void PrepareModel::compactModel()
+{
+    if ( !mModel )
+      mModel = mConfig->use_decision_tree ? TreeModel::fromCvDTree( mDTree ) : TreeModel::fromCvRTrees( mRTree );
+
+    int nodeCount = mModel->nodeCount();
+    mModel->compact();
+    QgsDebugMsg( QString("Model compaction: %1 nodes, %2 before").arg(mModel->nodeCount()).arg(nodeCount) );
+}
+
+double PrepareModel::pixelsPerSecond( const LatencyTuner& tuner ) const
+{
+    if ( mModel )
+      return tuner.pixelsPerSecond( mModel );
+    if ( mConfig->use_decision_tree )
+      return tuner.pixelsPerSecond( mDTree );
+    return tuner.pixelsPerSecond( mRTree );
+}
+
+namespace
+{
+  /** common integer type of the bands, GDT_Unknown when bands differ or are
+    not exact in float. Int32 values above 2^24 are rounded by the float
+    path, so Int32 rasters stay on it and classes match the float model
+    */
+  GDALDataType nativeIntegerType( GDALDataset* raster, const QVector<int>& bandMap )
+  {
+    GDALDataType type = GDT_Unknown;
+    for ( int i = 0; i < bandMap.size(); ++i )
+    {
+      GDALDataType bandType = raster->GetRasterBand( bandMap[ i ] )->GetRasterDataType();
+      if ( bandType != GDT_Byte && bandType != GDT_UInt16 && bandType != GDT_Int16 )
+        return GDT_Unknown;
+      if ( i > 0 && bandType != type )
+        return GDT_Unknown;
+      type = bandType;
+    }
+    return type;
+  }
+
+  /** prediction of TreeModel or QuantizedTreeModel. With a cascade first
+    stage, pixels reaching its leaves of at least minPurity take the leaf
+    value (and purity as confidence) and the model is not evaluated
+    */
+  template<typename Model>
+  struct RowPredictor
+  {
+    const Model* model;
+    const Model* firstStage;
+    const TreeNode* firstStageNodes;
+    float minPurity;
+    int exitMargin;
+
+    template<typename T>
+    float predict( const T* sample, int stride, float* confidence = NULL ) const
+    {
+      if ( firstStage )
+      {
+        const TreeNode& node = firstStageNodes[ firstStage->leaf( 0, sample, stride ) ];
+        if ( node.purity >= minPurity )
+        {
+          if ( confidence )
+            *confidence = node.purity;
+          return node.value;
+        }
+      }
+      return model->predict( sample, stride, exitMargin, confidence );
+    }
+  };
+
+  //! confidence in [0, 1] quantized to byte
+  inline unsigned char confidenceByte( float confidence )
+  {
+    return ( unsigned char )( confidence * 255 + 0.5f );
+  }
+
+  /** classify band-sequential row, pixels already in cache (if any) skip the
+    model. Masked pixels (valid[ col ] == 0, if valid is not NULL) are left
+    for maskRow(). Confidence is written to confData when it is not NULL
+    */
+  template<typename Predictor, typename T>
+  void predictRow( const Predictor& predictor, const T* data, const unsigned char* valid, int xSize, int bandCount,
+                   PredictionCache* cache, QVector<unsigned char>& outData, QVector<unsigned char>* confData )
+  {
+    float confidence = 0;
+    float* conf = confData ? &confidence : NULL;
+    if ( !cache )
+    {
+      for ( int col = 0; col < xSize; ++col )
+      {
+        if ( valid && !valid[ col ] )
+          continue;
+        outData[ col ] = ( unsigned char )predictor.predict( data + col, xSize, conf );
+        if ( confData )
+          ( *confData )[ col ] = confidenceByte( confidence );
+      }
+      return;
+    }
+
+    unsigned char* key = cache->key();
+    for ( int col = 0; col < xSize; ++col )
+    {
+      if ( valid && !valid[ col ] )
+        continue;
+      for ( int b = 0; b < bandCount; ++b )
+        memcpy( key + b * sizeof( T ), data + b * xSize + col, sizeof( T ) );
+      float value;
+      if ( !cache->find( value, confidence ) )
+      {
+        value = predictor.predict( data + col, xSize, conf );
+        cache->insert( value, confidence );
+      }
+      outData[ col ] = ( unsigned char )value;
+      if ( confData )
+        ( *confData )[ col ] = confidenceByte( confidence );
+    }
+  }
+
+  //! masked pixels (valid[ col ] == 0) get nodata class and zero confidence
+  void maskRow( const unsigned char* valid, int xSize, unsigned char nodata, unsigned char* outData, unsigned char* confData )
+  {
+    for ( int col = 0; col < xSize; ++col )
+    {
+      if ( valid[ col ] )
+        continue;
+      outData[ col ] = nodata;
+      if ( confData )
+        confData[ col ] = 0;
+    }
+  }
+
+  //! fully masked row goes to every output without reading or classifying it
+  void writeMaskedRow( const QList<GDALDataset*>& outRasters, const QList<GDALDataset*>& confRasters, int row, int xSize, unsigned char nodata )
+  {
+    QVector<unsigned char> outData( xSize, nodata );
+    QVector<unsigned char> confData( xSize, 0 );
+    for ( int m = 0; m < outRasters.size(); ++m )
+    {
+      outRasters.at( m )->RasterIO( GF_Write, 0, row, xSize, 1, (void *)outData.data(), xSize, 1, GDT_Byte, 1, 0, 0, 0, 0 );
+      if ( confRasters.at( m ) )
+        confRasters.at( m )->RasterIO( GF_Write, 0, row, xSize, 1, (void *)confData.data(), xSize, 1, GDT_Byte, 1, 0, 0, 0, 0 );
+    }
+  }
+
+  /** predictions for every sample of one or two uint8 bands, sample (v0, v1)
+    is at v0 + 256 * v1. Pixels are then looked up instead of walking trees.
+    Confidences go to confTable when it is not NULL
+    */
+  template<typename Predictor>
+  QVector<unsigned char> byteTable( const Predictor& predictor, int bandCount, QVector<unsigned char>* confTable )
+  {
+    QVector<unsigned char> table( bandCount == 1 ? 256 : 256 * 256 );
+    if ( confTable )
+      confTable->resize( table.size() );
+    unsigned char sample[ 2 ];
+    float confidence = 0;
+    for ( int i = 0; i < table.size(); ++i )
+    {
+      sample[ 0 ] = ( unsigned char )( i & 0xff );
+      sample[ 1 ] = ( unsigned char )( i >> 8 );
+      table[ i ] = ( unsigned char )predictor.predict( sample, 1, confTable ? &confidence : NULL );
+      if ( confTable )
+        ( *confTable )[ i ] = confidenceByte( confidence );
+    }
+    return table;
+  }
+
+  /** object-based classification of a strip of rows laid out as Classify
+    reads them: tiles of tileSize columns are split into SLIC segments and
+    every segment gets the prediction of its mean values. Pixels of valid
+    (if not NULL) with 0 stay out of the segments and get class 0, they are
+    masked afterwards. Classes (and confidences when confStrips[ m ] is not
+    empty) of model m go to outStrips[ m ], segments are counted to segmentCount
+    */
+  template<typename Predictor>
+  void classifyStrip( SlicSegmenter& segmenter, const QVector<Predictor>& predictors, const float* strip,
+                      const unsigned char* valid, int rows, int xSize, int varCount, int tileSize, QList< QVector<unsigned char> >& outStrips,
+                      QList< QVector<unsigned char> >& confStrips, qint64& segmentCount )
+  {
+    std::vector<int> labels;
+    std::vector<float> means;
+    std::vector<unsigned char> values;
+    std::vector<unsigned char> confidences;
+    for ( int x0 = 0; x0 < xSize; x0 += tileSize )
+    {
+      int width = qMin( tileSize, xSize - x0 );
+      int segments = segmenter.segment( strip + x0, valid ? valid + x0 : NULL, varCount, width, rows, xSize, labels );
+      SlicSegmenter::segmentMeans( strip + x0, varCount, width, rows, xSize, labels, segments, means );
+      segmentCount += segments;
+
+      for ( int m = 0; m < predictors.size(); ++m )
+      {
+        bool withConfidence = !confStrips.at( m ).isEmpty();
+        values.resize( segments );
+        confidences.resize( segments );
+        for ( int s = 0; s < segments; ++s )
+        {
+          float confidence = 0;
+          values[ s ] = ( unsigned char )predictors[ m ].predict( &means[ ( size_t )s * varCount ], 1, withConfidence ? &confidence : NULL );
+          confidences[ s ] = confidenceByte( confidence );
+        }
+
+        unsigned char* out = outStrips[ m ].data();
+        unsigned char* conf = withConfidence ? confStrips[ m ].data() : NULL;
+        for ( int y = 0; y < rows; ++y )
+        {
+          const int* lineLabels = &labels[ ( size_t )y * width ];
+          for ( int x = 0; x < width; ++x )
+          {
+            int s = lineLabels[ x ];
+            out[ y * xSize + x0 + x ] = s >= 0 ? values[ s ] : 0;
+            if ( conf )
+              conf[ y * xSize + x0 + x ] = s >= 0 ? confidences[ s ] : 0;
+          }
+        }
+      }
+    }
+  }
+
+  //! classify row of one or two 8-bit bands with byteTable()
+  void lookupRow( const QVector<unsigned char>& table, const QVector<char>& rowData, int xSize, int bandCount, QVector<unsigned char>& outData )
+  {
+    const unsigned char* lut = table.constData();
+    const unsigned char* first = ( const unsigned char* )rowData.constData();
+    unsigned char* out = outData.data();
+    if ( bandCount == 1 )
+    {
+      for ( int col = 0; col < xSize; ++col )
+        out[ col ] = lut[ first[ col ] ];
+      return;
+    }
+    const unsigned char* second = first + xSize;
+    for ( int col = 0; col < xSize; ++col )
+      out[ col ] = lut[ first[ col ] | ( second[ col ] << 8 ) ];
+  }
+}
+
 Classify::Classify(ClassifierWorkerConfig* config, ClassifierWorkerEnv* env)
     : ClassifierWorkerStep(config, env)
 {
@@ -1024,60 +2158,476 @@ Classify::~Classify()
 
 size_t Classify::stepCount()
 {
-    return mEnv->mResultInputRasterFileInfo->ySize();
+    return mEnv->mWindow.height();
 }
 
 void Classify::validate()
 {
-    if (!mEnv->mResultInputRasterFileInfo || (!mEnv->mDTree && !mEnv->mRTree))
+    if (!mEnv->mResultInputRasterFileInfo || (!mEnv->mDTree && !mEnv->mRTree && !mEnv->mModel))
         throw std::runtime_error("There are no input raster info or model in ClassifierWorkerEnv");
 }
 
-void Classify::doWork()
+GDALDataset* Classify::createOutputRaster( const QString& fileName, double nodata ) const
 {
     GDALDriver *driver = GetGDALDriverManager()->GetDriverByName( "GTiff" );
     GDALDataset *outRaster = driver->Create(
-      mConfig->mOutputRaster.toUtf8(),
-      mEnv->mResultInputRasterFileInfo->xSize(),
-      mEnv->mResultInputRasterFileInfo->ySize(),
+      fileName.toUtf8(),
+      mEnv->mWindow.width(),
+      mEnv->mWindow.height(),
       1,
       GDT_Byte,
       NULL
     );
+    if ( outRaster == NULL )
+      throw std::runtime_error( QString( "Can't create raster %1" ).arg( fileName ).toStdString() );
+
+    // origin moves to the top left pixel of the window
     double geotransform[6];
     mEnv->mResultInputRasterFileInfo->geoTransform( geotransform );
+    geotransform[0] += mEnv->mWindow.x() * geotransform[1] + mEnv->mWindow.y() * geotransform[2];
+    geotransform[3] += mEnv->mWindow.x() * geotransform[4] + mEnv->mWindow.y() * geotransform[5];
 
     outRaster->SetGeoTransform( geotransform );
     outRaster->SetProjection( mEnv->mResultInputRasterFileInfo->projection().toUtf8() );
-    QgsDebugMsg(QString("Output raster created"));
+    outRaster->GetRasterBand( 1 )->SetNoDataValue( nodata );
+    QgsDebugMsg(QString("Output raster created: %1").arg(fileName));
+    return outRaster;
+}
+
+void Classify::doWork()
+{
+    // every model writes own raster, input rows are read once for all of them
+    QStringList outputRasters = QStringList() << mConfig->mOutputRaster << mConfig->mExtraOutputRasters;
+    QList<const TreeModel*> models;
+    QList<const TreeModel*> firstStages;
+    QList< QSharedPointer<TreeModel> > ownModels;
+
+    // OpenCV models are flattened, so every model reads the same row buffers
+    const TreeModel* model = mEnv->mModel;
+    if ( !model )
+    {
+      QSharedPointer<TreeModel> converted( mConfig->use_decision_tree ? TreeModel::fromCvDTree( mEnv->mDTree ) : TreeModel::fromCvRTrees( mEnv->mRTree ) );
+      ownModels << converted;
+      model = converted.data();
+    }
+    models << model;
+    firstStages << mEnv->mCascadeModel;
+    for ( int m = 0; m < mEnv->mExtraModels.size(); ++m )
+    {
+      models << mEnv->mExtraModels.at( m );
+      firstStages << mEnv->mExtraCascadeModels.at( m );
+    }
+
+    // variables are the raster bands followed by derived features
+    int rasterBandCount = mEnv->mResultInputRasterFileInfo->bandCount();
+    int featureCount = mEnv->mFeatures ? mEnv->mFeatures->count() : 0;
 
-    QVector<float> rasterData( mEnv->mResultInputRasterFileInfo->xSize() * mEnv->mResultInputRasterFileInfo->bandCount() );
-    CvMat* sample = cvCreateMat( mEnv->mResultInputRasterFileInfo->bandCount(), 1, CV_32F );
-    QVector<unsigned char> outData( mEnv->mResultInputRasterFileInfo->xSize() );
+    // only bands the trees split on are read, the models are renumbered to them
+    std::vector<int> usedVars;
+    for ( int m = 0; m < models.size(); ++m )
+    {
+      if ( models.at( m )->varCount() > rasterBandCount + featureCount
+           || ( firstStages.at( m ) && firstStages.at( m )->varCount() > rasterBandCount + featureCount ) )
+        throw std::runtime_error( QString( "Model %1 needs more bands than the input raster has (derived features included)" ).arg( m + 1 ).toStdString() );
+      std::vector<int> vars = models.at( m )->usedVars();
+      usedVars.insert( usedVars.end(), vars.begin(), vars.end() );
+      if ( firstStages.at( m ) )
+      {
+        vars = firstStages.at( m )->usedVars();
+        usedVars.insert( usedVars.end(), vars.begin(), vars.end() );
+      }
+    }
+    std::sort( usedVars.begin(), usedVars.end() );
+    usedVars.erase( std::unique( usedVars.begin(), usedVars.end() ), usedVars.end() );
+
+    // used features are computed from the bands they reference, textures
+    // slide own row windows and aggregates read the time series
+    std::vector<int> readBands;
+    QVector<int> usedFeatures;
+    for ( size_t i = 0; i < usedVars.size(); ++i )
+    {
+      if ( usedVars[ i ] < rasterBandCount )
+      {
+        readBands.push_back( usedVars[ i ] );
+        continue;
+      }
+      usedFeatures << usedVars[ i ] - rasterBandCount;
+      if ( !mEnv->mFeatures->isBandMath( usedFeatures.last() ) )
+        continue;
+      std::vector<int> bands = mEnv->mFeatures->expression( usedFeatures.last() ).bands();
+      readBands.insert( readBands.end(), bands.begin(), bands.end() );
+    }
+    std::sort( readBands.begin(), readBands.end() );
+    readBands.erase( std::unique( readBands.begin(), readBands.end() ), readBands.end() );
+    if ( readBands.empty() )
+      readBands.push_back( 0 );
+    int bandCount = (int)readBands.size();
+    QVector<int> bandMap( bandCount );
+    for ( int i = 0; i < bandCount; ++i )
+      bandMap[ i ] = readBands[ i ] + 1;
 
-    for ( int row = 0; row < mEnv->mResultInputRasterFileInfo->ySize(); ++row )
+    // row buffer holds the read bands and then the used features
+    if ( bandCount < rasterBandCount || featureCount > 0 )
     {
-      mEnv->mInRaster->RasterIO( GF_Read, 0, row, mEnv->mResultInputRasterFileInfo->xSize(), 1, (void *)rasterData.data(), mEnv->mResultInputRasterFileInfo->xSize(), 1, GDT_Float32, mEnv->mResultInputRasterFileInfo->bandCount(), 0, 0, 0, 0 );
-      for ( int col = 0; col < mEnv->mResultInputRasterFileInfo->xSize(); ++col )
+      std::vector<int> varMap( rasterBandCount + featureCount, -1 );
+      for ( int i = 0; i < bandCount; ++i )
+        varMap[ readBands[ i ] ] = i;
+      for ( int i = 0; i < usedFeatures.size(); ++i )
+        varMap[ rasterBandCount + usedFeatures[ i ] ] = bandCount + i;
+      int varCount = bandCount + usedFeatures.size();
+      for ( int m = 0; m < models.size(); ++m )
       {
-        for ( int j = 0; j < mEnv->mResultInputRasterFileInfo->bandCount(); j++)
+        QSharedPointer<TreeModel> remapped( new TreeModel( *models.at( m ) ) );
+        remapped->remapVars( varMap, varCount );
+        ownModels << remapped;
+        models[ m ] = remapped.data();
+        if ( firstStages.at( m ) )
         {
-          cvmSet( sample, j, 0, rasterData[ mEnv->mResultInputRasterFileInfo->xSize() * j + col ] );
+          QSharedPointer<TreeModel> remappedFirstStage( new TreeModel( *firstStages.at( m ) ) );
+          remappedFirstStage->remapVars( varMap, varCount );
+          ownModels << remappedFirstStage;
+          firstStages[ m ] = remappedFirstStage.data();
         }
+      }
+    }
+    QgsDebugMsg( QString("Classify %1 models, reads %2 of %3 bands, computes %4 of %5 derived features").arg( models.size() ).arg( bandCount ).arg( rasterBandCount ).arg( usedFeatures.size() ).arg( featureCount ) );
 
-        if ( mConfig->use_decision_tree )
+    // confidence rasters are written in the same row loop
+    QList<GDALDataset*> outRasters;
+    QList<GDALDataset*> confRasters;
+    try
+    {
+      for ( int m = 0; m < outputRasters.size(); ++m )
+      {
+        outRasters << createOutputRaster( outputRasters.at( m ), mConfig->nodata_class );
+        confRasters << ( mConfig->write_confidence ? createOutputRaster( confidenceFileName( outputRasters.at( m ) ), 0 ) : NULL );
+      }
+      classifyRows( models, firstStages, bandMap, usedFeatures, outRasters, confRasters );
+    }
+    catch ( ... )
+    {
+      closeRasters( outRasters, confRasters );
+      throw;
+    }
+    closeRasters( outRasters, confRasters );
+}
+
+void Classify::closeRasters( const QList<GDALDataset*>& outRasters, const QList<GDALDataset*>& confRasters )
+{
+    for ( int m = 0; m < outRasters.size(); ++m )
+      GDALClose( (GDALDatasetH) outRasters.at( m ) );
+    for ( int m = 0; m < confRasters.size(); ++m )
+    {
+      if ( confRasters.at( m ) )
+        GDALClose( (GDALDatasetH) confRasters.at( m ) );
+    }
+}
+
+QString Classify::confidenceFileName( const QString& outputRaster )
+{
+    QFileInfo fi( outputRaster );
+    return fi.absoluteDir().absolutePath() + "/" + fi.baseName() + "_confidence.tif";
+}
+
+void Classify::classifyRows( const QList<const TreeModel*>& models, const QList<const TreeModel*>& firstStages,
+                             const QVector<int>& bandMap, const QVector<int>& features,
+                             const QList<GDALDataset*>& outRasters, const QList<GDALDataset*>& confRasters )
+{
+    // rows and columns of the window are read, output row is row - y0
+    int x0 = mEnv->mWindow.x();
+    int y0 = mEnv->mWindow.y();
+    int xSize = mEnv->mWindow.width();
+    int lastRow = mEnv->mWindow.bottom();
+    int bandCount = bandMap.size();
+    QVector<unsigned char> outData( xSize );
+    QVector<unsigned char> confData( xSize );
+
+    // nodata and masked pixels are not classified, rows without valid
+    // pixels are not even read
+    QStringList maskPaths;
+    if ( !mConfig->mMask.isEmpty() )
+      maskPaths << mConfig->mMask;
+    if ( !mConfig->mAoi.isEmpty() )
+      maskPaths << mConfig->mAoi;
+    PixelMask mask( mEnv->mInRaster, bandMap, maskPaths, x0, xSize );
+    QVector<unsigned char> valid( xSize, 1 );
+    const unsigned char* validRow = mask.isEmpty() ? NULL : valid.constData();
+    unsigned char nodata = (unsigned char)mConfig->nodata_class;
+    int maskedRows = 0;
+
+    // forest voting may stop when the leading class is this many votes ahead
+    QVector<int> exitMargins( models.size(), 0 );
+    if ( mConfig->vote_margin > 0 )
+    {
+      for ( int m = 0; m < models.size(); ++m )
+        exitMargins[ m ] = qMax( 1, (int)ceil( mConfig->vote_margin * models.at( m )->treeCount() ) );
+    }
+
+    // integer rasters are classified on native pixels with integer thresholds,
+    // derived features and segment means are float
+    GDALDataType nativeType = features.isEmpty() && mConfig->segment_size <= 0 ? nativeIntegerType( mEnv->mInRaster, bandMap ) : GDT_Unknown;
+    if ( nativeType != GDT_Unknown )
+    {
+      QgsDebugMsg( QString("Classify native %1 pixels").arg( GDALGetDataTypeName( nativeType ) ) );
+      int typeSize = GDALGetDataTypeSize( nativeType ) / 8;
+
+      QList< QSharedPointer<QuantizedTreeModel> > quantized;
+      QVector< RowPredictor<QuantizedTreeModel> > predictors( models.size() );
+      QList< QVector<unsigned char> > tables;
+      QList< QVector<unsigned char> > confTables;
+      QList< QSharedPointer<PredictionCache> > caches;
+      for ( int m = 0; m < models.size(); ++m )
+      {
+        QSharedPointer<QuantizedTreeModel> model( new QuantizedTreeModel( models.at( m ) ) );
+        QSharedPointer<QuantizedTreeModel> firstStage;
+        if ( firstStages.at( m ) )
+          firstStage = QSharedPointer<QuantizedTreeModel>( new QuantizedTreeModel( firstStages.at( m ) ) );
+        quantized << model << firstStage;
+
+        predictors[ m ].model = model.data();
+        predictors[ m ].firstStage = firstStage.data();
+        predictors[ m ].firstStageNodes = firstStages.at( m ) ? firstStages.at( m )->nodes() : NULL;
+        predictors[ m ].minPurity = (float)mConfig->cascade_purity;
+        predictors[ m ].exitMargin = exitMargins[ m ];
+
+        // one or two 8-bit bands have at most 65536 distinct samples, the model
+        // is evaluated for all of them once and pixels are looked up
+        QVector<unsigned char> table;
+        QVector<unsigned char> confTable;
+        if ( nativeType == GDT_Byte && bandCount <= 2 )
         {
-          outData[ col ] = (unsigned char)mEnv->mDTree->predict( sample )->value;
+          table = byteTable( predictors[ m ], bandCount, confRasters.at( m ) ? &confTable : NULL );
+          QgsDebugMsg( QString("Classify with %1 entries lookup table").arg( table.size() ) );
         }
-        else
+        tables << table;
+        confTables << confTable;
+
+        QSharedPointer<PredictionCache> cache;
+        if ( mConfig->prediction_cache > 0 && table.isEmpty() )
+          cache = QSharedPointer<PredictionCache>( new PredictionCache( bandCount * typeSize, mConfig->prediction_cache ) );
+        caches << cache;
+      }
+
+      QVector<char> rowData( xSize * bandCount * typeSize );
+      for ( int row = y0; row <= lastRow; ++row )
+      {
+        if ( validRow && !mask.readRow( row, valid.data() ) )
+        {
+          writeMaskedRow( outRasters, confRasters, row - y0, xSize, nodata );
+          maskedRows++;
+          nextStep();
+          continue;
+        }
+        mEnv->mInRaster->RasterIO( GF_Read, x0, row, xSize, 1, (void *)rowData.data(), xSize, 1, nativeType, bandCount, (int *)bandMap.constData(), 0, 0, 0 );
+        for ( int m = 0; m < models.size(); ++m )
         {
-          outData[ col ] = (unsigned char)mEnv->mRTree->predict( sample );
+          QVector<unsigned char>* conf = confRasters.at( m ) ? &confData : NULL;
+          switch ( nativeType )
+          {
+            case GDT_Byte:
+              if ( !tables.at( m ).isEmpty() )
+              {
+                lookupRow( tables.at( m ), rowData, xSize, bandCount, outData );
+                if ( conf )
+                  lookupRow( confTables.at( m ), rowData, xSize, bandCount, confData );
+              }
+              else
+                predictRow( predictors[ m ], (const unsigned char*)rowData.constData(), validRow, xSize, bandCount, caches.at( m ).data(), outData, conf );
+              break;
+            case GDT_UInt16:
+              predictRow( predictors[ m ], (const unsigned short*)rowData.constData(), validRow, xSize, bandCount, caches.at( m ).data(), outData, conf );
+              break;
+            default:
+              predictRow( predictors[ m ], (const short*)rowData.constData(), validRow, xSize, bandCount, caches.at( m ).data(), outData, conf );
+              break;
+          }
+          if ( validRow )
+            maskRow( validRow, xSize, nodata, outData.data(), conf ? confData.data() : NULL );
+          outRasters.at( m )->RasterIO( GF_Write, 0, row - y0, xSize, 1, (void *)outData.data(), xSize, 1, GDT_Byte, 1, 0, 0, 0, 0 );
+          if ( conf )
+            confRasters.at( m )->RasterIO( GF_Write, 0, row - y0, xSize, 1, (void *)confData.data(), xSize, 1, GDT_Byte, 1, 0, 0, 0, 0 );
         }
+        nextStep();
+      }
+
+      if ( maskedRows > 0 )
+        QgsDebugMsg( QString("Skipped %1 fully masked rows").arg( maskedRows ) );
+      for ( int m = 0; m < caches.size(); ++m )
+      {
+        if ( caches.at( m ) )
+          emit messageReported( QString("Prediction cache of model %1: %2 hits, %3 misses, hit rate %4").arg( m + 1 ).arg( caches.at( m )->hits() ).arg( caches.at( m )->misses() ).arg( caches.at( m )->hitRate(), 0, 'f', 4 ) );
+      }
+      return;
+    }
+
+    // derived features are computed into rows after the bands, texture values
+    // depend on neighbors, so the cache key covers feature rows too
+    int rowCount = bandCount + features.size();
+    QVector< RowPredictor<TreeModel> > predictors( models.size() );
+    QList< QSharedPointer<PredictionCache> > caches;
+    for ( int m = 0; m < models.size(); ++m )
+    {
+      predictors[ m ].model = models.at( m );
+      predictors[ m ].firstStage = firstStages.at( m );
+      predictors[ m ].firstStageNodes = firstStages.at( m ) ? firstStages.at( m )->nodes() : NULL;
+      predictors[ m ].minPurity = (float)mConfig->cascade_purity;
+      predictors[ m ].exitMargin = exitMargins[ m ];
+
+      QSharedPointer<PredictionCache> cache;
+      if ( mConfig->prediction_cache > 0 && mConfig->segment_size <= 0 )
+        cache = QSharedPointer<PredictionCache>( new PredictionCache( rowCount * sizeof( float ), mConfig->prediction_cache ) );
+      caches << cache;
+    }
+
+    QVector<float> rasterData( xSize * rowCount );
+    QVector<const float*> bandRows( mEnv->mResultInputRasterFileInfo->bandCount(), NULL );
+    for ( int i = 0; i < bandCount; ++i )
+      bandRows[ bandMap[ i ] - 1 ] = rasterData.constData() + i * xSize;
+
+    // textures of the same band and window size share one sliding window
+    QList< QSharedPointer<TextureWindow> > windows;
+    QVector<int> windowOf( features.size(), -1 );
+    for ( int f = 0; f < features.size(); ++f )
+    {
+      if ( !mEnv->mFeatures->isTexture( features[ f ] ) )
+        continue;
+      const TextureKernel& kernel = mEnv->mFeatures->texture( features[ f ] );
+      for ( int w = 0; w < windows.size() && windowOf[ f ] < 0; ++w )
+      {
+        if ( windows.at( w )->band() == kernel.band() && windows.at( w )->radius() == kernel.radius() )
+          windowOf[ f ] = w;
+      }
+      if ( windowOf[ f ] < 0 )
+      {
+        windowOf[ f ] = windows.size();
+        windows << QSharedPointer<TextureWindow>( new TextureWindow( mEnv->mInRaster, kernel.band(), kernel.radius(), x0, xSize ) );
+      }
+    }
+
+    // aggregates of the same series band reduce one row of all scenes
+    const TimeSeriesStack* timeSeries = mEnv->mFeatures ? mEnv->mFeatures->timeSeries() : NULL;
+    QVector<int> seriesBands;
+    QVector<int> seriesOf( features.size(), -1 );
+    for ( int f = 0; f < features.size(); ++f )
+    {
+      if ( !mEnv->mFeatures->isAggregate( features[ f ] ) )
+        continue;
+      int band = mEnv->mFeatures->aggregate( features[ f ] ).band();
+      seriesOf[ f ] = seriesBands.indexOf( band );
+      if ( seriesOf[ f ] < 0 )
+      {
+        seriesOf[ f ] = seriesBands.size();
+        seriesBands << band;
+      }
+    }
+    int sceneCount = timeSeries ? timeSeries->sceneCount() : 0;
+    QVector<float> seriesData( sceneCount * xSize * seriesBands.size() );
+    std::vector<float> scratch;
+
+    // object-based mode gathers rows into strips of tileSize rows, which are
+    // segmented tile by tile and classified once per segment
+    QScopedPointer<SlicSegmenter> segmenter;
+    int tileSize = qMax( 256, 8 * mConfig->segment_size );
+    QVector<float> strip;
+    QVector<unsigned char> stripValid;
+    QList< QVector<unsigned char> > outStrips;
+    QList< QVector<unsigned char> > confStrips;
+    int stripFill = 0;
+    qint64 segmentCount = 0;
+    if ( mConfig->segment_size > 0 )
+    {
+      segmenter.reset( new SlicSegmenter( mConfig->segment_size, mConfig->segment_compactness ) );
+      strip.resize( tileSize * rowCount * xSize );
+      stripValid.resize( tileSize * xSize );
+      for ( int m = 0; m < models.size(); ++m )
+      {
+        outStrips << QVector<unsigned char>( tileSize * xSize );
+        confStrips << ( confRasters.at( m ) ? QVector<unsigned char>( tileSize * xSize ) : QVector<unsigned char>() );
+      }
+    }
+
+    for ( int row = y0; row <= lastRow; ++row )
+    {
+      // segments need every row of the strip, masked pixels are left out of them
+      bool rowValid = !validRow || mask.readRow( row, valid.data() );
+      if ( !rowValid )
+      {
+        maskedRows++;
+        if ( !segmenter )
+        {
+          writeMaskedRow( outRasters, confRasters, row - y0, xSize, nodata );
+          nextStep();
+          continue;
+        }
+        rasterData.fill( 0 );
+      }
+      else
+      {
+        mEnv->mInRaster->RasterIO( GF_Read, x0, row, xSize, 1, (void *)rasterData.data(), xSize, 1, GDT_Float32, bandCount, (int *)bandMap.constData(), 0, 0, 0 );
+        for ( int w = 0; w < windows.size(); ++w )
+          windows.at( w )->moveTo( row );
+        for ( int s = 0; s < seriesBands.size(); ++s )
+          timeSeries->readRow( seriesBands[ s ], row, seriesData.data() + s * sceneCount * xSize, x0, xSize );
+        for ( int f = 0; f < features.size(); ++f )
+        {
+          float* featureRow = rasterData.data() + ( bandCount + f ) * xSize;
+          if ( windowOf[ f ] >= 0 )
+            windows.at( windowOf[ f ] )->compute( mEnv->mFeatures->texture( features[ f ] ).stat(), featureRow );
+          else if ( seriesOf[ f ] >= 0 )
+            mEnv->mFeatures->aggregate( features[ f ] ).reduce( seriesData.constData() + seriesOf[ f ] * sceneCount * xSize, sceneCount, xSize, featureRow, scratch );
+          else
+            mEnv->mFeatures->expression( features[ f ] ).evaluate( bandRows.constData(), xSize, featureRow );
+        }
+      }
+
+      if ( segmenter )
+      {
+        memcpy( strip.data() + stripFill * rowCount * xSize, rasterData.constData(), sizeof( float ) * rowCount * xSize );
+        memcpy( stripValid.data() + stripFill * xSize, valid.constData(), xSize );
+        stripFill++;
+        if ( stripFill == tileSize || row == lastRow )
+        {
+          classifyStrip( *segmenter, predictors, strip.constData(), validRow ? stripValid.constData() : NULL, stripFill, xSize, rowCount, tileSize, outStrips, confStrips, segmentCount );
+          int firstRow = row - y0 - stripFill + 1;
+          for ( int m = 0; m < models.size(); ++m )
+          {
+            if ( validRow )
+            {
+              for ( int y = 0; y < stripFill; ++y )
+                maskRow( stripValid.constData() + y * xSize, xSize, nodata, outStrips[ m ].data() + y * xSize,
+                         confStrips.at( m ).isEmpty() ? NULL : confStrips[ m ].data() + y * xSize );
+            }
+            outRasters.at( m )->RasterIO( GF_Write, 0, firstRow, xSize, stripFill, (void *)outStrips[ m ].data(), xSize, stripFill, GDT_Byte, 1, 0, 0, 0, 0 );
+            if ( confRasters.at( m ) )
+              confRasters.at( m )->RasterIO( GF_Write, 0, firstRow, xSize, stripFill, (void *)confStrips[ m ].data(), xSize, stripFill, GDT_Byte, 1, 0, 0, 0, 0 );
+          }
+          stripFill = 0;
+        }
+        nextStep();
+        continue;
+      }
+
+      // flat models read band-sequential row buffer directly
+      for ( int m = 0; m < models.size(); ++m )
+      {
+        QVector<unsigned char>* conf = confRasters.at( m ) ? &confData : NULL;
+        predictRow( predictors[ m ], rasterData.constData(), validRow, xSize, rowCount, caches.at( m ).data(), outData, conf );
+        if ( validRow )
+          maskRow( validRow, xSize, nodata, outData.data(), conf ? confData.data() : NULL );
+        outRasters.at( m )->RasterIO( GF_Write, 0, row - y0, xSize, 1, (void *)outData.data(), xSize, 1, GDT_Byte, 1, 0, 0, 0, 0 );
+        if ( conf )
+          confRasters.at( m )->RasterIO( GF_Write, 0, row - y0, xSize, 1, (void *)confData.data(), xSize, 1, GDT_Byte, 1, 0, 0, 0, 0 );
       }
-      outRaster->RasterIO( GF_Write, 0, row, mEnv->mResultInputRasterFileInfo->xSize(), 1, (void *)outData.data(), mEnv->mResultInputRasterFileInfo->xSize(), 1, GDT_Byte, 1, 0, 0, 0, 0 );
       nextStep();
     }
 
-    GDALClose( (GDALDatasetH) outRaster );
-    cvReleaseMat( &sample );
-}
\ No newline at end of file
+    if ( maskedRows > 0 )
+      QgsDebugMsg( QString("Skipped %1 fully masked rows").arg( maskedRows ) );
+    if ( segmenter )
+      QgsDebugMsg( QString("Classified %1 segments instead of %2 pixels").arg( segmentCount ).arg( (qint64)xSize * mEnv->mWindow.height() ) );
+    for ( int m = 0; m < caches.size(); ++m )
+    {
+      if ( caches.at( m ) )
+        emit messageReported( QString("Prediction cache of model %1: %2 hits, %3 misses, hit rate %4").arg( m + 1 ).arg( caches.at( m )->hits() ).arg( caches.at( m )->misses() ).arg( caches.at( m )->hitRate(), 0, 'f', 4 ) );
+    }
+}
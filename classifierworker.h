@@ -23,9 +23,12 @@
 #include <exception>
 #include <stdexcept>
 
+#include <QList>
 #include <QObject>
+#include <QRect>
 #include <QString>
 #include <QStringList>
+#include <QVector>
 
 #include "opencv2/core/core_c.h"
 #include "opencv2/ml/ml.hpp"
@@ -42,13 +45,44 @@ struct ClassifierWorkerConfig
         use_decision_tree(false),
         discrete_classes(false),
         do_generalization(false),
-        kernel_size(3) {}
+        kernel_size(3),
+        use_arrow_stream(true),
+        threads_count(0),
+        random_seed(0),
+        use_histogram_split(false),
+        cv_folds(10),
+        max_depth(0),
+        min_sample_count(10),
+        max_categories(10),
+        trees_count(50),
+        forest_accuracy(0.1),
+        active_vars(0),
+        target_pixels_per_second(0),
+        search_random(0),
+        memory_budget_mb(0),
+        shard_index(0),
+        shard_count(1),
+        update_model(false),
+        max_trees(0),
+        compact_model(false),
+        prediction_cache(0),
+        vote_margin(0),
+        cascade_depth(0),
+        cascade_purity(0.95),
+        write_confidence(false),
+        segment_size(0),
+        segment_compactness(1.0),
+        nodata_class(255) {}
 
     QString mOutputRaster;
     QString mOutputModel;
     QString mOutputTrainLayer;
 
     QString mInputModel;
+    // further models applied in the same Classify pass over the input, model i
+    // writes mExtraOutputRasters[ i ]
+    QStringList mExtraInputModels;
+    QStringList mExtraOutputRasters;
     QString mInputPoints;
     QStringList mInputRasters;
     QStringList mPresence;
@@ -61,23 +95,143 @@ struct ClassifierWorkerConfig
     bool do_generalization;
     size_t kernel_size;
 
+    // read train vectors through OGR ArrowArrayStream when GDAL supports it
+    bool use_arrow_stream;
+
+    // 0 - use all available cores
+    int threads_count;
+    // seed of random trees, each tree derives own seed from it
+    quint64 random_seed;
+
+    // train on bands quantized into 256 bins, model is saved as TreeModel
+    bool use_histogram_split;
+
+    // decision tree is pruned by K fold cross-validation, <= 1 - no pruning
+    int cv_folds;
+
+    // tree limits, max_depth 0 - 8 for decision tree and 5 for random trees
+    int max_depth;
+    int min_sample_count;
+    int max_categories;
+
+    // random trees: forest size, out-of-bag error to stop adding trees at
+    // and variables tried at every node (0 - square root of bands count)
+    int trees_count;
+    double forest_accuracy;
+    int active_vars;
+
+    // when > 0 depth and forest size are reduced until predict of calibration
+    // pixels runs at least that fast
+    double target_pixels_per_second;
+
+    // hyperparameter search grid, e.g. "max_depth=4,6,8 trees=20,50", the best
+    // candidate is saved as the model; search_random > 0 tries that many grid points
+    QString mSearch;
+    int search_random;
+
+    // training-set files (see TrainSetReader) to train from instead of train layer,
+    // several files are merged into one, and file to write extracted samples to
+    QStringList mInputTrainSets;
+    QString mOutputTrainSet;
+    // when > 0 samples are streamed from a training-set file and PrepareModel
+    // keeps its memory within that many megabytes, model is saved as TreeModel
+    int memory_budget_mb;
+
+    // extract samples only from raster tiles of shard shard_index of shard_count,
+    // shards are merged later with mInputTrainSets
+    int shard_index;
+    int shard_count;
+
+    // train trees on the new samples only and append them to the forest of
+    // mInputModel, max_trees > 0 drops the oldest trees above that count
+    bool update_model;
+    int max_trees;
+
+    // compact trained model before save (see TreeModel::compact), OpenCV
+    // models are converted to TreeModel
+    bool compact_model;
+
+    // CSV report of splits per band of the prepared model
+    QString mOutputImportance;
+
+    // entries of the cache of predictions by pixel values across bands, 0 - no cache
+    int prediction_cache;
+
+    // random forest voting stops when the leading class is ahead by this share
+    // of the trees, 0 - only when the remaining trees can't change the winner
+    double vote_margin;
+
+    // cascade: a single tree of cascade_depth (0 - no cascade) is trained too,
+    // pixels reaching its leaves of at least cascade_purity skip the model.
+    // It is saved and loaded next to the model as <model>_cascade.<ext>
+    int cascade_depth;
+    double cascade_purity;
+
+    // every classified raster gets <output>_confidence.tif with vote share of
+    // the winning class (leaf purity for a single tree) scaled to 0..255
+    bool write_confidence;
+
+    // band math expressions like "(b4 - b3) / (b4 + b3)" or "t2.b1 - t1.b1"
+    // (see BandExpression) and window statistics like "var(b4, 5)" (see
+    // TextureKernel), their values follow the band values in training
+    // samples and classified pixels
+    QStringList mFeatures;
+
+    // time series: same-grid scenes in date order, never stacked into the
+    // input raster. Features like "mean(ts.b1)" or "p90(ts.b2)" (see
+    // TemporalAggregate) reduce them per pixel, mAggregates (e.g. "min",
+    // "mean", "p90", "slope") adds such features for every series band after
+    // mFeatures
+    QStringList mTimeSeries;
+    QStringList mAggregates;
+
+    // object-based classification: Classify splits the input into SLIC
+    // segments of about segment_size pixels across (0 - classify pixels) and
+    // classifies every segment once by its mean values, see SlicSegmenter
+    int segment_size;
+    double segment_compactness;
+
+    // pixels that are nodata or masked by GDAL mask bands of the input, or
+    // outside mMask (raster on the input grid, nonzero is valid, or polygons
+    // of the valid area), are not classified and get nodata_class, which is
+    // the nodata value of the output rasters
+    QString mMask;
+    int nodata_class;
+
+    // region of interest: Classify and the results cover only mWindow,
+    // "minx,miny,maxx,maxy" in map units of the input raster or
+    // "px:col,row,width,height" in pixels, and/or the extent of mAoi
+    // polygons. Pixels outside mAoi polygons are masked like mMask
+    QString mWindow;
+    QString mAoi;
+
+    bool needToTrain()
+    {
+        return mInputModel.isEmpty() || update_model;
+    }
+
     bool needToPrepareRaster()
     {
         if (!mOutputRaster.isEmpty())
             return true;
         if (!mOutputModel.isEmpty())
-            if (mInputModel.isEmpty() && mInputPoints.isEmpty())
+            if (needToTrain() && mInputPoints.isEmpty() && mInputTrainSets.isEmpty())
                 return true;
         if (!mOutputTrainLayer.isEmpty())
             if (mInputPoints.isEmpty())
                 return true;
+        if (!mOutputTrainSet.isEmpty())
+            if (mInputPoints.isEmpty() && mInputTrainSets.isEmpty())
+                return true;
 
         return false;
     }
 
     bool needToCreateTrainLayer()
     {
-        if (!mInputModel.isEmpty())
+        if (!needToTrain())
+            return false;
+        if (!mInputTrainSets.isEmpty())
             return false;
         return true;
     }
@@ -93,20 +247,39 @@ struct ClassifierWorkerConfig
     }
 };
 
+class DerivedFeatures;
 class GDALDataset;
+class TimeSeriesStack;
+class LatencyTuner;
+class HistogramTreeTrainer;
+struct HistogramTreeParams;
+class ParallelRTrees;
+class TreeModel;
 
 struct ClassifierWorkerEnv
 {
     RasterFileInfo* mResultInputRasterFileInfo;
     GDALDataset* mInRaster;
+    // derived features of mFeatures, NULL - none
+    DerivedFeatures* mFeatures;
+    // pixels of mInRaster that are classified, see mWindow and mAoi of config
+    QRect mWindow;
 
     QgsVectorLayer* mTrainLayer;
     
     CvMat* mTrainData;
     CvMat* mTrainResponses;
+    // training-set file for out-of-core training
+    QString mTrainSetFile;
 
     CvDTree* mDTree;
     CvRTrees* mRTree;
+    TreeModel* mModel;
+    // first stage of cascade classification, NULL - none
+    TreeModel* mCascadeModel;
+    // models of mExtraInputModels and their cascades (NULL - none)
+    QList<TreeModel*> mExtraModels;
+    QList<TreeModel*> mExtraCascadeModels;
 };
 
 
@@ -142,6 +315,8 @@ class ClassifierWorker : public QObject
         void subStepCount(int count);
         void progressSubStep(int count);
         void errorOccured(QString msg);
+        //! statistics and notes for the user, not errors
+        void messageReported(QString msg);
         void finished();
 };
 
@@ -167,6 +342,7 @@ class ClassifierWorkerStep : public QObject
         void started(size_t count);
         void nextStep();
         void errorOccured(QString msg);
+        void messageReported(QString msg);
         void finished();
 };
 
@@ -183,10 +359,19 @@ class PrepareInputRaster : public ClassifierWorkerStep
         bool mResultInputRasterFileNameIsTemp;
         RasterFileInfo mResultInputRasterFileInfo;
         GDALDataset *mInRaster;
+        DerivedFeatures* mFeatures;
+        TimeSeriesStack* mTimeSeries;
 
         void doWork();
         size_t stepCount();
         void validate();
+
+        //! window of the stacked raster to classify from config. Throws std::runtime_error
+        QRect classificationWindow();
+        //! pixels covering the map rectangle, not clipped to the raster
+        QRect mapWindow( double minX, double minY, double maxX, double maxY );
+        //! extent of polygons of all layers of the AOI file in pixels. Throws std::runtime_error
+        QRect aoiWindow( const QString& path );
 };
 
 class CreateTrainLayer : public ClassifierWorkerStep
@@ -203,6 +388,9 @@ class CreateTrainLayer : public ClassifierWorkerStep
         size_t stepCount();
         void validate();
 
+        //! true when the pixel is sampled by this process, see shard_index
+        bool inShard( double col, double row ) const;
+
         void createTrainLayer();
         //! merge multiple vectors with different geometry into one point in-memory layer
         void mergeLayers( QgsVectorLayer* outLayer, const QStringList& layers, GDALDataset* raster, int layerType );
@@ -224,10 +412,16 @@ class CreateTrainData : public ClassifierWorkerStep
     private:
         CvMat* mTrainData;
         CvMat* mTrainResponses;
+        QString mTrainSetFileName;
+        bool mTrainSetFileNameIsTemp;
 
         void doWork();
         size_t stepCount();
         void validate();
+
+        //! load training-set file into train matrices
+        QString tempTrainSetFileName();
+        void readTrainSet( const QString& fileName );
 };
 
 class PrepareModel : public ClassifierWorkerStep
@@ -239,11 +433,38 @@ class PrepareModel : public ClassifierWorkerStep
     
     private:
         CvDTree* mDTree;
-        CvRTrees* mRTree;
+        ParallelRTrees* mRTree;
+        TreeModel* mModel;
+        TreeModel* mCascadeModel;
+        QList<TreeModel*> mExtraModels;
+        QList<TreeModel*> mExtraCascadeModels;
 
         void doWork();
         size_t stepCount();
         void validate();
+
+        //! train model of configured kind with given depth and forest size
+        void train( HistogramTreeTrainer* trainer, int maxDepth, int treesCount, const TreeModel* loadedModel = NULL );
+        //! trees appended to loadedModel (if not NULL) follow its kind. Throws std::runtime_error when bands differ
+        HistogramTreeParams histogramParams( int maxDepth, int treesCount, int varCount, const TreeModel* loadedModel = NULL ) const;
+        int treeCount() const;
+        //! keep first count trees of the forest
+        void truncateForest( int count );
+        //! append trees trained on new samples to the loaded forest, drop the oldest above max_trees
+        void appendToLoaded( TreeModel* loadedModel, ParallelRTrees* loadedForest );
+        //! replace trained model with compacted TreeModel
+        void compactModel();
+        //! write band importance report if configured, hand the model over to the next steps
+        void finishModel();
+        void writeImportance( const QString& fileName ) const;
+        //! train the single shallow tree of the cascade first stage
+        void trainCascade( HistogramTreeTrainer* trainer );
+        static QString cascadeFileName( const QString& modelFileName );
+        //! load cascade first stage saved next to the model. Throws std::runtime_error
+        static TreeModel* loadCascade( const QString& modelFileName );
+        //! load model of any kind as TreeModel, OpenCV models are converted
+        TreeModel* loadFlatModel( const QString& fileName ) const;
+        double pixelsPerSecond( const LatencyTuner& tuner ) const;
 };
 
 class Classify : public ClassifierWorkerStep
@@ -257,6 +478,18 @@ class Classify : public ClassifierWorkerStep
         void doWork();
         size_t stepCount();
         void validate();
+
+        //! byte raster of input size and georeference with nodata value. Throws std::runtime_error
+        GDALDataset* createOutputRaster( const QString& fileName, double nodata ) const;
+        //! read rows of bandMap bands once, compute derived features of given indices
+        //! after them and classify the rows with every model
+        void classifyRows( const QList<const TreeModel*>& models, const QList<const TreeModel*>& firstStages,
+                           const QVector<int>& bandMap, const QVector<int>& features,
+                           const QList<GDALDataset*>& outRasters, const QList<GDALDataset*>& confRasters );
+        //! confidence rasters may be NULL
+        static void closeRasters( const QList<GDALDataset*>& outRasters, const QList<GDALDataset*>& confRasters );
+        //! <output>_confidence.tif next to the output raster
+        static QString confidenceFileName( const QString& outputRaster );
 };
 
 #endif // CLASSIFIERWORKER_H
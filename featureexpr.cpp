@@ -0,0 +1,320 @@
+/***************************************************************************
+  featureexpr.cpp
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "featureexpr.h"
+
+BandExpression::BandExpression( const QString& text, const QVector<int>& rasterBands )
+    : mText( text.trimmed() ),
+      mRasterBands( rasterBands ),
+      mBandCount( 0 ),
+      mDepth( 0 ),
+      mMaxDepth( 0 ),
+      mPos( 0 )
+{
+  for ( int i = 0; i < rasterBands.size(); ++i )
+    mBandCount += rasterBands[ i ];
+
+  parseSum();
+  skipSpaces();
+  if ( mPos < mText.size() )
+    fail( QString( "unexpected '%1'" ).arg( mText.at( mPos ) ) );
+}
+
+std::vector<int> BandExpression::bands() const
+{
+  std::vector<int> result;
+  for ( size_t i = 0; i < mOps.size(); ++i )
+  {
+    if ( mOps[ i ].code == PushBand )
+      result.push_back( mOps[ i ].band );
+  }
+  std::sort( result.begin(), result.end() );
+  result.erase( std::unique( result.begin(), result.end() ), result.end() );
+  return result;
+}
+
+int BandExpression::singleBand() const
+{
+  return mOps.size() == 1 && mOps[ 0 ].code == PushBand ? mOps[ 0 ].band : -1;
+}
+
+void BandExpression::evaluate( const float* const* bandRows, int n, float* out ) const
+{
+  if ( n <= 0 )
+    return;
+
+  // stack of mMaxDepth arrays, the result is left in the first one
+  std::vector<float> stack( ( size_t )mMaxDepth * n );
+  size_t depth = 0;
+  for ( size_t i = 0; i < mOps.size(); ++i )
+  {
+    const Op& op = mOps[ i ];
+    switch ( op.code )
+    {
+      case PushBand:
+        memcpy( &stack[ depth++ * n ], bandRows[ op.band ], sizeof( float ) * n );
+        break;
+      case PushConst:
+        std::fill( stack.begin() + depth * n, stack.begin() + ( depth + 1 ) * n, op.value );
+        depth++;
+        break;
+      case Neg:
+      {
+        float* a = &stack[ ( depth - 1 ) * n ];
+        for ( int p = 0; p < n; ++p )
+          a[ p ] = -a[ p ];
+        break;
+      }
+      default:
+      {
+        float* a = &stack[ ( depth - 2 ) * n ];
+        const float* b = a + n;
+        if ( op.code == Add )
+          for ( int p = 0; p < n; ++p )
+            a[ p ] += b[ p ];
+        else if ( op.code == Sub )
+          for ( int p = 0; p < n; ++p )
+            a[ p ] -= b[ p ];
+        else if ( op.code == Mul )
+          for ( int p = 0; p < n; ++p )
+            a[ p ] *= b[ p ];
+        else
+          for ( int p = 0; p < n; ++p )
+            a[ p ] = b[ p ] != 0 ? a[ p ] / b[ p ] : 0;
+        depth--;
+        break;
+      }
+    }
+  }
+  memcpy( out, &stack[ 0 ], sizeof( float ) * n );
+}
+
+void BandExpression::parseSum()
+{
+  parseProduct();
+  for ( ;; )
+  {
+    if ( accept( '+' ) )
+    {
+      parseProduct();
+      push( Add );
+    }
+    else if ( accept( '-' ) )
+    {
+      parseProduct();
+      push( Sub );
+    }
+    else
+      return;
+  }
+}
+
+void BandExpression::parseProduct()
+{
+  parseUnary();
+  for ( ;; )
+  {
+    if ( accept( '*' ) )
+    {
+      parseUnary();
+      push( Mul );
+    }
+    else if ( accept( '/' ) )
+    {
+      parseUnary();
+      push( Div );
+    }
+    else
+      return;
+  }
+}
+
+void BandExpression::parseUnary()
+{
+  if ( accept( '-' ) )
+  {
+    parseUnary();
+    push( Neg );
+    return;
+  }
+  if ( accept( '(' ) )
+  {
+    parseSum();
+    if ( !accept( ')' ) )
+      fail( "missing ')'" );
+    return;
+  }
+
+  skipSpaces();
+  if ( mPos >= mText.size() )
+    fail( "unexpected end" );
+
+  QChar c = mText.at( mPos ).toLower();
+  if ( c == 'b' || c == 't' )
+  {
+    parseBand();
+    return;
+  }
+  if ( !c.isDigit() && c != '.' )
+    fail( QString( "unexpected '%1'" ).arg( mText.at( mPos ) ) );
+
+  int begin = mPos;
+  while ( mPos < mText.size() && ( mText.at( mPos ).isDigit() || mText.at( mPos ) == '.' ) )
+    mPos++;
+  bool ok = false;
+  float value = mText.mid( begin, mPos - begin ).toFloat( &ok );
+  if ( !ok )
+    fail( QString( "bad number '%1'" ).arg( mText.mid( begin, mPos - begin ) ) );
+  push( PushConst, -1, value );
+}
+
+void BandExpression::parseBand()
+{
+  // bN - stacked band, tK.bN - band N of raster K
+  int offset = 0;
+  int limit = mBandCount;
+  if ( mText.at( mPos ).toLower() == 't' )
+  {
+    mPos++;
+    int raster = parseInt();
+    if ( raster < 1 || raster > mRasterBands.size() )
+      fail( QString( "there is no input raster t%1" ).arg( raster ) );
+    for ( int i = 0; i < raster - 1; ++i )
+      offset += mRasterBands[ i ];
+    limit = mRasterBands[ raster - 1 ];
+    if ( mPos >= mText.size() || mText.at( mPos ) != '.' )
+      fail( "'.' expected after raster number" );
+    mPos++;
+  }
+  if ( mPos >= mText.size() || mText.at( mPos ).toLower() != 'b' )
+    fail( "band reference expected" );
+  mPos++;
+  int band = parseInt();
+  if ( band < 1 || band > limit )
+    fail( QString( "band %1 is out of range 1..%2" ).arg( band ).arg( limit ) );
+  push( PushBand, offset + band - 1 );
+}
+
+void BandExpression::push( OpCode code, int band, float value )
+{
+  Op op;
+  op.code = code;
+  op.band = band;
+  op.value = value;
+  mOps.push_back( op );
+
+  if ( code == PushBand || code == PushConst )
+    mMaxDepth = std::max( mMaxDepth, ++mDepth );
+  else if ( code != Neg )
+    mDepth--;
+}
+
+bool BandExpression::accept( QChar c )
+{
+  skipSpaces();
+  if ( mPos < mText.size() && mText.at( mPos ) == c )
+  {
+    mPos++;
+    return true;
+  }
+  return false;
+}
+
+void BandExpression::skipSpaces()
+{
+  while ( mPos < mText.size() && mText.at( mPos ).isSpace() )
+    mPos++;
+}
+
+int BandExpression::parseInt()
+{
+  int begin = mPos;
+  while ( mPos < mText.size() && mText.at( mPos ).isDigit() )
+    mPos++;
+  if ( begin == mPos )
+    fail( "number expected" );
+  return mText.mid( begin, mPos - begin ).toInt();
+}
+
+void BandExpression::fail( const QString& message ) const
+{
+  throw std::runtime_error( QString( "Feature \"%1\": %2 at position %3" ).arg( mText, message ).arg( mPos + 1 ).toStdString() );
+}
+
+DerivedFeatures::DerivedFeatures( const QStringList& expressions, const QVector<int>& rasterBands,
+                                  const TimeSeriesStack* timeSeries )
+    : mTimeSeries( timeSeries )
+{
+  for ( int i = 0; i < expressions.size(); ++i )
+  {
+    const QString& text = expressions.at( i );
+    if ( TemporalAggregate::isAggregate( text ) )
+    {
+      if ( !timeSeries )
+        throw std::runtime_error( QString( "Feature \"%1\" needs a time series" ).arg( text ).toStdString() );
+      mIndex.push_back( ( int )mAggregates.size() );
+      mKinds.push_back( Aggregate );
+      mAggregates.push_back( TemporalAggregate( text, timeSeries->bandCount() ) );
+    }
+    else if ( TextureKernel::isTexture( text ) )
+    {
+      mIndex.push_back( ( int )mTextures.size() );
+      mKinds.push_back( Texture );
+      mTextures.push_back( TextureKernel( text, rasterBands ) );
+    }
+    else
+    {
+      mIndex.push_back( ( int )mExpressions.size() );
+      mKinds.push_back( BandMath );
+      mExpressions.push_back( BandExpression( text, rasterBands ) );
+    }
+  }
+}
+
+void DerivedFeatures::evaluate( const float* const* bandRows, int n, float* out, int outStride ) const
+{
+  for ( int f = 0; f < count(); ++f )
+  {
+    if ( isBandMath( f ) )
+      expression( f ).evaluate( bandRows, n, out + ( size_t )f * outStride );
+  }
+}
+
+void DerivedFeatures::evaluateAt( GDALDataset* raster, int col, int row, float* out, int outStride ) const
+{
+  std::vector<float> series;
+  std::vector<float> scratch;
+  for ( int f = 0; f < count(); ++f )
+  {
+    if ( isTexture( f ) )
+    {
+      out[ ( size_t )f * outStride ] = texture( f ).pixel( raster, col, row );
+    }
+    else if ( isAggregate( f ) )
+    {
+      series.resize( mTimeSeries->sceneCount() );
+      mTimeSeries->readPixel( aggregate( f ).band(), col, row, &series[ 0 ] );
+      aggregate( f ).reduce( &series[ 0 ], mTimeSeries->sceneCount(), 1, out + ( size_t )f * outStride, scratch );
+    }
+  }
+}
@@ -0,0 +1,143 @@
+/***************************************************************************
+  featureexpr.h
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef FEATUREEXPR_H
+#define FEATUREEXPR_H
+
+#include <vector>
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "texturefeatures.h"
+#include "timeseries.h"
+
+class GDALDataset;
+
+/**
+  Band math expression compiled into a postfix program, e.g.
+  "(b4 - b3) / (b4 + b3)". bN is band N of the stacked input raster, tK.bN
+  is band N of the K-th input raster (both 1-based). Operators are + - * /,
+  unary minus and parentheses; division by zero gives 0. The program is run
+  one operation at a time over whole arrays of pixels, so the per-pixel cost
+  is a few arithmetic instructions per operation.
+  */
+class BandExpression
+{
+  public:
+    /** rasterBands holds band count of every input raster, in stacking
+      order. Throws std::runtime_error on syntax error or unknown band
+      */
+    BandExpression( const QString& text, const QVector<int>& rasterBands );
+
+    const QString& text() const { return mText; }
+
+    //! stacked bands (0-based) the expression reads, sorted
+    std::vector<int> bands() const;
+    //! stacked band when the expression is a bare band reference, -1 otherwise
+    int singleBand() const;
+
+    /** evaluate n pixels, value of pixel i of stacked band b is
+      bandRows[ b ][ i ]. Only rows of bands() are read
+      */
+    void evaluate( const float* const* bandRows, int n, float* out ) const;
+
+  private:
+    enum OpCode { PushBand, PushConst, Add, Sub, Mul, Div, Neg };
+    struct Op
+    {
+      OpCode code;
+      int band;
+      float value;
+    };
+
+    void parseSum();
+    void parseProduct();
+    void parseUnary();
+    void parseBand();
+    void push( OpCode code, int band = -1, float value = 0 );
+    bool accept( QChar c );
+    void skipSpaces();
+    int parseInt();
+    void fail( const QString& message ) const;
+
+    QString mText;
+    QVector<int> mRasterBands;
+    int mBandCount;
+    std::vector<Op> mOps;
+    int mDepth;
+    int mMaxDepth;
+    int mPos;
+};
+
+/**
+  Derived features of the model: band values are followed by the values of
+  the features, in the order they were given. A feature is band math
+  (BandExpression), a neighborhood texture (TextureKernel) or an aggregate
+  over the time series (TemporalAggregate). Training points and classified
+  rows get the same features, so a model trained with features must be
+  applied with the same expressions.
+  */
+class DerivedFeatures
+{
+  public:
+    /** timeSeries is needed by temporal aggregates and must outlive the
+      features. Throws std::runtime_error on bad expression
+      */
+    DerivedFeatures( const QStringList& expressions, const QVector<int>& rasterBands,
+                     const TimeSeriesStack* timeSeries = NULL );
+
+    int count() const { return ( int )mIndex.size(); }
+    //! true when some features need more than the band values of the pixel
+    bool readsRaster() const { return !mTextures.empty() || !mAggregates.empty(); }
+    bool isBandMath( int i ) const { return mKinds[ i ] == BandMath; }
+    bool isTexture( int i ) const { return mKinds[ i ] == Texture; }
+    bool isAggregate( int i ) const { return mKinds[ i ] == Aggregate; }
+    //! band math of feature i
+    const BandExpression& expression( int i ) const { return mExpressions[ mIndex[ i ] ]; }
+    //! kernel of texture feature i
+    const TextureKernel& texture( int i ) const { return mTextures[ mIndex[ i ] ]; }
+    //! temporal aggregate of feature i
+    const TemporalAggregate& aggregate( int i ) const { return mAggregates[ mIndex[ i ] ]; }
+    const TimeSeriesStack* timeSeries() const { return mTimeSeries; }
+
+    /** evaluate band math features of n pixels, feature f goes to
+      out[ f * outStride + i ], other slots are left as they are.
+      bandRows as in BandExpression::evaluate
+      */
+    void evaluate( const float* const* bandRows, int n, float* out, int outStride ) const;
+    /** evaluate textures and temporal aggregates of one pixel, feature f
+      goes to out[ f * outStride ]. Throws std::runtime_error
+      */
+    void evaluateAt( GDALDataset* raster, int col, int row, float* out, int outStride ) const;
+
+  private:
+    enum Kind { BandMath, Texture, Aggregate };
+
+    std::vector<BandExpression> mExpressions;
+    std::vector<TextureKernel> mTextures;
+    std::vector<TemporalAggregate> mAggregates;
+    const TimeSeriesStack* mTimeSeries;
+    //! index of feature in the vector of its kind
+    std::vector<int> mIndex;
+    std::vector<Kind> mKinds;
+};
+
+#endif // FEATUREEXPR_H
@@ -0,0 +1,439 @@
+/***************************************************************************
+  foresttrainer.cpp
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <QRunnable>
+#include <QString>
+#include <QThread>
+#include <QThreadPool>
+
+#include "qgslogger.h"
+
+#include "foresttrainer.h"
+
+namespace
+{
+  //! train data copies of concurrent chunks stay below this together
+  const qint64 MaxChunkDataBytes = Q_INT64_C( 2 ) << 30;
+
+  /** approximate size of CvDTreeTrainData with shared = true: the sorted
+    root row and the working row of sample indices of every variable plus
+    the sample index column, 16-bit below 65536 samples
+    */
+  qint64 trainDataBytes( int sampleCount, int varCount )
+  {
+    qint64 indexSize = sampleCount < 65536 ? 2 : 4;
+    return 2 * indexSize * ( varCount + 1 ) * ( qint64 )sampleCount;
+  }
+
+  /** CvForestTree::forest is protected and CvRTrees has no setter, adopted
+    trees are pointed to their new forest through a member pointer
+    */
+  struct ForestTreeAccess : public CvForestTree
+  {
+    static void setForest( CvForestTree* tree, CvRTrees* forest )
+    {
+      tree->*( &ForestTreeAccess::forest ) = forest;
+    }
+  };
+
+  class ForestChunkTask : public QRunnable
+  {
+    public:
+      ForestChunkTask( ParallelRTrees* chunk, const CvMat* trainData, const CvMat* responses, const CvMat* varType,
+                       const CvRTParams& params, int firstTree, int count, quint64 seed, const CvMat* sampleIdx )
+          : mChunk( chunk ),
+            mTrainData( trainData ),
+            mResponses( responses ),
+            mVarType( varType ),
+            mParams( params ),
+            mFirstTree( firstTree ),
+            mCount( count ),
+            mSeed( seed ),
+            mSampleIdx( sampleIdx )
+      {
+        setAutoDelete( false );
+      }
+
+      void run()
+      {
+        try
+        {
+          mChunk->trainChunk( mTrainData, mResponses, mVarType, mParams, mFirstTree, mCount, mSeed, mSampleIdx );
+        }
+        catch ( cv::Exception& e )
+        {
+          mError = QString::fromStdString( e.what() );
+        }
+        catch ( std::exception& e )
+        {
+          mError = QString::fromStdString( e.what() );
+        }
+      }
+
+      QString error() const { return mError; }
+
+    private:
+      ParallelRTrees* mChunk;
+      const CvMat* mTrainData;
+      const CvMat* mResponses;
+      const CvMat* mVarType;
+      CvRTParams mParams;
+      int mFirstTree;
+      int mCount;
+      quint64 mSeed;
+      const CvMat* mSampleIdx;
+      QString mError;
+  };
+
+  //! class labels of the responses, empty for regression
+  std::vector<int> classLabels( const CvDTreeTrainData* data )
+  {
+    std::vector<int> labels;
+    if ( data && data->is_classifier )
+    {
+      int count = data->cat_count->data.i[ data->cat_var_count ];
+      const int* map = data->cat_map->data.i + data->cat_ofs->data.i[ data->cat_var_count ];
+      labels.assign( map, map + count );
+    }
+    return labels;
+  }
+}
+
+ParallelRTrees::ParallelRTrees()
+    : CvRTrees()
+{
+}
+
+ParallelRTrees::~ParallelRTrees()
+{
+  // CvRTrees destructor would call base clear() only
+  clear();
+}
+
+void ParallelRTrees::clear()
+{
+  // trees of every chunk free their nodes into the chunk train data, so
+  // they go before any data. The first chunk data is released by CvRTrees
+  // as its own
+  for ( int k = 0; k < ntrees; ++k )
+  {
+    delete trees[ k ];
+  }
+  cvFree( &trees );
+  ntrees = 0;
+  for ( int i = 1; i < mChunkData.size(); ++i )
+  {
+    delete mChunkData[ i ];
+  }
+  mChunkData.clear();
+  CvRTrees::clear();
+}
+
+void ParallelRTrees::truncate( int count )
+{
+  for ( int k = qMax( count, 0 ); k < ntrees; ++k )
+  {
+    delete trees[ k ];
+    trees[ k ] = 0;
+  }
+  ntrees = qMin( ntrees, qMax( count, 0 ) );
+}
+
+void ParallelRTrees::removeFirst( int count )
+{
+  count = qMin( qMax( count, 0 ), ntrees );
+  for ( int k = 0; k < count; ++k )
+  {
+    delete trees[ k ];
+  }
+  // train data of removed trees stays with the chunk data
+  memmove( trees, trees + count, sizeof( trees[ 0 ] ) * ( ntrees - count ) );
+  ntrees -= count;
+}
+
+void ParallelRTrees::append( ParallelRTrees* other )
+{
+  if ( other->ntrees == 0 )
+    return;
+
+  // trees vote by class index, so both forests must index the same labels
+  if ( ntrees > 0 && ( data->var_count != other->data->var_count || classLabels( data ) != classLabels( other->data ) ) )
+    throw std::runtime_error( "Random trees: new samples must have the same bands and classes as the model" );
+
+  adopt( other );
+}
+
+quint64 ParallelRTrees::treeSeed( quint64 forestSeed, int treeIndex )
+{
+  // splitmix64 step, gives well separated streams for neighbour indices
+  quint64 z = forestSeed + ( quint64 )( treeIndex + 1 ) * Q_UINT64_C( 0x9E3779B97F4A7C15 );
+  z = ( z ^ ( z >> 30 ) ) * Q_UINT64_C( 0xBF58476D1CE4E5B9 );
+  z = ( z ^ ( z >> 27 ) ) * Q_UINT64_C( 0x94D049BB133111EB );
+  z = z ^ ( z >> 31 );
+  return z ? z : 1;
+}
+
+int ParallelRTrees::maxConcurrentTrainData( int sampleCount, int varCount )
+{
+  qint64 dataBytes = qMax( trainDataBytes( sampleCount, varCount ), Q_INT64_C( 1 ) );
+  return ( int )qBound( Q_INT64_C( 1 ), MaxChunkDataBytes / dataBytes, ( qint64 )INT_MAX );
+}
+
+void ParallelRTrees::trainParallel( const CvMat* trainData, const CvMat* responses, const CvMat* varType,
+                                    CvRTParams params, int threadCount, quint64 seed, const CvMat* sampleIdx )
+{
+  clear();
+
+  int treeCount = params.term_crit.type & CV_TERMCRIT_ITER ? params.term_crit.max_iter : 50;
+  if ( treeCount <= 0 )
+    throw std::runtime_error( "Random trees: number of trees must be positive" );
+
+  if ( threadCount <= 0 )
+    threadCount = QThread::idealThreadCount();
+  // OpenCV grows a tree in the working row of the train data buffer and
+  // takes its nodes from unsynchronized heaps of the same CvDTreeTrainData,
+  // so concurrent trees can't share one. Every chunk keeps its own sorted
+  // copy, chunks are limited by thread and tree count and by the memory
+  // the copies take together
+  int sampleCount = sampleIdx ? sampleIdx->rows * sampleIdx->cols : trainData->rows;
+  int chunkCount = qMin( qMin( threadCount, treeCount ), maxConcurrentTrainData( sampleCount, trainData->cols ) );
+
+  QgsDebugMsg( QString( "ParallelRTrees: %1 trees on %2 threads, %3 MB of train data each" ).arg( treeCount ).arg( chunkCount ).arg( trainDataBytes( sampleCount, trainData->cols ) >> 20 ) );
+
+  QList<ParallelRTrees*> chunks;
+  QList<ForestChunkTask*> tasks;
+  QThreadPool pool;
+  pool.setMaxThreadCount( chunkCount );
+
+  int firstTree = 0;
+  for ( int i = 0; i < chunkCount; ++i )
+  {
+    int count = treeCount / chunkCount + ( i < treeCount % chunkCount ? 1 : 0 );
+    ParallelRTrees* chunk = new ParallelRTrees();
+    ForestChunkTask* task = new ForestChunkTask( chunk, trainData, responses, varType, params, firstTree, count, seed, sampleIdx );
+    chunks << chunk;
+    tasks << task;
+    pool.start( task );
+    firstTree += count;
+  }
+  pool.waitForDone();
+
+  QString error;
+  for ( int i = 0; i < chunks.size(); ++i )
+  {
+    if ( error.isEmpty() && !tasks[ i ]->error().isEmpty() )
+      error = tasks[ i ]->error();
+    else if ( error.isEmpty() )
+      adopt( chunks[ i ] );
+
+    delete tasks[ i ];
+    delete chunks[ i ];
+  }
+
+  if ( !error.isEmpty() )
+  {
+    clear();
+    throw std::runtime_error( QString( "Random trees training failed: %1" ).arg( error ).toStdString() );
+  }
+
+  if ( params.term_crit.type & CV_TERMCRIT_EPS )
+    truncateByOobError( trainData, responses, sampleIdx, params.term_crit.epsilon, seed );
+
+  QgsDebugMsg( QString( "ParallelRTrees: forest of %1 trees" ).arg( ntrees ) );
+}
+
+void ParallelRTrees::trainChunk( const CvMat* trainData, const CvMat* responses, const CvMat* varType,
+                                 CvRTParams params, int firstTree, int count, quint64 seed, const CvMat* sampleIdx )
+{
+  clear();
+
+  // same setup as CvRTrees::train, but rng is owned by the chunk
+  CvDTreeParams treeParams( params.max_depth, params.min_sample_count, params.regression_accuracy,
+                            params.use_surrogates, params.max_categories, params.cv_folds,
+                            params.use_1se_rule, false, params.priors );
+
+  data = new CvDTreeTrainData();
+  data->set_data( trainData, CV_ROW_SAMPLE, responses, 0, sampleIdx, varType, 0, treeParams, true );
+
+  int varCount = data->var_count;
+  if ( params.nactive_vars > varCount )
+    params.nactive_vars = varCount;
+  else if ( params.nactive_vars == 0 )
+    params.nactive_vars = ( int )sqrt( ( double )varCount );
+  else if ( params.nactive_vars < 0 )
+    throw std::runtime_error( "Random trees: nactive_vars must be non-negative" );
+  params.nactive_vars = qMax( 1, params.nactive_vars );
+
+  nclasses = data->get_num_classes();
+  nsamples = data->sample_count;
+
+  active_var_mask = cvCreateMat( 1, varCount, CV_8UC1 );
+  cvZero( active_var_mask );
+  memset( active_var_mask->data.ptr, 1, params.nactive_vars );
+
+  rng = &mRng;
+
+  trees = ( CvForestTree** )cvAlloc( sizeof( trees[ 0 ] ) * count );
+  memset( trees, 0, sizeof( trees[ 0 ] ) * count );
+
+  CvMat* bagIdx = cvCreateMat( 1, nsamples, CV_32SC1 );
+  for ( int k = 0; k < count; ++k )
+  {
+    bootstrap( bagIdx, treeSeed( seed, firstTree + k ) );
+
+    CvForestTree* tree = new CvForestTree();
+    tree->train( data, bagIdx, this );
+    trees[ ntrees++ ] = tree;
+  }
+  cvReleaseMat( &bagIdx );
+}
+
+void ParallelRTrees::bootstrap( CvMat* sampleIdx, quint64 seed )
+{
+  mRng = cv::RNG( seed );
+  for ( int i = 0; i < sampleIdx->cols; ++i )
+  {
+    sampleIdx->data.i[ i ] = ( unsigned )mRng % sampleIdx->cols;
+  }
+}
+
+void ParallelRTrees::adopt( ParallelRTrees* chunk )
+{
+  if ( chunk->ntrees == 0 )
+    return;
+
+  CvForestTree** merged = ( CvForestTree** )cvAlloc( sizeof( trees[ 0 ] ) * ( ntrees + chunk->ntrees ) );
+  if ( ntrees > 0 )
+    memcpy( merged, trees, sizeof( trees[ 0 ] ) * ntrees );
+  memcpy( merged + ntrees, chunk->trees, sizeof( trees[ 0 ] ) * chunk->ntrees );
+  // the chunk is deleted after adoption, trees must not point to it
+  for ( int k = 0; k < chunk->ntrees; ++k )
+    ForestTreeAccess::setForest( merged[ ntrees + k ], this );
+  cvFree( &trees );
+  trees = merged;
+  ntrees += chunk->ntrees;
+
+  // data of a loaded forest is owned by CvRTrees and stays the first one
+  if ( mChunkData.isEmpty() && data )
+    mChunkData << data;
+
+  if ( mChunkData.isEmpty() )
+  {
+    // first chunk provides forest-wide state: params for save, class count, active vars
+    data = chunk->data;
+    nclasses = chunk->nclasses;
+    nsamples = chunk->nsamples;
+    active_var_mask = chunk->active_var_mask;
+    chunk->active_var_mask = 0;
+  }
+  // chunk may be a forest of adopted chunks itself
+  if ( chunk->mChunkData.isEmpty() )
+    mChunkData << chunk->data;
+  else
+    mChunkData << chunk->mChunkData;
+  chunk->mChunkData.clear();
+
+  cvFree( &chunk->trees );
+  chunk->ntrees = 0;
+  chunk->data = 0;
+}
+
+void ParallelRTrees::truncateByOobError( const CvMat* trainData, const CvMat* responses, const CvMat* sampleIdx,
+                                         double maxOobError, quint64 seed )
+{
+  // bootstrap indices refer to the selected rows
+  int sampleCount = sampleIdx ? sampleIdx->rows * sampleIdx->cols : trainData->rows;
+  bool classifier = nclasses > 0;
+
+  std::vector<int> votes( classifier ? sampleCount * nclasses : 0, 0 );
+  std::vector<double> sums( classifier ? 0 : sampleCount, 0.0 );
+  std::vector<int> oobCount( sampleCount, 0 );
+  std::vector<uchar> inBag( sampleCount );
+
+  CvMat* bagIdx = cvCreateMat( 1, sampleCount, CV_32SC1 );
+  CvMat sample;
+  int stopAt = ntrees;
+
+  for ( int k = 0; k < ntrees; ++k )
+  {
+    bootstrap( bagIdx, treeSeed( seed, k ) );
+    std::fill( inBag.begin(), inBag.end(), 0 );
+    for ( int i = 0; i < sampleCount; ++i )
+      inBag[ bagIdx->data.i[ i ] ] = 1;
+
+    double error = 0;
+    int oobSamples = 0;
+    for ( int i = 0; i < sampleCount; ++i )
+    {
+      if ( !inBag[ i ] )
+      {
+        cvGetRow( trainData, &sample, sampleIdx ? sampleIdx->data.i[ i ] : i );
+        CvDTreeNode* node = trees[ k ]->predict( &sample );
+        if ( classifier )
+          votes[ i * nclasses + node->class_idx ]++;
+        else
+          sums[ i ] += node->value;
+        oobCount[ i ]++;
+      }
+      if ( oobCount[ i ] == 0 )
+        continue;
+
+      double truth = cvGetReal1D( responses, sampleIdx ? sampleIdx->data.i[ i ] : i );
+      if ( classifier )
+      {
+        // the leaf value of the winning class is the class label
+        int best = 0;
+        for ( int c = 1; c < nclasses; ++c )
+        {
+          if ( votes[ i * nclasses + c ] > votes[ i * nclasses + best ] )
+            best = c;
+        }
+        int label = data->cat_map->data.i[ data->cat_ofs->data.i[ data->cat_var_count ] + best ];
+        error += ( label != cvRound( truth ) ) ? 1 : 0;
+      }
+      else
+      {
+        double diff = sums[ i ] / oobCount[ i ] - truth;
+        error += diff * diff;
+      }
+      oobSamples++;
+    }
+
+    oob_error = oobSamples > 0 ? error / oobSamples : 0;
+    if ( oob_error < maxOobError )
+    {
+      stopAt = k + 1;
+      break;
+    }
+  }
+  cvReleaseMat( &bagIdx );
+
+  for ( int k = stopAt; k < ntrees; ++k )
+  {
+    delete trees[ k ];
+    trees[ k ] = 0;
+  }
+  ntrees = stopAt;
+}
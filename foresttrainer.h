@@ -0,0 +1,92 @@
+/***************************************************************************
+  foresttrainer.h
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef FORESTTRAINER_H
+#define FORESTTRAINER_H
+
+#include <QList>
+#include <QtGlobal>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/ml/ml.hpp"
+
+/**
+  Random trees trained concurrently. Every tree gets its own seed derived
+  from the forest seed and the tree index, so the forest does not depend on
+  the number of threads. The result is a regular CvRTrees: it predicts and
+  saves to the same YAML that CvRTrees::load() reads.
+  */
+class ParallelRTrees : public CvRTrees
+{
+  public:
+    ParallelRTrees();
+    virtual ~ParallelRTrees();
+
+    /** train forest on a read-only row-sample matrix, sampleIdx selects rows
+      (0 - all). threadCount <= 0 means QThread::idealThreadCount(). Every
+      thread sorts own copy of the samples, fewer threads are used when the
+      copies would take more than 2 GB. Throws std::runtime_error on failure
+      */
+    void trainParallel( const CvMat* trainData, const CvMat* responses, const CvMat* varType,
+                        CvRTParams params, int threadCount, quint64 seed, const CvMat* sampleIdx = 0 );
+
+    virtual void clear();
+
+    //! keep the first count trees, later trees are deleted
+    void truncate( int count );
+
+    //! delete the first count trees
+    void removeFirst( int count );
+
+    /** append trees of other forest (e.g. trained on new samples after this
+      one was loaded), other is left empty. Throws std::runtime_error when
+      forests use different bands or classes
+      */
+    void append( ParallelRTrees* other );
+
+    //! seed of the tree with given index in the forest
+    static quint64 treeSeed( quint64 forestSeed, int treeIndex );
+
+    /** number of OpenCV train data copies of sampleCount samples that fit
+      the 2 GB cap of concurrent training together, at least 1
+      */
+    static int maxConcurrentTrainData( int sampleCount, int varCount );
+
+    //! train trees [firstTree, firstTree + count) with own train data buffers
+    void trainChunk( const CvMat* trainData, const CvMat* responses, const CvMat* varType,
+                     CvRTParams params, int firstTree, int count, quint64 seed, const CvMat* sampleIdx = 0 );
+
+  protected:
+    //! take trees and train data of the chunk or forest, chunk is left empty
+    void adopt( ParallelRTrees* chunk );
+
+    //! bootstrap sample indices of the tree, rng is reseeded
+    void bootstrap( CvMat* sampleIdx, quint64 seed );
+
+    //! apply CvRTrees out-of-bag stop rule to trees trained in index order
+    void truncateByOobError( const CvMat* trainData, const CvMat* responses, const CvMat* sampleIdx,
+                             double maxOobError, quint64 seed );
+
+    //! train data of adopted chunks, data of the first chunk is CvRTrees::data
+    QList<CvDTreeTrainData*> mChunkData;
+
+    cv::RNG mRng;
+};
+
+#endif // FORESTTRAINER_H
@@ -0,0 +1,478 @@
+/***************************************************************************
+  histogramtrainer.cpp
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <QList>
+#include <QRunnable>
+#include <QString>
+#include <QThread>
+#include <QThreadPool>
+
+#include "opencv2/core/core.hpp"
+
+#include "qgslogger.h"
+
+#include "foresttrainer.h"
+#include "histogramtrainer.h"
+#include "treemodel.h"
+
+namespace
+{
+  //! split criterion: weighted Gini purity for classes, variance reduction for regression
+  double splitScore( const double* stats, int count, bool classifier )
+  {
+    if ( classifier )
+    {
+      double weight = 0, sum = 0;
+      for ( int c = 0; c < count; ++c )
+      {
+        weight += stats[ c ];
+        sum += stats[ c ] * stats[ c ];
+      }
+      return weight > 0 ? sum / weight : 0;
+    }
+    return stats[ 0 ] > 0 ? stats[ 1 ] * stats[ 1 ] / stats[ 0 ] : 0;
+  }
+
+  //! grows a single tree, state is private to the tree so trees can be grown concurrently
+  class TreeGrower
+  {
+    public:
+      TreeGrower( const HistogramTreeParams& params, int sampleCount, int varCount,
+                  const uchar* bins, const std::vector< std::vector<float> >& edges,
+                  const std::vector<float>& responses, const std::vector<int>& labelIdx,
+                  const std::vector<float>& labels, quint64 seed, TreeModel& out )
+          : mParams( params ),
+            mSampleCount( sampleCount ),
+            mVarCount( varCount ),
+            mBins( bins ),
+            mEdges( edges ),
+            mResponses( responses ),
+            mLabelIdx( labelIdx ),
+            mLabels( labels ),
+            mRng( seed ),
+            mOut( out )
+      {
+        mStats = mParams.classifier ? ( int )mLabels.size() : 2;
+
+        mVarOffset.resize( mVarCount + 1 );
+        mVarOffset[ 0 ] = 0;
+        for ( int v = 0; v < mVarCount; ++v )
+          mVarOffset[ v + 1 ] = mVarOffset[ v ] + ( int )( mEdges[ v ].size() + 1 ) * mStats;
+
+        mActiveVars = mParams.activeVars;
+        if ( mActiveVars <= 0 || mActiveVars > mVarCount )
+          mActiveVars = mVarCount;
+        mVars.resize( mVarCount );
+        for ( int v = 0; v < mVarCount; ++v )
+          mVars[ v ] = v;
+      }
+
+      void grow()
+      {
+        // bootstrap is expressed as sample multiplicity, not as copies
+        mWeights.assign( mSampleCount, mParams.bootstrap ? 0 : 1 );
+        if ( mParams.bootstrap )
+        {
+          for ( int i = 0; i < mSampleCount; ++i )
+            mWeights[ ( unsigned )mRng % mSampleCount ]++;
+        }
+        mIdx.clear();
+        for ( int i = 0; i < mSampleCount; ++i )
+        {
+          if ( mWeights[ i ] > 0 )
+            mIdx.push_back( i );
+        }
+        mTmp.resize( mIdx.size() );
+
+        mOut.mRoots.assign( 1, 0 );
+        std::vector<double>* hist = takeBuffer();
+        fillHistogram( *hist, 0, ( int )mIdx.size() );
+        build( 0, ( int )mIdx.size(), 0, *hist );
+        releaseBuffer( hist );
+
+        for ( size_t i = 0; i < mPool.size(); ++i )
+          delete mPool[ i ];
+      }
+
+    private:
+      std::vector<double>* takeBuffer()
+      {
+        if ( mPool.empty() )
+          return new std::vector<double>( mVarOffset[ mVarCount ] );
+        std::vector<double>* buffer = mPool.back();
+        mPool.pop_back();
+        return buffer;
+      }
+
+      void releaseBuffer( std::vector<double>* buffer )
+      {
+        mPool.push_back( buffer );
+      }
+
+      void fillHistogram( std::vector<double>& hist, int begin, int end )
+      {
+        std::fill( hist.begin(), hist.end(), 0.0 );
+        for ( int v = 0; v < mVarCount; ++v )
+        {
+          double* base = &hist[ mVarOffset[ v ] ];
+          const uchar* column = mBins + ( size_t )v * mSampleCount;
+          for ( int i = begin; i < end; ++i )
+          {
+            int s = mIdx[ i ];
+            double* cell = base + column[ s ] * mStats;
+            if ( mParams.classifier )
+            {
+              cell[ mLabelIdx[ s ] ] += mWeights[ s ];
+            }
+            else
+            {
+              cell[ 0 ] += mWeights[ s ];
+              cell[ 1 ] += mWeights[ s ] * mResponses[ s ];
+            }
+          }
+        }
+      }
+
+      int build( int begin, int end, int depth, std::vector<double>& hist )
+      {
+        int nodeIdx = ( int )mOut.mNodes.size();
+        mOut.mNodes.push_back( TreeNode() );
+
+        // node totals are the sum of any band histogram
+        std::vector<double> total( mStats, 0.0 );
+        int binCount = ( int )mEdges[ 0 ].size() + 1;
+        for ( int b = 0; b < binCount; ++b )
+        {
+          for ( int c = 0; c < mStats; ++c )
+            total[ c ] += hist[ b * mStats + c ];
+        }
+
+        // majority of response labels gives purity for both kinds of trees
+        std::vector<double> labelWeights( mLabels.size(), 0.0 );
+        double weight = 0;
+        for ( int i = begin; i < end; ++i )
+        {
+          labelWeights[ mLabelIdx[ mIdx[ i ] ] ] += mWeights[ mIdx[ i ] ];
+          weight += mWeights[ mIdx[ i ] ];
+        }
+        int majority = ( int )( std::max_element( labelWeights.begin(), labelWeights.end() ) - labelWeights.begin() );
+
+        TreeNode node;
+        node.left = node.right = -1;
+        node.splitBegin = node.splitCount = 0;
+        node.defaultDir = -1;
+        node.purity = weight > 0 ? ( float )( labelWeights[ majority ] / weight ) : 1.0f;
+        if ( mParams.classifier )
+        {
+          node.classIdx = majority;
+          node.value = mLabels[ majority ];
+        }
+        else
+        {
+          node.classIdx = -1;
+          node.value = total[ 0 ] > 0 ? ( float )( total[ 1 ] / total[ 0 ] ) : 0.0f;
+        }
+        mOut.mNodes[ nodeIdx ] = node;
+
+        if ( depth >= mParams.maxDepth || weight <= mParams.minSampleCount || node.purity >= 1.0f )
+          return nodeIdx;
+
+        // random subset of bands for forests
+        if ( mActiveVars < mVarCount )
+        {
+          for ( int k = 0; k < mActiveVars; ++k )
+            std::swap( mVars[ k ], mVars[ k + ( unsigned )mRng % ( mVarCount - k ) ] );
+        }
+
+        int bestBin = -1;
+        int bestVar = HistogramTreeTrainer::bestSplit( &hist[ 0 ], mVarOffset, mVars, mActiveVars, mStats,
+                                                       mParams.classifier, &total[ 0 ], bestBin );
+        if ( bestVar < 0 )
+          return nodeIdx;
+
+        // stable partition keeps sample indices ascending for cache friendly histogram scans
+        const uchar* column = mBins + ( size_t )bestVar * mSampleCount;
+        int mid = begin, rightPos = 0;
+        for ( int i = begin; i < end; ++i )
+        {
+          if ( column[ mIdx[ i ] ] <= bestBin )
+            mIdx[ mid++ ] = mIdx[ i ];
+          else
+            mTmp[ rightPos++ ] = mIdx[ i ];
+        }
+        std::copy( mTmp.begin(), mTmp.begin() + rightPos, mIdx.begin() + mid );
+        if ( mid == begin || mid == end )
+          return nodeIdx;
+
+        TreeSplit split;
+        split.var = bestVar;
+        split.inversed = 0;
+        split.catBegin = -1;
+        split.catCount = 0;
+        split.threshold = mEdges[ bestVar ][ bestBin ];
+        mOut.mNodes[ nodeIdx ].splitBegin = ( int )mOut.mSplits.size();
+        mOut.mNodes[ nodeIdx ].splitCount = 1;
+        mOut.mNodes[ nodeIdx ].defaultDir = ( mid - begin ) >= ( end - mid ) ? -1 : 1;
+        mOut.mSplits.push_back( split );
+
+        // histogram of the smaller child is scanned, the larger one is parent minus smaller
+        bool leftSmaller = ( mid - begin ) <= ( end - mid );
+        std::vector<double>* smaller = takeBuffer();
+        if ( leftSmaller )
+          fillHistogram( *smaller, begin, mid );
+        else
+          fillHistogram( *smaller, mid, end );
+        for ( size_t i = 0; i < hist.size(); ++i )
+          hist[ i ] -= ( *smaller )[ i ];
+
+        int leftIdx = build( begin, mid, depth + 1, leftSmaller ? *smaller : hist );
+        int rightIdx = build( mid, end, depth + 1, leftSmaller ? hist : *smaller );
+        releaseBuffer( smaller );
+
+        mOut.mNodes[ nodeIdx ].left = leftIdx;
+        mOut.mNodes[ nodeIdx ].right = rightIdx;
+        return nodeIdx;
+      }
+
+      const HistogramTreeParams& mParams;
+      int mSampleCount;
+      int mVarCount;
+      const uchar* mBins;
+      const std::vector< std::vector<float> >& mEdges;
+      const std::vector<float>& mResponses;
+      const std::vector<int>& mLabelIdx;
+      const std::vector<float>& mLabels;
+      cv::RNG mRng;
+      TreeModel& mOut;
+
+      int mStats;
+      int mActiveVars;
+      std::vector<int> mVarOffset;
+      std::vector<int> mVars;
+      std::vector<int> mWeights;
+      std::vector<int> mIdx;
+      std::vector<int> mTmp;
+      std::vector< std::vector<double>* > mPool;
+  };
+
+  class HistogramTreeTask : public QRunnable
+  {
+    public:
+      HistogramTreeTask( const HistogramTreeTrainer* trainer, const HistogramTreeParams& params, quint64 seed, TreeModel* tree )
+          : mTrainer( trainer ),
+            mParams( params ),
+            mSeed( seed ),
+            mTree( tree )
+      {
+        setAutoDelete( false );
+      }
+
+      void run()
+      {
+        try
+        {
+          mTrainer->growTree( mParams, mSeed, *mTree );
+        }
+        catch ( std::exception& e )
+        {
+          mError = QString::fromStdString( e.what() );
+        }
+      }
+
+      QString error() const { return mError; }
+
+    private:
+      const HistogramTreeTrainer* mTrainer;
+      HistogramTreeParams mParams;
+      quint64 mSeed;
+      TreeModel* mTree;
+      QString mError;
+  };
+}
+
+HistogramTreeTrainer::HistogramTreeTrainer( const CvMat* trainData, const CvMat* responses, int maxBins )
+    : mSampleCount( trainData->rows ),
+      mVarCount( trainData->cols ),
+      mMaxBins( maxBins )
+{
+  if ( mSampleCount == 0 || mVarCount == 0 )
+    throw std::runtime_error( "Histogram trees: empty train data" );
+  if ( maxBins < 2 || maxBins > 256 )
+    throw std::runtime_error( "Histogram trees: number of bins must be in [2, 256]" );
+
+  quantize( trainData );
+  encodeResponses( responses );
+}
+
+HistogramTreeTrainer::~HistogramTreeTrainer()
+{
+}
+
+void HistogramTreeTrainer::quantize( const CvMat* trainData )
+{
+  mBins.resize( ( size_t )mSampleCount * mVarCount );
+  mEdges.resize( mVarCount );
+
+  std::vector<float> sorted( mSampleCount );
+  for ( int v = 0; v < mVarCount; ++v )
+  {
+    for ( int i = 0; i < mSampleCount; ++i )
+      sorted[ i ] = ( float )cvGetReal2D( trainData, i, v );
+    std::vector<float> column( sorted );
+    std::sort( sorted.begin(), sorted.end() );
+
+    // bins of equal population, cuts are moved to the next change of value
+    std::vector<float>& edges = mEdges[ v ];
+    edges.clear();
+    int lastCut = 0;
+    for ( int b = 1; b < mMaxBins; ++b )
+    {
+      int r = ( int )( ( qint64 )b * mSampleCount / mMaxBins );
+      if ( r <= lastCut )
+        r = lastCut + 1;
+      while ( r < mSampleCount && sorted[ r ] == sorted[ r - 1 ] )
+        r++;
+      if ( r >= mSampleCount )
+        break;
+
+      // any value between neighbours separates them, keep it strictly below the upper one
+      float lo = sorted[ r - 1 ], hi = sorted[ r ];
+      float edge = ( float )( ( ( double )lo + hi ) / 2 );
+      if ( !( edge < hi ) )
+        edge = lo;
+      edges.push_back( edge );
+      lastCut = r;
+    }
+
+    uchar* bins = &mBins[ ( size_t )v * mSampleCount ];
+    for ( int i = 0; i < mSampleCount; ++i )
+      bins[ i ] = ( uchar )( std::lower_bound( edges.begin(), edges.end(), column[ i ] ) - edges.begin() );
+
+    QgsDebugMsg( QString( "Histogram trees: band %1 quantized into %2 bins" ).arg( v + 1 ).arg( edges.size() + 1 ) );
+  }
+}
+
+void HistogramTreeTrainer::encodeResponses( const CvMat* responses )
+{
+  mResponses.resize( mSampleCount );
+  for ( int i = 0; i < mSampleCount; ++i )
+    mResponses[ i ] = ( float )cvGetReal1D( responses, i );
+
+  mLabels = mResponses;
+  std::sort( mLabels.begin(), mLabels.end() );
+  mLabels.erase( std::unique( mLabels.begin(), mLabels.end() ), mLabels.end() );
+
+  mLabelIdx.resize( mSampleCount );
+  for ( int i = 0; i < mSampleCount; ++i )
+    mLabelIdx[ i ] = ( int )( std::lower_bound( mLabels.begin(), mLabels.end(), mResponses[ i ] ) - mLabels.begin() );
+}
+
+int HistogramTreeTrainer::bestSplit( const double* hist, const std::vector<int>& varOffset, const std::vector<int>& vars,
+                                     int activeVars, int stats, bool classifier, const double* total, int& bestBin )
+{
+  double baseScore = splitScore( total, stats, classifier );
+  double bestScore = baseScore + 1e-9 * std::max( 1.0, fabs( baseScore ) );
+  int bestVar = -1;
+  bestBin = -1;
+  std::vector<double> left( stats ), right( stats );
+  for ( int k = 0; k < activeVars; ++k )
+  {
+    int v = vars[ k ];
+    const double* base = hist + varOffset[ v ];
+    int bins = ( varOffset[ v + 1 ] - varOffset[ v ] ) / stats;
+
+    std::fill( left.begin(), left.end(), 0.0 );
+    for ( int b = 0; b + 1 < bins; ++b )
+    {
+      bool empty = true;
+      for ( int c = 0; c < stats; ++c )
+      {
+        left[ c ] += base[ b * stats + c ];
+        right[ c ] = total[ c ] - left[ c ];
+        empty = empty && base[ b * stats + c ] == 0;
+      }
+      // empty bins do not move samples between children
+      if ( empty )
+        continue;
+
+      double s = splitScore( &left[ 0 ], stats, classifier ) + splitScore( &right[ 0 ], stats, classifier );
+      if ( s > bestScore )
+      {
+        bestScore = s;
+        bestVar = v;
+        bestBin = b;
+      }
+    }
+  }
+  return bestVar;
+}
+
+void HistogramTreeTrainer::growTree( const HistogramTreeParams& params, quint64 seed, TreeModel& tree ) const
+{
+  TreeGrower grower( params, mSampleCount, mVarCount, &mBins[ 0 ], mEdges, mResponses, mLabelIdx, mLabels, seed, tree );
+  grower.grow();
+}
+
+TreeModel* HistogramTreeTrainer::train( const HistogramTreeParams& params, int threadCount, quint64 seed ) const
+{
+  if ( params.treeCount <= 0 )
+    throw std::runtime_error( "Histogram trees: number of trees must be positive" );
+
+  if ( threadCount <= 0 )
+    threadCount = QThread::idealThreadCount();
+
+  std::vector<TreeModel> trees( params.treeCount );
+  QList<HistogramTreeTask*> tasks;
+  QThreadPool pool;
+  pool.setMaxThreadCount( qMax( 1, qMin( threadCount, params.treeCount ) ) );
+  for ( int t = 0; t < params.treeCount; ++t )
+  {
+    HistogramTreeTask* task = new HistogramTreeTask( this, params, ParallelRTrees::treeSeed( seed, t ), &trees[ t ] );
+    tasks << task;
+    pool.start( task );
+  }
+  pool.waitForDone();
+
+  QString error;
+  for ( int t = 0; t < tasks.size(); ++t )
+  {
+    if ( error.isEmpty() )
+      error = tasks[ t ]->error();
+    delete tasks[ t ];
+  }
+  if ( !error.isEmpty() )
+    throw std::runtime_error( QString( "Histogram trees training failed: %1" ).arg( error ).toStdString() );
+
+  // concatenate trees into one model
+  TreeModel* model = new TreeModel();
+  model->mClassifier = params.classifier;
+  model->mVarCount = mVarCount;
+  if ( params.classifier )
+    model->mClassLabels = mLabels;
+
+  for ( int t = 0; t < params.treeCount; ++t )
+    model->appendTrees( trees[ t ] );
+
+  QgsDebugMsg( QString( "Histogram trees: %1 trees, %2 nodes" ).arg( model->treeCount() ).arg( model->mNodes.size() ) );
+  return model;
+}
@@ -0,0 +1,101 @@
+/***************************************************************************
+  histogramtrainer.h
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef HISTOGRAMTRAINER_H
+#define HISTOGRAMTRAINER_H
+
+#include <vector>
+
+#include <QtGlobal>
+
+#include "opencv2/core/core_c.h"
+
+class TreeModel;
+
+struct HistogramTreeParams
+{
+  HistogramTreeParams():
+      maxDepth( 8 ),
+      minSampleCount( 10 ),
+      classifier( true ),
+      treeCount( 1 ),
+      activeVars( 0 ),
+      bootstrap( false ) {}
+
+  int maxDepth;
+  int minSampleCount;
+  // responses are class labels by default, as OpenCV trees without var_type treat them
+  bool classifier;
+  int treeCount;
+  // variables tried at every node, 0 - all for a single tree, sqrt(count) for forests
+  int activeVars;
+  bool bootstrap;
+};
+
+/**
+  Trains trees on band values quantized into at most 256 bins. Every band is
+  stored as a uint8 column, split search scans per-node histograms and the
+  histogram of the larger child is obtained by subtracting the smaller one
+  from the parent. Thresholds are stored in the original value domain.
+  */
+class HistogramTreeTrainer
+{
+  public:
+    //! quantizes the train matrix, it is not referenced afterwards
+    HistogramTreeTrainer( const CvMat* trainData, const CvMat* responses, int maxBins = 256 );
+    ~HistogramTreeTrainer();
+
+    //! trees are trained on threadCount threads (<= 0 - all cores). Throws std::runtime_error
+    TreeModel* train( const HistogramTreeParams& params, int threadCount, quint64 seed ) const;
+
+    //! grow one tree into model arrays, used by training tasks
+    void growTree( const HistogramTreeParams& params, quint64 seed, TreeModel& tree ) const;
+
+    int sampleCount() const { return mSampleCount; }
+    int varCount() const { return mVarCount; }
+    //! upper bin edges of every band
+    const std::vector< std::vector<float> >& edges() const { return mEdges; }
+
+    /** best split of a node histogram with stats values per bin, band v starts
+      at hist[ varOffset[ v ] ]. The first activeVars of vars are tried.
+      Returns band or -1 when no split improves the node
+      */
+    static int bestSplit( const double* hist, const std::vector<int>& varOffset, const std::vector<int>& vars,
+                          int activeVars, int stats, bool classifier, const double* total, int& bestBin );
+
+  private:
+    void quantize( const CvMat* trainData );
+    void encodeResponses( const CvMat* responses );
+
+    int mSampleCount;
+    int mVarCount;
+    int mMaxBins;
+
+    //! band-major bin indices: mBins[ v * mSampleCount + i ]
+    std::vector<uchar> mBins;
+    //! upper edges of bins in original values, value <= mEdges[ v ][ b ] falls into bin <= b
+    std::vector< std::vector<float> > mEdges;
+
+    std::vector<float> mResponses;
+    //! index of the response value in mLabels for every sample
+    std::vector<int> mLabelIdx;
+    std::vector<float> mLabels;
+};
+
+#endif // HISTOGRAMTRAINER_H
@@ -0,0 +1,353 @@
+/***************************************************************************
+  hypersearch.cpp
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <QFile>
+#include <QRegExp>
+#include <QRunnable>
+#include <QStringList>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+
+#include "qgslogger.h"
+
+#include "classifierworker.h"
+#include "foresttrainer.h"
+#include "latencytuner.h"
+#include "hypersearch.h"
+
+namespace
+{
+  class CandidateTask : public QRunnable
+  {
+    public:
+      CandidateTask( const HyperSearch* search, int candidate, const std::vector<int>* heldOut, quint64 seed, bool keepModel )
+          : mSearch( search ),
+            mCandidate( candidate ),
+            mHeldOut( heldOut ),
+            mSeed( seed ),
+            mKeepModel( keepModel ),
+            mCorrect( 0 ),
+            mModel( 0 )
+      {
+        setAutoDelete( false );
+      }
+
+      void run()
+      {
+        try
+        {
+          mCorrect = mSearch->evaluate( mSearch->candidates()[ mCandidate ], *mHeldOut, mSeed, mKeepModel ? &mModel : 0 );
+        }
+        catch ( cv::Exception& e )
+        {
+          mError = QString::fromStdString( e.what() );
+        }
+        catch ( std::exception& e )
+        {
+          mError = QString::fromStdString( e.what() );
+        }
+      }
+
+      int candidate() const { return mCandidate; }
+      int correct() const { return mCorrect; }
+      CvStatModel* takeModel() { CvStatModel* model = mModel; mModel = 0; return model; }
+      QString error() const { return mError; }
+
+    private:
+      const HyperSearch* mSearch;
+      int mCandidate;
+      const std::vector<int>* mHeldOut;
+      quint64 mSeed;
+      bool mKeepModel;
+      int mCorrect;
+      CvStatModel* mModel;
+      QString mError;
+  };
+
+  bool betterCandidate( const SearchCandidate& a, const SearchCandidate& b )
+  {
+    if ( a.accuracy != b.accuracy )
+      return a.accuracy > b.accuracy;
+    return a.pixelsPerSecond > b.pixelsPerSecond;
+  }
+
+  int* candidateField( SearchCandidate& candidate, const QString& name )
+  {
+    if ( name == "max_depth" )
+      return &candidate.maxDepth;
+    if ( name == "min_samples" )
+      return &candidate.minSampleCount;
+    if ( name == "max_categories" )
+      return &candidate.maxCategories;
+    if ( name == "trees" )
+      return &candidate.treesCount;
+    if ( name == "active_vars" )
+      return &candidate.activeVars;
+    if ( name == "cv_folds" )
+      return &candidate.cvFolds;
+    return 0;
+  }
+}
+
+HyperSearch::HyperSearch( const ClassifierWorkerConfig& config, const CvMat* trainData, const CvMat* responses, int folds )
+    : mConfig( config ),
+      mTrainData( trainData ),
+      mResponses( responses ),
+      mFolds( qMax( 2, qMin( folds, trainData->rows ) ) )
+{
+}
+
+void HyperSearch::setGrid( const QString& spec, int randomCount, quint64 seed )
+{
+  // configured parameters are the base point of the grid
+  SearchCandidate base;
+  base.maxDepth = mConfig.max_depth > 0 ? mConfig.max_depth : ( mConfig.use_decision_tree ? 8 : CvRTParams().max_depth );
+  base.minSampleCount = mConfig.min_sample_count;
+  base.maxCategories = mConfig.max_categories;
+  base.treesCount = mConfig.trees_count;
+  base.activeVars = mConfig.active_vars;
+  base.cvFolds = mConfig.cv_folds;
+  base.accuracy = 0;
+  base.pixelsPerSecond = 0;
+
+  mCandidates.clear();
+  mCandidates << base;
+
+  QStringList axes = spec.split( QRegExp( "[\\s;]+" ), QString::SkipEmptyParts );
+  for ( int i = 0; i < axes.size(); ++i )
+  {
+    QString name = axes[ i ].section( '=', 0, 0 ).trimmed();
+    QStringList values = axes[ i ].section( '=', 1 ).split( ',', QString::SkipEmptyParts );
+    if ( !candidateField( base, name ) || values.isEmpty() )
+      throw std::runtime_error( QString( "Bad search parameter: %1" ).arg( axes[ i ] ).toStdString() );
+
+    QList<SearchCandidate> grid;
+    for ( int v = 0; v < values.size(); ++v )
+    {
+      bool ok;
+      int value = values[ v ].toInt( &ok );
+      if ( !ok )
+        throw std::runtime_error( QString( "Bad search value: %1" ).arg( axes[ i ] ).toStdString() );
+
+      for ( int c = 0; c < mCandidates.size(); ++c )
+      {
+        SearchCandidate candidate = mCandidates[ c ];
+        *candidateField( candidate, name ) = value;
+        grid << candidate;
+      }
+    }
+    mCandidates = grid;
+  }
+
+  if ( randomCount > 0 && randomCount < mCandidates.size() )
+  {
+    cv::RNG rng( seed ? seed : 1 );
+    for ( int i = mCandidates.size() - 1; i > 0; --i )
+      mCandidates.swap( i, ( unsigned )rng % ( i + 1 ) );
+    mCandidates = mCandidates.mid( 0, randomCount );
+  }
+
+  QgsDebugMsg( QString( "HyperSearch: %1 candidates, %2 folds" ).arg( mCandidates.size() ).arg( mFolds ) );
+}
+
+void HyperSearch::run( int threadCount, quint64 seed )
+{
+  if ( threadCount <= 0 )
+    threadCount = QThread::idealThreadCount();
+
+  // one set of folds for all candidates
+  int sampleCount = mTrainData->rows;
+  std::vector<int> order( sampleCount );
+  for ( int i = 0; i < sampleCount; ++i )
+    order[ i ] = i;
+  cv::RNG rng( seed ? seed : 1 );
+  for ( int i = sampleCount - 1; i > 0; --i )
+    std::swap( order[ i ], order[ ( unsigned )rng % ( i + 1 ) ] );
+
+  std::vector< std::vector<int> > heldOut( mFolds );
+  for ( int i = 0; i < sampleCount; ++i )
+    heldOut[ i % mFolds ].push_back( order[ i ] );
+
+  QList<CandidateTask*> tasks;
+  QThreadPool pool;
+  pool.setMaxThreadCount( threadCount );
+  for ( int c = 0; c < mCandidates.size(); ++c )
+  {
+    for ( int f = 0; f < mFolds; ++f )
+    {
+      // model of the first fold is kept to measure inference cost
+      CandidateTask* task = new CandidateTask( this, c, &heldOut[ f ], seed, f == 0 );
+      tasks << task;
+      pool.start( task );
+    }
+  }
+  pool.waitForDone();
+
+  QString error;
+  std::vector<int> correct( mCandidates.size(), 0 );
+  std::vector<CvStatModel*> models( mCandidates.size(), ( CvStatModel* )0 );
+  for ( int i = 0; i < tasks.size(); ++i )
+  {
+    if ( error.isEmpty() )
+      error = tasks[ i ]->error();
+    correct[ tasks[ i ]->candidate() ] += tasks[ i ]->correct();
+    CvStatModel* model = tasks[ i ]->takeModel();
+    if ( model )
+      models[ tasks[ i ]->candidate() ] = model;
+    delete tasks[ i ];
+  }
+
+  if ( error.isEmpty() )
+  {
+    // timing runs alone, training threads would skew it
+    LatencyTuner tuner( mTrainData );
+    for ( int c = 0; c < mCandidates.size(); ++c )
+    {
+      mCandidates[ c ].accuracy = ( double )correct[ c ] / sampleCount;
+      if ( mConfig.use_decision_tree )
+        mCandidates[ c ].pixelsPerSecond = tuner.pixelsPerSecond( static_cast<CvDTree*>( models[ c ] ) );
+      else
+        mCandidates[ c ].pixelsPerSecond = tuner.pixelsPerSecond( static_cast<CvRTrees*>( models[ c ] ) );
+    }
+  }
+
+  for ( int c = 0; c < mCandidates.size(); ++c )
+    delete models[ c ];
+
+  if ( !error.isEmpty() )
+    throw std::runtime_error( QString( "Parameter search failed: %1" ).arg( error ).toStdString() );
+
+  std::stable_sort( mCandidates.begin(), mCandidates.end(), betterCandidate );
+}
+
+int HyperSearch::evaluate( const SearchCandidate& candidate, const std::vector<int>& heldOut, quint64 seed, CvStatModel** model ) const
+{
+  int sampleCount = mTrainData->rows;
+  std::vector<uchar> isHeldOut( sampleCount, 0 );
+  for ( size_t i = 0; i < heldOut.size(); ++i )
+    isHeldOut[ heldOut[ i ] ] = 1;
+
+  std::vector<int> trainRows;
+  trainRows.reserve( sampleCount - heldOut.size() );
+  for ( int i = 0; i < sampleCount; ++i )
+  {
+    if ( !isHeldOut[ i ] )
+      trainRows.push_back( i );
+  }
+  CvMat sampleIdx = cvMat( 1, ( int )trainRows.size(), CV_32SC1, &trainRows[ 0 ] );
+
+  CvDTree* tree = 0;
+  ParallelRTrees* forest = 0;
+  CvMat* varType = 0;
+  int correct = 0;
+  try
+  {
+    if ( mConfig.use_decision_tree )
+    {
+      CvDTreeParams params( candidate.maxDepth, candidate.minSampleCount, 0, true, candidate.maxCategories,
+                            candidate.cvFolds > 1 ? candidate.cvFolds : 0, false, false, 0 );
+      if ( mConfig.discrete_classes )
+      {
+        varType = cvCreateMat( mTrainData->cols + 1, 1, CV_8U );
+        cvSet( varType, cvScalarAll( CV_VAR_CATEGORICAL ) );
+      }
+      tree = new CvDTree();
+      tree->train( mTrainData, CV_ROW_SAMPLE, mResponses, 0, &sampleIdx, varType, 0, params );
+    }
+    else
+    {
+      CvRTParams params( candidate.maxDepth, candidate.minSampleCount, 0, false, candidate.maxCategories, 0, false,
+                         candidate.activeVars, candidate.treesCount, ( float )mConfig.forest_accuracy,
+                         CV_TERMCRIT_ITER + CV_TERMCRIT_EPS );
+      forest = new ParallelRTrees();
+      // candidates already run concurrently
+      forest->trainParallel( mTrainData, mResponses, 0, params, 1, seed, &sampleIdx );
+    }
+
+    CvMat sample;
+    for ( size_t i = 0; i < heldOut.size(); ++i )
+    {
+      cvGetRow( mTrainData, &sample, heldOut[ i ] );
+      double predicted = tree ? tree->predict( &sample )->value : forest->predict( &sample );
+      // output raster stores rounded values
+      if ( cvRound( predicted ) == cvRound( cvGetReal1D( mResponses, heldOut[ i ] ) ) )
+        correct++;
+    }
+  }
+  catch ( ... )
+  {
+    cvReleaseMat( &varType );
+    delete tree;
+    delete forest;
+    throw;
+  }
+  cvReleaseMat( &varType );
+
+  if ( model )
+  {
+    *model = tree ? ( CvStatModel* )tree : ( CvStatModel* )forest;
+  }
+  else
+  {
+    delete tree;
+    delete forest;
+  }
+  return correct;
+}
+
+void HyperSearch::writeReport( const QString& fileName ) const
+{
+  QFile file( fileName );
+  if ( !file.open( QIODevice::WriteOnly | QIODevice::Text ) )
+    throw std::runtime_error( QString( "Can't write search report %1" ).arg( fileName ).toStdString() );
+
+  QTextStream out( &file );
+  out << "rank,max_depth,min_samples,max_categories,trees,active_vars,cv_folds,accuracy,pixels_per_second\n";
+  for ( int c = 0; c < mCandidates.size(); ++c )
+  {
+    const SearchCandidate& candidate = mCandidates[ c ];
+    out << c + 1 << ","
+        << candidate.maxDepth << ","
+        << candidate.minSampleCount << ","
+        << candidate.maxCategories << ","
+        << candidate.treesCount << ","
+        << candidate.activeVars << ","
+        << candidate.cvFolds << ","
+        << QString::number( candidate.accuracy, 'f', 4 ) << ","
+        << QString::number( candidate.pixelsPerSecond, 'f', 0 ) << "\n";
+  }
+}
+
+void HyperSearch::apply( ClassifierWorkerConfig& config ) const
+{
+  if ( mCandidates.isEmpty() )
+    return;
+
+  const SearchCandidate& best = mCandidates.first();
+  config.max_depth = best.maxDepth;
+  config.min_sample_count = best.minSampleCount;
+  config.max_categories = best.maxCategories;
+  config.trees_count = best.treesCount;
+  config.active_vars = best.activeVars;
+  config.cv_folds = best.cvFolds;
+}
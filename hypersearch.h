@@ -0,0 +1,94 @@
+/***************************************************************************
+  hypersearch.h
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef HYPERSEARCH_H
+#define HYPERSEARCH_H
+
+#include <vector>
+
+#include <QList>
+#include <QString>
+
+#include "opencv2/core/core_c.h"
+#include "opencv2/ml/ml.hpp"
+
+struct ClassifierWorkerConfig;
+
+//! tree parameters of one search candidate and its scores
+struct SearchCandidate
+{
+  int maxDepth;
+  int minSampleCount;
+  int maxCategories;
+  int treesCount;
+  int activeVars;
+  int cvFolds;
+
+  //! share of held-out samples classified correctly, over all folds
+  double accuracy;
+  double pixelsPerSecond;
+};
+
+/**
+  Hyperparameter search for the configured algorithm. Candidates are a grid
+  ("max_depth=4,6,8 min_samples=5,10 trees=20,50") or a random subset of it.
+  Every candidate is trained on the same folds of one read-only train matrix,
+  candidate/fold pairs are trained concurrently. Inference cost is measured
+  afterwards, one candidate at a time. Candidates are OpenCV trees (CvDTree
+  with CV pruning or ParallelRTrees), so the winner only describes models of
+  those trainers; histogram and out-of-core training are not searched.
+  */
+class HyperSearch
+{
+  public:
+    HyperSearch( const ClassifierWorkerConfig& config, const CvMat* trainData, const CvMat* responses, int folds = 5 );
+
+    /** build candidates from the grid spec, randomCount > 0 keeps that many
+      random grid points. Throws std::runtime_error on bad spec
+      */
+    void setGrid( const QString& spec, int randomCount, quint64 seed );
+
+    //! evaluate candidates, threadCount <= 0 - all cores. Throws std::runtime_error
+    void run( int threadCount, quint64 seed );
+
+    //! candidates sorted by accuracy, then by speed
+    const QList<SearchCandidate>& candidates() const { return mCandidates; }
+
+    //! CSV report of ranked candidates, throws std::runtime_error
+    void writeReport( const QString& fileName ) const;
+
+    //! put parameters of the best candidate into config
+    void apply( ClassifierWorkerConfig& config ) const;
+
+    /** train candidate on all rows except the held-out ones and count correct
+      held-out predictions. When model is not 0 the trained model is returned
+      there and the caller deletes it
+      */
+    int evaluate( const SearchCandidate& candidate, const std::vector<int>& heldOut, quint64 seed, CvStatModel** model ) const;
+
+  private:
+    const ClassifierWorkerConfig& mConfig;
+    const CvMat* mTrainData;
+    const CvMat* mResponses;
+    int mFolds;
+
+    QList<SearchCandidate> mCandidates;
+};
+
+#endif // HYPERSEARCH_H
@@ -0,0 +1,131 @@
+/***************************************************************************
+  latencytuner.cpp
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <QElapsedTimer>
+
+#include "treemodel.h"
+#include "latencytuner.h"
+
+namespace
+{
+  // repeat calibration pass until the timing is not dominated by timer resolution
+  const qint64 MinMeasureNsecs = 100 * 1000 * 1000;
+
+  struct DTreePredictor
+  {
+    const CvDTree* tree;
+    const CvMat* samples;
+
+    double operator()( int i ) const
+    {
+      CvMat sample;
+      cvGetRow( samples, &sample, i );
+      return tree->predict( &sample )->value;
+    }
+  };
+
+  struct RTreesPredictor
+  {
+    const CvRTrees* forest;
+    const CvMat* samples;
+
+    double operator()( int i ) const
+    {
+      CvMat sample;
+      cvGetRow( samples, &sample, i );
+      return forest->predict( &sample );
+    }
+  };
+
+  struct ModelPredictor
+  {
+    const TreeModel* model;
+    const float* data;
+    int stride;
+
+    double operator()( int i ) const
+    {
+      return model->predict( data + i, stride );
+    }
+  };
+
+  template <class Predictor>
+  double measure( const Predictor& predictor, int count )
+  {
+    if ( count == 0 )
+      return 0;
+
+    // keeps predictions from being optimized away
+    volatile double sink = 0;
+    qint64 pixels = 0;
+    QElapsedTimer timer;
+    timer.start();
+    do
+    {
+      for ( int i = 0; i < count; ++i )
+        sink += predictor( i );
+      pixels += count;
+    }
+    while ( timer.nsecsElapsed() < MinMeasureNsecs );
+
+    return pixels * 1e9 / timer.nsecsElapsed();
+  }
+}
+
+LatencyTuner::LatencyTuner( const CvMat* trainData, int sampleCount )
+{
+  int rows = qMin( sampleCount, trainData->rows );
+  int cols = trainData->cols;
+  mSamples = cvCreateMat( rows, cols, CV_32FC1 );
+  mBandMajor.resize( ( size_t )rows * cols );
+
+  for ( int i = 0; i < rows; ++i )
+  {
+    int src = ( int )( ( qint64 )i * trainData->rows / rows );
+    for ( int j = 0; j < cols; ++j )
+    {
+      float value = ( float )cvGetReal2D( trainData, src, j );
+      CV_MAT_ELEM( *mSamples, float, i, j ) = value;
+      mBandMajor[ ( size_t )j * rows + i ] = value;
+    }
+  }
+}
+
+LatencyTuner::~LatencyTuner()
+{
+  cvReleaseMat( &mSamples );
+}
+
+double LatencyTuner::pixelsPerSecond( const CvDTree* tree ) const
+{
+  DTreePredictor predictor = { tree, mSamples };
+  return measure( predictor, mSamples->rows );
+}
+
+double LatencyTuner::pixelsPerSecond( const CvRTrees* forest ) const
+{
+  RTreesPredictor predictor = { forest, mSamples };
+  return measure( predictor, mSamples->rows );
+}
+
+double LatencyTuner::pixelsPerSecond( const TreeModel* model ) const
+{
+  ModelPredictor predictor = { model, mBandMajor.empty() ? 0 : &mBandMajor[ 0 ], mSamples->rows };
+  return measure( predictor, mSamples->rows );
+}
@@ -0,0 +1,53 @@
+/***************************************************************************
+  latencytuner.h
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef LATENCYTUNER_H
+#define LATENCYTUNER_H
+
+#include <vector>
+
+#include "opencv2/core/core_c.h"
+#include "opencv2/ml/ml.hpp"
+
+class TreeModel;
+
+/**
+  Measures predict throughput of a trained model on calibration pixels taken
+  from the train matrix. Models are called the same way Classify calls them,
+  so the result is the per-pixel cost of classification without raster I/O.
+  */
+class LatencyTuner
+{
+  public:
+    //! copies up to sampleCount evenly spaced rows of the train matrix
+    LatencyTuner( const CvMat* trainData, int sampleCount = 4096 );
+    ~LatencyTuner();
+
+    double pixelsPerSecond( const CvDTree* tree ) const;
+    double pixelsPerSecond( const CvRTrees* forest ) const;
+    double pixelsPerSecond( const TreeModel* model ) const;
+
+  private:
+    //! calibration pixels as rows
+    CvMat* mSamples;
+    //! the same pixels band-sequential, as Classify passes them to TreeModel
+    std::vector<float> mBandMajor;
+};
+
+#endif // LATENCYTUNER_H
@@ -21,11 +21,13 @@
 #include <string>
 #include <vector>
 
+#include <QScopedPointer>
 #include <QString>
 #include <QTextStream>
 
 #include "classifierworker.h"
 #include "main_application.h"
+#include "treemodel.h"
 
 #define VERSION "0.0.2"
 
@@ -35,26 +37,86 @@ void usage()
             << " Usage: classifier [options]"
               << " [--input_rasters rast1 [rast2, ...]]"
               << " [--presence vect1 [vect2, ...] --absence vect1 [vect2, ...]]" 
-              << " [--classify output]" << std::endl
+              << " [--classify output [output2, ...]]" << std::endl
             << "  " << "options:" << std::endl
             << "    " << "[--decision_tree]\tUse decision tree" << std::endl
             << "    " << "[--discrete_classes]\tOutput values are discrete class labels" << std::endl
             << "    " << "[--generalize kernel_size]\tGeneralize resut using kernel size" << std::endl
             << "    " << "[--save_train_layer output]\tCan be used with --classify to save model" << std::endl
             << "    " << "[--save_model output]\tCan be used with --classify and --save_train_layer to save train layer" << std::endl
-            << "    " << "[--use_model model_filename]\tUse existing model. Ignore --presence --absence --use_train_layer options" << std::endl
+            << "    " << "[--use_model model_filename [model2, ...]]\tUse existing model. Ignore --presence --absence --use_train_layer options. Several models classify the input in one pass, each into the --classify output of the same position" << std::endl
             << "    " << "[--use_train_layer shape_file]\tLoad point layer (train laier). Ignore --presence --absence and --input_rasters if --classify not set" << std::endl
+            << "    " << "[--threads count]\tNumber of threads for training (default: all cores)" << std::endl
+            << "    " << "[--seed value]\tRandom forest seed, the same seed gives the same forest" << std::endl
+            << "    " << "[--cv_folds count]\tPrune decision tree with K fold cross-validation, 0 - no pruning (default: 10)" << std::endl
+            << "    " << "[--max_depth depth]\tMaximum tree depth (default: 8 for decision tree, 5 for random forest)" << std::endl
+            << "    " << "[--min_samples count]\tDon't split tree nodes with fewer samples (default: 10)" << std::endl
+            << "    " << "[--max_categories count]\tCluster categorical values into this number of categories (default: 10)" << std::endl
+            << "    " << "[--trees count]\tMaximum number of trees in random forest (default: 50)" << std::endl
+            << "    " << "[--forest_accuracy value]\tKeep the first trees whose out-of-bag error is below the value (default: 0.1). All trees are trained concurrently before the cut, so it does not save training time" << std::endl
+            << "    " << "[--active_vars count]\tBands tried at every random forest node, 0 - square root of bands count (default: 0)" << std::endl
+            << "    " << "[--target_speed pixels]\tReduce tree depth and forest size until prediction runs at this number of pixels per second. Each depth step retrains OpenCV models from scratch, --histogram models are cut instead" << std::endl
+            << "    " << "[--search grid]\tWith --save_model train candidates like \"max_depth=4,6,8 min_samples=5,10 trees=20,50\" and save the best one, report goes to <model>_search.csv. Candidates are OpenCV trees, so it is not available with --histogram and --memory_budget" << std::endl
+            << "    " << "[--search_random count]\tTry this number of random candidates of the --search grid" << std::endl
+            << "    " << "[--save_train_set output]\tWrite extracted samples to a training-set file" << std::endl
+            << "    " << "[--use_train_set file1 [file2, ...]]\tTrain on training-set files, several files are merged and duplicate pixels removed. Ignore --presence --absence and --use_train_layer options" << std::endl
+            << "    " << "[--shard index/count]\tExtract samples only from raster tiles of shard index (0 .. count-1), use with --save_train_set" << std::endl
+            << "    " << "[--memory_budget megabytes]\tStream samples from a training-set file and keep training memory within the budget" << std::endl
+            << "    " << "[--update_model]\tWith --use_model and --save_model append trees trained on the new samples only to the random forest" << std::endl
+            << "    " << "[--max_trees count]\tWith --update_model drop the oldest trees above this number" << std::endl
+            << "    " << "[--convert_model model_filename]\tConvert model to --save_model format: *.dtm is binary memory-mapped, otherwise YAML TreeModel" << std::endl
+            << "    " << "[--compact]\tCollapse splits with the same outcome and share identical subtrees of the saved or converted model" << std::endl
+            << "    " << "[--save_importance output]\tWrite CSV report of splits per band of the model, with --save_model or --classify" << std::endl
+            << "    " << "[--cache entries]\tCache predictions of repeated pixel values while classifying, e.g. 65536 (default: 0 - no cache)" << std::endl
+            << "    " << "[--vote_margin fraction]\tStop random forest voting when the leading class is ahead by this share of trees, e.g. 0.3 (default: 0 - exact result)" << std::endl
+            << "    " << "[--cascade_depth depth]\tTrain a shallow tree too, pixels it classifies with high purity skip the model. Saved and loaded as <model>_cascade.<ext>" << std::endl
+            << "    " << "[--cascade_purity value]\tMinimal leaf purity of the cascade tree to skip the model (default: 0.95)" << std::endl
+            << "    " << "[--confidence]\tWith --classify also write <output>_confidence.tif: vote share of the winning class or leaf purity, 0..255" << std::endl
+            << "    " << "[--feature expression]\tDerived feature like \"(b4-b3)/(b4+b3)\" or \"t2.b1-t1.b1\" (band 1 of the second input raster), or window statistic mean|var|range(band, size) like \"var(b4,5)\", computed while sampling and classifying. Repeatable, a saved model needs the same features in the same order" << std::endl
+            << "    " << "[--time_series scene1 [scene2, ...]]\tSame-grid scenes in date order, reduced per pixel by --feature \"mean(ts.b1)\", \"min|max|slope|p<N>(ts.bN)\" without stacking them. Without --input_rasters the first scene is the input raster" << std::endl
+            << "    " << "[--aggregates list]\tAggregates of every time series band added as features, e.g. min,max,mean,p10,p90,slope" << std::endl
+            << "    " << "[--segments size]\tClassify SLIC superpixels of about size pixels across by their mean values instead of single pixels (default: 0 - pixels)" << std::endl
+            << "    " << "[--segment_compactness value]\tWeight of spatial distance in --segments, higher gives more regular segments (default: 1)" << std::endl
+            << "    " << "[--mask path]\tClassify only where the mask raster (same grid, nonzero) or mask polygons are, besides nodata and mask bands of the input" << std::endl
+            << "    " << "[--nodata_class value]\tClass of nodata and masked pixels, nodata value of the result (default: 255)" << std::endl
+            << "    " << "[--window minx,miny,maxx,maxy | px:col,row,width,height]\tClassify only this window of the input, in map units or pixels. The result covers the window" << std::endl
+            << "    " << "[--aoi vector]\tClassify only inside these polygons, the result covers their extent" << std::endl
+            << "    " << "[--histogram]\tTrain on bands quantized into 256 bins (fast, for large train sets)" << std::endl
+            << "    " << "[--no_arrow_stream]\tRead presence/absence vectors through QGIS even if GDAL provides Arrow streams" << std::endl
             << "\n Usage examples:" << std::endl
             << "  " << "Classify:" << std::endl
             << "    " << "classifier --input_rasters rast1 [rast2, ...] --presence vect1 [vect2, ...] --absence vect1 [vect2, ...] --classify result.tiff" << std::endl
             << "\n  " << "Classify using a previously saved model:" << std::endl
             << "    " << "classifier --input_rasters rast1 [rast2, ...] --use_model model.yaml --classify result.tiff" << std::endl
+            << "\n  " << "Classify with several models reading the input once:" << std::endl
+            << "    " << "classifier --input_rasters rast1 [rast2, ...] --use_model water.yaml forest.yaml --classify water.tiff forest.tiff" << std::endl
             << "\n  " << "Create model only:" << std::endl
             << "    " << "classifier --input_rasters rast1 [rast2, ...] --presence vect1 [vect2, ...] --absence vect1 [vect2, ...] --save_model model.yaml" << std::endl
             << "\n  " << "Create model only using a previously saved train layer:" << std::endl
             << "    " << "classifier --use_train_layer train_layer.shp --save_model model.yaml" << std::endl
             << "\n  " << "Create train layer only:" << std::endl
             << "    " << "classifier --input_rasters rast1 [rast2, ...] --presence vect1 [vect2, ...] --absence vect1 [vect2, ...] --save_train_layer train_layer.shp" << std::endl
+            << "\n  " << "Create model out-of-core from a training-set file:" << std::endl
+            << "    " << "classifier --use_train_set samples.dts --memory_budget 2048 --save_model model.yaml" << std::endl
+            << "\n  " << "Classify with a cascade, the forest runs only where a shallow tree is uncertain:" << std::endl
+            << "    " << "classifier --input_rasters rast1 [rast2, ...] --presence vect1 [vect2, ...] --absence vect1 [vect2, ...] --cascade_depth 4 --cascade_purity 0.95 --save_model model.yaml --classify result.tiff" << std::endl
+            << "\n  " << "Classify with NDVI and change of band 1 between two dates as extra features:" << std::endl
+            << "    " << "classifier --input_rasters date1.tif date2.tif --presence vect1 --absence vect2 --feature \"(t2.b4-t2.b3)/(t2.b4+t2.b3)\" --feature \"t2.b1-t1.b1\" --classify result.tiff" << std::endl
+            << "\n  " << "Classify from per-pixel aggregates of a time series:" << std::endl
+            << "    " << "classifier --time_series date01.tif date02.tif ... date40.tif --aggregates min,max,mean,p10,p90,slope --presence vect1 --absence vect2 --classify result.tiff" << std::endl
+            << "\n  " << "Classify image objects instead of pixels:" << std::endl
+            << "    " << "classifier --input_rasters rast1 [rast2, ...] --use_model model.yaml --segments 10 --segment_compactness 1 --classify result.tiff" << std::endl
+            << "\n  " << "Classify only cloud-free pixels inside an area:" << std::endl
+            << "    " << "classifier --input_rasters rast1 [rast2, ...] --use_model model.yaml --mask clear_area.shp --nodata_class 255 --classify result.tiff" << std::endl
+            << "\n  " << "Classify a district of a scene:" << std::endl
+            << "    " << "classifier --input_rasters rast1 [rast2, ...] --use_model model.yaml --aoi district.shp --classify district.tiff" << std::endl
+            << "\n  " << "Convert YAML model to fast loading binary model:" << std::endl
+            << "    " << "classifier --convert_model model.yaml [--compact] --save_model model.dtm" << std::endl
+            << "\n  " << "Add trees trained on new samples to a model:" << std::endl
+            << "    " << "classifier --input_rasters rast1 [rast2, ...] --presence vect1 [vect2, ...] --absence vect1 [vect2, ...] --use_model model.yaml --update_model --trees 10 --max_trees 100 --save_model updated.yaml" << std::endl
+            << "\n  " << "Extract training set in shards and merge them:" << std::endl
+            << "    " << "classifier --input_rasters rast1 [rast2, ...] --presence vect1 [vect2, ...] --absence vect1 [vect2, ...] --shard 0/4 --save_train_set shard0.dts" << std::endl
+            << "    " << "classifier --use_train_set shard0.dts shard1.dts shard2.dts shard3.dts --save_train_set samples.dts" << std::endl
             ;
 }
 
@@ -63,6 +125,42 @@ void printError(const std::string& msg)
   std::cerr << std::endl << msg << std::endl << std::endl;
 }
 
+int convertModel(const QString& input, const QString& output, bool decisionTree, bool compact)
+{
+  try
+  {
+    QScopedPointer<TreeModel> model;
+    if (TreeModel::isTreeModelFile(input))
+    {
+      model.reset(new TreeModel());
+      model->load(input);
+    }
+    else if (decisionTree)
+    {
+      CvDTree tree;
+      tree.load(input.toUtf8());
+      model.reset(TreeModel::fromCvDTree(&tree));
+    }
+    else
+    {
+      CvRTrees forest;
+      forest.load(input.toUtf8());
+      model.reset(TreeModel::fromCvRTrees(&forest));
+    }
+    if (compact)
+      model->compact();
+    model->save(output);
+    std::cout << "Model " << output.toStdString() << ": " << model->treeCount() << " trees, "
+              << model->nodeCount() << " nodes" << std::endl;
+  }
+  catch (std::exception& e)
+  {
+    printError(std::string("Model conversion failed: ") + e.what());
+    return 1;
+  }
+  return 0;
+}
+
 void fileExistValidate(const std::string& fname)
 {
   // bool ifExist = ( std::ifstream(fname)!= NULL);
@@ -79,6 +177,7 @@ int main( int argc,
           char *envp[] )
 {
     ClassifierWorkerConfig config;
+    QString convertModelFile;
 
     std::string curent_argument = std::string("");
 
@@ -107,8 +206,7 @@ int main( int argc,
       }
       else if (argument == std::string("--classify"))
       {
-        config.mOutputRaster = QString(argv[count+1]);
-        count++;
+        curent_argument = std::string("--classify");
         continue;
       }
       else if (argument == std::string("--save_model"))
@@ -147,10 +245,235 @@ int main( int argc,
       }
       else if (argument == std::string("--use_model"))
       {
-        config.mInputModel = QString(argv[count+1]);
+        curent_argument = std::string("--use_model");
+        continue;
+      }
+      else if (argument == std::string("--threads"))
+      {
+        config.threads_count = QString(argv[count+1]).toInt();
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--seed"))
+      {
+        config.random_seed = QString(argv[count+1]).toULongLong();
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--cv_folds"))
+      {
+        config.cv_folds = QString(argv[count+1]).toInt();
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--max_depth"))
+      {
+        config.max_depth = QString(argv[count+1]).toInt();
         count++;
         continue;
       }
+      else if (argument == std::string("--min_samples"))
+      {
+        config.min_sample_count = QString(argv[count+1]).toInt();
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--max_categories"))
+      {
+        config.max_categories = QString(argv[count+1]).toInt();
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--trees"))
+      {
+        config.trees_count = QString(argv[count+1]).toInt();
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--forest_accuracy"))
+      {
+        config.forest_accuracy = QString(argv[count+1]).toDouble();
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--active_vars"))
+      {
+        config.active_vars = QString(argv[count+1]).toInt();
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--target_speed"))
+      {
+        config.target_pixels_per_second = QString(argv[count+1]).toDouble();
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--search"))
+      {
+        config.mSearch = QString(argv[count+1]);
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--search_random"))
+      {
+        config.search_random = QString(argv[count+1]).toInt();
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--save_train_set"))
+      {
+        config.mOutputTrainSet = QString(argv[count+1]);
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--use_train_set"))
+      {
+        curent_argument = std::string("--use_train_set");
+        continue;
+      }
+      else if (argument == std::string("--shard"))
+      {
+        QStringList shard = QString(argv[count+1]).split('/');
+        bool indexOk = false, countOk = false;
+        if (shard.size() == 2)
+        {
+          config.shard_index = shard.at(0).toInt(&indexOk);
+          config.shard_count = shard.at(1).toInt(&countOk);
+        }
+        if (!indexOk || !countOk || config.shard_count < 1 || config.shard_index < 0 || config.shard_index >= config.shard_count)
+        {
+          printError("Bad shard: " + std::string(argv[count+1]) + ", expected index/count");
+          return 1;
+        }
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--memory_budget"))
+      {
+        config.memory_budget_mb = QString(argv[count+1]).toInt();
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--histogram"))
+      {
+        config.use_histogram_split = true;
+        continue;
+      }
+      else if (argument == std::string("--convert_model"))
+      {
+        convertModelFile = QString(argv[count+1]);
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--save_importance"))
+      {
+        config.mOutputImportance = QString(argv[count+1]);
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--cache"))
+      {
+        config.prediction_cache = QString(argv[count+1]).toInt();
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--vote_margin"))
+      {
+        config.vote_margin = QString(argv[count+1]).toDouble();
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--cascade_depth"))
+      {
+        config.cascade_depth = QString(argv[count+1]).toInt();
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--cascade_purity"))
+      {
+        config.cascade_purity = QString(argv[count+1]).toDouble();
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--mask"))
+      {
+        config.mMask = QString(argv[count+1]);
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--nodata_class"))
+      {
+        config.nodata_class = QString(argv[count+1]).toInt();
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--window"))
+      {
+        config.mWindow = QString(argv[count+1]);
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--aoi"))
+      {
+        config.mAoi = QString(argv[count+1]);
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--segments"))
+      {
+        config.segment_size = QString(argv[count+1]).toInt();
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--segment_compactness"))
+      {
+        config.segment_compactness = QString(argv[count+1]).toDouble();
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--time_series"))
+      {
+        curent_argument = std::string("--time_series");
+        continue;
+      }
+      else if (argument == std::string("--aggregates"))
+      {
+        config.mAggregates = QString(argv[count+1]).split(",", QString::SkipEmptyParts);
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--feature"))
+      {
+        config.mFeatures << QString(argv[count+1]);
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--confidence"))
+      {
+        config.write_confidence = true;
+        continue;
+      }
+      else if (argument == std::string("--compact"))
+      {
+        config.compact_model = true;
+        continue;
+      }
+      else if (argument == std::string("--update_model"))
+      {
+        config.update_model = true;
+        continue;
+      }
+      else if (argument == std::string("--max_trees"))
+      {
+        config.max_trees = QString(argv[count+1]).toInt();
+        count++;
+        continue;
+      }
+      else if (argument == std::string("--no_arrow_stream"))
+      {
+        config.use_arrow_stream = false;
+        continue;
+      }
       else if (argument == std::string("--use_train_layer"))
       {
         config.mInputPoints = QString(argv[count+1]);
@@ -185,16 +508,82 @@ int main( int argc,
         config.mAbsence << QString(argv[count]);
         continue;
       }
+      else if (curent_argument == std::string("--time_series"))
+      {
+        fileExistValidate(argv[count]);
+        config.mTimeSeries << QString(argv[count]);
+        continue;
+      }
+      else if (curent_argument == std::string("--use_train_set"))
+      {
+        fileExistValidate(argv[count]);
+        config.mInputTrainSets << QString(argv[count]);
+        continue;
+      }
+      else if (curent_argument == std::string("--use_model"))
+      {
+        if (config.mInputModel.isEmpty())
+          config.mInputModel = QString(argv[count]);
+        else
+        {
+          fileExistValidate(argv[count]);
+          config.mExtraInputModels << QString(argv[count]);
+        }
+        continue;
+      }
+      else if (curent_argument == std::string("--classify"))
+      {
+        if (config.mOutputRaster.isEmpty())
+          config.mOutputRaster = QString(argv[count]);
+        else
+          config.mExtraOutputRasters << QString(argv[count]);
+        continue;
+      }
 
       printError("Bad options!");
       usage();
       return 1;
     }
 
+    // ------- Model conversion ---------------------------
+    if (!convertModelFile.isEmpty())
+    {
+      fileExistValidate(convertModelFile.toStdString());
+      if (config.mOutputModel.isEmpty())
+      {
+        printError("--convert_model needs --save_model");
+        return 1;
+      }
+      return convertModel(convertModelFile, config.mOutputModel, config.use_decision_tree, config.compact_model);
+    }
+
     // ------- Validation ---------------------------
-    if (config.mOutputRaster.isEmpty() && config.mOutputModel.isEmpty() && config.mOutputTrainLayer.isEmpty())
+    // the first scene gives the grid when the time series is the only input
+    if (config.mInputRasters.isEmpty() && !config.mTimeSeries.isEmpty())
+    {
+        config.mInputRasters << config.mTimeSeries.at(0);
+    }
+    if (!config.mMask.isEmpty())
+    {
+        fileExistValidate(config.mMask.toStdString());
+    }
+    if (!config.mAoi.isEmpty())
+    {
+        fileExistValidate(config.mAoi.toStdString());
+    }
+    if (config.nodata_class < 0 || config.nodata_class > 255)
     {
-        printError("At least one of the arguments (save_train_layer, save_model, classify) must be specified");
+        printError("--nodata_class must be 0..255");
+        return 1;
+    }
+    if (!config.mAggregates.isEmpty() && config.mTimeSeries.isEmpty())
+    {
+        printError("--aggregates needs --time_series");
+        return 1;
+    }
+    if (config.mOutputRaster.isEmpty() && config.mOutputModel.isEmpty() && config.mOutputTrainLayer.isEmpty() && config.mOutputTrainSet.isEmpty())
+    {
+        printError("At least one of the arguments (save_train_layer, save_train_set, save_model, classify) must be specified");
         usage();
         return 1;   
     }
@@ -212,6 +601,47 @@ int main( int argc,
     {
       fileExistValidate(config.mInputPoints.toStdString());
     }
+    if (config.mExtraInputModels.size() != config.mExtraOutputRasters.size())
+    {
+        printError("Every model of --use_model needs own --classify output");
+        return 1;
+    }
+    if (!config.mExtraInputModels.isEmpty() && config.update_model)
+    {
+        printError("--update_model works with a single model");
+        return 1;
+    }
+    if (config.update_model && (config.mInputModel.isEmpty() || config.mOutputModel.isEmpty()))
+    {
+        printError("--update_model needs --use_model and --save_model");
+        return 1;
+    }
+    if (!config.mOutputImportance.isEmpty() && config.mOutputModel.isEmpty() && config.mOutputRaster.isEmpty())
+    {
+        printError("--save_importance needs --save_model or --classify");
+        return 1;
+    }
+    if (config.cascade_purity <= 0 || config.cascade_purity > 1)
+    {
+        printError("--cascade_purity must be in (0, 1]");
+        return 1;
+    }
+    if (config.shard_count > 1 && (config.mOutputTrainSet.isEmpty() || !config.mInputTrainSets.isEmpty()))
+    {
+        printError("--shard extracts samples from rasters, use it with --save_train_set and without --use_train_set");
+        return 1;
+    }
+    if (!config.mSearch.isEmpty() && (config.use_histogram_split || config.memory_budget_mb > 0))
+    {
+        // candidates are scored with OpenCV trees, which prune and run differently
+        printError("--search scores OpenCV trees, it can't be combined with --histogram or --memory_budget");
+        return 1;
+    }
+    if (!config.mOutputTrainSet.isEmpty() && config.mInputTrainSets.contains(config.mOutputTrainSet))
+    {
+        printError("--save_train_set must not be one of --use_train_set files");
+        return 1;
+    }
     
     // ------- Print input parameters ---------------------------
     std::cout << "Classification arguments" << std::endl;
@@ -230,6 +660,33 @@ int main( int argc,
     {
         std::cout << "\t\t" << config.mAbsence.at(i).toStdString() << std::endl;
     }
+    if (!config.mFeatures.isEmpty())
+    {
+        std::cout << "\tDerived features:" << std::endl;
+        for(int i = 0; i < config.mFeatures.size(); i++)
+        {
+            std::cout << "\t\t" << config.mFeatures.at(i).toStdString() << std::endl;
+        }
+    }
+    if (!config.mTimeSeries.isEmpty())
+    {
+        std::cout << "\tTime series: " << config.mTimeSeries.size() << " scenes";
+        if (!config.mAggregates.isEmpty())
+            std::cout << ", aggregates " << config.mAggregates.join(",").toStdString();
+        std::cout << std::endl;
+    }
+    if (!config.mWindow.isEmpty() || !config.mAoi.isEmpty())
+    {
+        std::cout << "\tRegion of interest: " << config.mWindow.toStdString() << " " << config.mAoi.toStdString() << std::endl;
+    }
+    if (!config.mMask.isEmpty())
+    {
+        std::cout << "\tMask: " << config.mMask.toStdString() << std::endl;
+    }
+    if (config.segment_size > 0)
+    {
+        std::cout << "\tSegments: size " << config.segment_size << ", compactness " << config.segment_compactness << std::endl;
+    }
 
     // ------- Run application ---------------------------
     ClassifierApplication a(argc,argv);
@@ -242,6 +699,7 @@ int main( int argc,
     a.connect( worker, SIGNAL( progressStep(int) ), &a, SLOT( showNextStep(int) ) );
     a.connect( worker, SIGNAL( progressSubStep(int) ), &a, SLOT( showNextSubStep(int) ) );
     a.connect( worker, SIGNAL( errorOccured(QString) ), &a, SLOT( showError(QString) ) );
+    a.connect( worker, SIGNAL( messageReported(QString) ), &a, SLOT( showMessage(QString) ) );
     a.connect( worker, SIGNAL( finished() ), &a, SLOT( showFinish() ) );
     
     worker->process();
@@ -67,6 +67,13 @@ void ClassifierApplication::showFinish()
     mutex->unlock();
 }
 
+void ClassifierApplication::showMessage(QString msg)
+{
+    mutex->lock();
+    std::cout << msg.toStdString() << std::endl;
+    mutex->unlock();
+}
+
 void ClassifierApplication::showError(QString msg)
 {
     mutex->lock();
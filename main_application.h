@@ -20,6 +20,7 @@ class ClassifierApplication : public QgsApplication
         void setSubStepCount(int stepCount);
         void showNextSubStep(int subbStep);
         void showError(QString msg);
+        void showMessage(QString msg);
         void showFinish();
     
     private:
@@ -0,0 +1,652 @@
+/***************************************************************************
+  ograrrowsampler.cpp
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <QString>
+#include <QVariant>
+#include <QtEndian>
+
+#include "gdal_priv.h"
+#include "cpl_string.h"
+#include "ogrsf_frmts.h"
+#include "ogr_spatialref.h"
+#ifdef HAVE_OGR_ARROW_STREAM
+#include "ogr_recordbatch.h"
+#endif
+
+#include "qgsgeometry.h"
+#include "qgslogger.h"
+#include "qgspoint.h"
+
+#include "classifierutils.h"
+#include "featureexpr.h"
+#include "rasterfileinfo.h"
+#include "ograrrowsampler.h"
+
+namespace
+{
+  enum WkbType
+  {
+    WkbPoint = 1,
+    WkbLineString = 2,
+    WkbPolygon = 3,
+    WkbMultiPoint = 4,
+    WkbMultiLineString = 5,
+    WkbMultiPolygon = 6,
+    WkbGeometryCollection = 7
+  };
+
+  //! minimal WKB/ISO WKB/EWKB reader working on the raw batch buffer
+  struct WkbCursor
+  {
+    const unsigned char* ptr;
+    const unsigned char* end;
+    bool swap;
+
+    bool readByte( unsigned char& value )
+    {
+      if ( end - ptr < 1 )
+        return false;
+      value = *ptr++;
+      return true;
+    }
+
+    bool readUInt32( quint32& value )
+    {
+      if ( end - ptr < 4 )
+        return false;
+      memcpy( &value, ptr, 4 );
+      ptr += 4;
+      if ( swap )
+        value = qbswap( value );
+      return true;
+    }
+
+    bool readDouble( double& value )
+    {
+      if ( end - ptr < 8 )
+        return false;
+      quint64 bits;
+      memcpy( &bits, ptr, 8 );
+      ptr += 8;
+      if ( swap )
+        bits = qbswap( bits );
+      memcpy( &value, &bits, 8 );
+      return true;
+    }
+
+    bool skip( size_t count )
+    {
+      if ( ( size_t )( end - ptr ) < count )
+        return false;
+      ptr += count;
+      return true;
+    }
+  };
+
+  bool readHeader( WkbCursor& cur, quint32& type, int& dims )
+  {
+    unsigned char order;
+    if ( !cur.readByte( order ) )
+      return false;
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    cur.swap = ( order == 0 );
+#else
+    cur.swap = ( order == 1 );
+#endif
+    if ( !cur.readUInt32( type ) )
+      return false;
+
+    bool hasZ = ( type & 0x80000000 ) != 0;
+    bool hasM = ( type & 0x40000000 ) != 0;
+    if ( type & 0x20000000 ) // EWKB SRID
+    {
+      if ( !cur.skip( 4 ) )
+        return false;
+    }
+    type &= 0x0fffffff;
+    if ( type >= 3000 )
+    {
+      hasZ = hasM = true;
+      type -= 3000;
+    }
+    else if ( type >= 2000 )
+    {
+      hasM = true;
+      type -= 2000;
+    }
+    else if ( type >= 1000 )
+    {
+      hasZ = true;
+      type -= 1000;
+    }
+    dims = 2 + ( hasZ ? 1 : 0 ) + ( hasM ? 1 : 0 );
+    return true;
+  }
+
+  bool readVertices( WkbCursor& cur, quint32 count, int dims, std::vector<double>& xs, std::vector<double>& ys )
+  {
+    if ( ( size_t )( cur.end - cur.ptr ) < ( size_t )count * dims * 8 )
+      return false;
+    for ( quint32 i = 0; i < count; ++i )
+    {
+      double x, y;
+      cur.readDouble( x );
+      cur.readDouble( y );
+      cur.skip( ( dims - 2 ) * 8 );
+      xs.push_back( x );
+      ys.push_back( y );
+    }
+    return true;
+  }
+
+  bool readGeometry( WkbCursor& cur, std::vector<double>& xs, std::vector<double>& ys,
+                     std::vector<int>& points, std::vector<int>& lines, std::vector<int>& rings, int depth )
+  {
+    quint32 type;
+    int dims;
+    if ( depth > 32 || !readHeader( cur, type, dims ) )
+      return false;
+
+    quint32 count;
+    switch ( type )
+    {
+      case WkbPoint:
+      {
+        size_t first = xs.size();
+        if ( !readVertices( cur, 1, dims, xs, ys ) )
+          return false;
+        // POINT EMPTY is encoded with NaN coordinates
+        if ( xs[ first ] == xs[ first ] && ys[ first ] == ys[ first ] )
+          points.push_back( first );
+        else
+        {
+          xs.pop_back();
+          ys.pop_back();
+        }
+        return true;
+      }
+      case WkbLineString:
+      {
+        if ( !cur.readUInt32( count ) )
+          return false;
+        lines.push_back( xs.size() );
+        if ( !readVertices( cur, count, dims, xs, ys ) )
+          return false;
+        lines.push_back( xs.size() );
+        return true;
+      }
+      case WkbPolygon:
+      {
+        if ( !cur.readUInt32( count ) )
+          return false;
+        for ( quint32 r = 0; r < count; ++r )
+        {
+          quint32 vertexCount;
+          if ( !cur.readUInt32( vertexCount ) )
+            return false;
+          rings.push_back( xs.size() );
+          if ( !readVertices( cur, vertexCount, dims, xs, ys ) )
+            return false;
+          rings.push_back( xs.size() );
+        }
+        return true;
+      }
+      case WkbMultiPoint:
+      case WkbMultiLineString:
+      case WkbMultiPolygon:
+      case WkbGeometryCollection:
+      {
+        if ( !cur.readUInt32( count ) )
+          return false;
+        for ( quint32 i = 0; i < count; ++i )
+        {
+          if ( !readGeometry( cur, xs, ys, points, lines, rings, depth + 1 ) )
+            return false;
+        }
+        return true;
+      }
+      default:
+        return false;
+    }
+  }
+}
+
+OgrArrowSampler::OgrArrowSampler( GDALDataset* raster, RasterFileInfo* rasterInfo )
+    : mRaster( raster ),
+      mRasterInfo( rasterInfo ),
+      mTransform( 0 ),
+      mLayerType( 0 ),
+      mShardIndex( 0 ),
+      mShardCount( 1 ),
+      mFeatures( 0 ),
+      mDerived( 0 )
+{
+  mBandCount = mRasterInfo->bandCount();
+  mXSize = mRasterInfo->xSize();
+  mYSize = mRasterInfo->ySize();
+}
+
+OgrArrowSampler::~OgrArrowSampler()
+{
+  if ( mTransform )
+    OGRCoordinateTransformation::DestroyCT( mTransform );
+}
+
+bool OgrArrowSampler::isAvailable()
+{
+#ifdef HAVE_OGR_ARROW_STREAM
+  return true;
+#else
+  return false;
+#endif
+}
+
+void OgrArrowSampler::setShard( int index, int count )
+{
+  mShardIndex = index;
+  mShardCount = count;
+}
+
+void OgrArrowSampler::setDerivedFeatures( const DerivedFeatures* features )
+{
+  mDerived = features;
+}
+
+int OgrArrowSampler::derivedCount() const
+{
+  return mDerived ? mDerived->count() : 0;
+}
+
+void OgrArrowSampler::deriveFeatures( int width )
+{
+  if ( !mDerived )
+    return;
+  mBandRows.resize( mBandCount );
+  for ( int b = 0; b < mBandCount; ++b )
+    mBandRows[ b ] = &mStrip[ ( size_t )b * width ];
+  mDerivedValues.resize( ( size_t )mDerived->count() * width );
+  mDerived->evaluate( &mBandRows[ 0 ], width, &mDerivedValues[ 0 ], width );
+}
+
+bool OgrArrowSampler::sample( const QString& path, int layerType, QgsFeatureList& features )
+{
+#ifndef HAVE_OGR_ARROW_STREAM
+  Q_UNUSED( path );
+  Q_UNUSED( layerType );
+  Q_UNUSED( features );
+  return false;
+#else
+  GDALDataset* ds = ( GDALDataset* ) GDALOpenEx( path.toUtf8(), GDAL_OF_VECTOR | GDAL_OF_READONLY, NULL, NULL, NULL );
+  if ( ds == NULL || ds->GetLayerCount() == 0 )
+  {
+    if ( ds )
+      GDALClose( ( GDALDatasetH ) ds );
+    return false;
+  }
+  OGRLayer* layer = ds->GetLayer( 0 );
+
+  // only the geometry column is needed, don't let the driver decode attributes
+  OGRFeatureDefn* defn = layer->GetLayerDefn();
+  char** ignored = NULL;
+  for ( int i = 0; i < defn->GetFieldCount(); ++i )
+    ignored = CSLAddString( ignored, defn->GetFieldDefn( i )->GetNameRef() );
+  ignored = CSLAddString( ignored, "OGR_STYLE" );
+  layer->SetIgnoredFields( ( const char** ) ignored );
+  CSLDestroy( ignored );
+
+  // reproject geometries to the raster CRS like the QGIS path does
+  if ( mTransform )
+  {
+    OGRCoordinateTransformation::DestroyCT( mTransform );
+    mTransform = 0;
+  }
+  OGRSpatialReference* srcSRS = layer->GetSpatialRef();
+  OGRSpatialReference dstSRS;
+  QByteArray dstWkt = mRasterInfo->projection().toUtf8();
+  if ( srcSRS && !dstWkt.isEmpty() && dstSRS.importFromWkt( dstWkt.constData() ) == OGRERR_NONE && !srcSRS->IsSame( &dstSRS ) )
+  {
+    OGRSpatialReference src( *srcSRS );
+    src.SetAxisMappingStrategy( OAMS_TRADITIONAL_GIS_ORDER );
+    dstSRS.SetAxisMappingStrategy( OAMS_TRADITIONAL_GIS_ORDER );
+    mTransform = OGRCreateCoordinateTransformation( &src, &dstSRS );
+  }
+
+  QByteArray geomColumn( layer->GetGeometryColumn() );
+  if ( geomColumn.isEmpty() )
+    geomColumn = "wkb_geometry";
+
+  char** options = CSLSetNameValue( NULL, "INCLUDE_FID", "NO" );
+  struct ArrowArrayStream stream;
+  bool ok = layer->GetArrowStream( &stream, options );
+  CSLDestroy( options );
+  if ( !ok )
+  {
+    GDALClose( ( GDALDatasetH ) ds );
+    return false;
+  }
+
+  struct ArrowSchema schema;
+  if ( stream.get_schema( &stream, &schema ) != 0 )
+  {
+    stream.release( &stream );
+    GDALClose( ( GDALDatasetH ) ds );
+    return false;
+  }
+
+  int geomIndex = -1;
+  bool largeOffsets = false;
+  for ( int i = 0; i < schema.n_children; ++i )
+  {
+    if ( geomColumn == schema.children[ i ]->name )
+    {
+      geomIndex = i;
+      largeOffsets = ( strcmp( schema.children[ i ]->format, "Z" ) == 0 );
+      break;
+    }
+  }
+  schema.release( &schema );
+
+  if ( geomIndex < 0 )
+  {
+    QgsDebugMsg( QString( "No WKB geometry column in Arrow stream of %1" ).arg( path ) );
+    stream.release( &stream );
+    GDALClose( ( GDALDatasetH ) ds );
+    return false;
+  }
+
+  mLayerType = layerType;
+  mFeatures = &features;
+  size_t sampledFrom = features.size();
+
+  bool wellFormed = true;
+  struct ArrowArray batch;
+  while ( wellFormed && stream.get_next( &stream, &batch ) == 0 && batch.release != NULL )
+  {
+    const struct ArrowArray* column = batch.children[ geomIndex ];
+    const unsigned char* validity = ( const unsigned char* ) column->buffers[ 0 ];
+    const unsigned char* data = ( const unsigned char* ) column->buffers[ 2 ];
+
+    for ( int64_t i = 0; i < column->length; ++i )
+    {
+      int64_t idx = column->offset + i;
+      if ( validity && !( validity[ idx >> 3 ] & ( 1 << ( idx & 7 ) ) ) )
+        continue;
+
+      int64_t begin, end;
+      if ( largeOffsets )
+      {
+        const int64_t* offsets = ( const int64_t* ) column->buffers[ 1 ];
+        begin = offsets[ idx ];
+        end = offsets[ idx + 1 ];
+      }
+      else
+      {
+        const int32_t* offsets = ( const int32_t* ) column->buffers[ 1 ];
+        begin = offsets[ idx ];
+        end = offsets[ idx + 1 ];
+      }
+
+      if ( !sampleWkb( data + begin, end - begin ) )
+      {
+        wellFormed = false;
+        break;
+      }
+    }
+    batch.release( &batch );
+  }
+  stream.release( &stream );
+  GDALClose( ( GDALDatasetH ) ds );
+
+  if ( !wellFormed )
+  {
+    // let the caller resample the whole layer through QGIS
+    QgsDebugMsg( QString( "Malformed WKB in Arrow stream of %1" ).arg( path ) );
+    features.erase( features.begin() + sampledFrom, features.end() );
+    return false;
+  }
+
+  QgsDebugMsg( QString( "Arrow stream %1: %2 train points" ).arg( path ).arg( features.size() - sampledFrom ) );
+  return true;
+#endif
+}
+
+bool OgrArrowSampler::sampleWkb( const unsigned char* wkb, size_t size )
+{
+  mX.clear();
+  mY.clear();
+  mPoints.clear();
+  mLines.clear();
+  mRings.clear();
+
+  WkbCursor cur;
+  cur.ptr = wkb;
+  cur.end = wkb + size;
+  cur.swap = false;
+  if ( !readGeometry( cur, mX, mY, mPoints, mLines, mRings, 0 ) )
+    return false;
+
+  toPixelSpace();
+
+  samplePoints();
+  sampleLines();
+  samplePolygons();
+  return true;
+}
+
+void OgrArrowSampler::toPixelSpace()
+{
+  if ( mX.empty() )
+    return;
+
+  if ( mTransform )
+    mTransform->Transform( mX.size(), &mX[ 0 ], &mY[ 0 ] );
+
+  double inv[ 6 ];
+  mRasterInfo->invGeoTransform( inv );
+
+  mPx.resize( mX.size() );
+  mPy.resize( mY.size() );
+  for ( size_t i = 0; i < mX.size(); ++i )
+  {
+    mPx[ i ] = inv[ 0 ] + mX[ i ] * inv[ 1 ] + mY[ i ] * inv[ 2 ];
+    mPy[ i ] = inv[ 3 ] + mX[ i ] * inv[ 4 ] + mY[ i ] * inv[ 5 ];
+  }
+}
+
+void OgrArrowSampler::samplePoints()
+{
+  for ( size_t i = 0; i < mPoints.size(); ++i )
+  {
+    int v = mPoints[ i ];
+    int col = ( int ) floor( mPx[ v ] );
+    int row = ( int ) floor( mPy[ v ] );
+    if ( col < 0 || row < 0 || col >= mXSize || row >= mYSize )
+      continue;
+    if ( !pixelInShard( col, row, mShardIndex, mShardCount ) )
+      continue;
+
+    mStrip.resize( mBandCount );
+    mRaster->RasterIO( GF_Read, col, row, 1, 1, ( void* )&mStrip[ 0 ], 1, 1, GDT_Float32, mBandCount, 0, 0, 0, 0 );
+    deriveFeatures( 1 );
+    if ( mDerived && mDerived->readsRaster() )
+      mDerived->evaluateAt( mRaster, col, row, &mDerivedValues[ 0 ], 1 );
+
+    // keep the original point location as the QGIS path does
+    int derived = derivedCount();
+    QgsFeature feat;
+    feat.setGeometry( QgsGeometry::fromPoint( QgsPoint( mX[ v ], mY[ v ] ) ) );
+    feat.initAttributes( mBandCount + derived + 1 );
+    for ( int b = 0; b < mBandCount; ++b )
+      feat.setAttribute( b, QVariant( ( double )mStrip[ b ] ) );
+    for ( int f = 0; f < derived; ++f )
+      feat.setAttribute( mBandCount + f, QVariant( ( double )mDerivedValues[ f ] ) );
+    feat.setAttribute( mBandCount + derived, QVariant( mLayerType ) );
+    mFeatures->append( feat );
+  }
+}
+
+void OgrArrowSampler::samplePolygons()
+{
+  if ( mRings.empty() )
+    return;
+
+  double minY = mPy[ mRings[ 0 ] ], maxY = minY;
+  for ( size_t r = 0; r < mRings.size(); r += 2 )
+  {
+    for ( int v = mRings[ r ]; v < mRings[ r + 1 ]; ++v )
+    {
+      minY = std::min( minY, mPy[ v ] );
+      maxY = std::max( maxY, mPy[ v ] );
+    }
+  }
+
+  int rowFrom = std::max( 0, ( int ) floor( minY ) );
+  int rowTo = std::min( mYSize - 1, ( int ) floor( maxY ) );
+
+  // even-odd scanline through pixel centers over all rings (holes included)
+  std::vector<double> crossings;
+  std::vector<int> cols;
+  for ( int row = rowFrom; row <= rowTo; ++row )
+  {
+    double yc = row + 0.5;
+    crossings.clear();
+    for ( size_t r = 0; r < mRings.size(); r += 2 )
+    {
+      int first = mRings[ r ];
+      int last = mRings[ r + 1 ];
+      for ( int v = first; v < last; ++v )
+      {
+        int w = ( v + 1 < last ) ? v + 1 : first;
+        double y0 = mPy[ v ], y1 = mPy[ w ];
+        if ( ( y0 > yc ) != ( y1 > yc ) )
+          crossings.push_back( mPx[ v ] + ( yc - y0 ) * ( mPx[ w ] - mPx[ v ] ) / ( y1 - y0 ) );
+      }
+    }
+    if ( crossings.size() < 2 )
+      continue;
+    std::sort( crossings.begin(), crossings.end() );
+
+    cols.clear();
+    for ( size_t k = 0; k + 1 < crossings.size(); k += 2 )
+    {
+      int colFrom = std::max( 0, ( int ) ceil( crossings[ k ] - 0.5 ) );
+      int colTo = std::min( mXSize, ( int ) ceil( crossings[ k + 1 ] - 0.5 ) );
+      for ( int col = colFrom; col < colTo; ++col )
+        cols.push_back( col );
+    }
+    if ( !cols.empty() )
+      emitStrip( row, cols );
+  }
+}
+
+void OgrArrowSampler::sampleLines()
+{
+  if ( mLines.empty() )
+    return;
+
+  // QGIS path buffers lines by half a pixel, so take pixels whose
+  // centers are closer than 0.5 pixel to any segment
+  std::vector<qint64> hits;
+  for ( size_t l = 0; l < mLines.size(); l += 2 )
+  {
+    for ( int v = mLines[ l ]; v + 1 < mLines[ l + 1 ]; ++v )
+    {
+      double x0 = mPx[ v ], y0 = mPy[ v ];
+      double dx = mPx[ v + 1 ] - x0, dy = mPy[ v + 1 ] - y0;
+      double len2 = dx * dx + dy * dy;
+
+      int colFrom = std::max( 0, ( int ) floor( std::min( x0, x0 + dx ) - 0.5 ) );
+      int colTo = std::min( mXSize - 1, ( int ) floor( std::max( x0, x0 + dx ) + 0.5 ) );
+      int rowFrom = std::max( 0, ( int ) floor( std::min( y0, y0 + dy ) - 0.5 ) );
+      int rowTo = std::min( mYSize - 1, ( int ) floor( std::max( y0, y0 + dy ) + 0.5 ) );
+
+      for ( int row = rowFrom; row <= rowTo; ++row )
+      {
+        for ( int col = colFrom; col <= colTo; ++col )
+        {
+          double cx = col + 0.5 - x0, cy = row + 0.5 - y0;
+          double t = len2 > 0 ? std::max( 0.0, std::min( 1.0, ( cx * dx + cy * dy ) / len2 ) ) : 0.0;
+          double ex = cx - t * dx, ey = cy - t * dy;
+          if ( ex * ex + ey * ey <= 0.25 )
+            hits.push_back( ( qint64 )row * mXSize + col );
+        }
+      }
+    }
+  }
+
+  std::sort( hits.begin(), hits.end() );
+  hits.erase( std::unique( hits.begin(), hits.end() ), hits.end() );
+
+  std::vector<int> cols;
+  size_t i = 0;
+  while ( i < hits.size() )
+  {
+    int row = hits[ i ] / mXSize;
+    cols.clear();
+    for ( ; i < hits.size() && hits[ i ] / mXSize == row; ++i )
+      cols.push_back( hits[ i ] % mXSize );
+    emitStrip( row, cols );
+  }
+}
+
+void OgrArrowSampler::emitStrip( int row, std::vector<int>& cols )
+{
+  if ( mShardCount > 1 )
+  {
+    size_t kept = 0;
+    for ( size_t i = 0; i < cols.size(); ++i )
+      if ( pixelInShard( cols[ i ], row, mShardIndex, mShardCount ) )
+        cols[ kept++ ] = cols[ i ];
+    cols.resize( kept );
+    if ( cols.empty() )
+      return;
+  }
+
+  int colFrom = cols.front();
+  int width = cols.back() - colFrom + 1;
+
+  mStrip.resize( ( size_t )width * mBandCount );
+  mRaster->RasterIO( GF_Read, colFrom, row, width, 1, ( void* )&mStrip[ 0 ], width, 1, GDT_Float32, mBandCount, 0, 0, 0, 0 );
+  // features of the whole strip at once
+  deriveFeatures( width );
+  int derived = derivedCount();
+
+  double x, y;
+  for ( size_t i = 0; i < cols.size(); ++i )
+  {
+    int offset = cols[ i ] - colFrom;
+    mRasterInfo->pixelToMap( cols[ i ] + 0.5, row + 0.5, x, y );
+    if ( mDerived && mDerived->readsRaster() )
+      mDerived->evaluateAt( mRaster, cols[ i ], row, &mDerivedValues[ offset ], width );
+
+    QgsFeature feat;
+    feat.setGeometry( QgsGeometry::fromPoint( QgsPoint( x, y ) ) );
+    feat.initAttributes( mBandCount + derived + 1 );
+    for ( int b = 0; b < mBandCount; ++b )
+      feat.setAttribute( b, QVariant( ( double )mStrip[ ( size_t )b * width + offset ] ) );
+    for ( int f = 0; f < derived; ++f )
+      feat.setAttribute( mBandCount + f, QVariant( ( double )mDerivedValues[ ( size_t )f * width + offset ] ) );
+    feat.setAttribute( mBandCount + derived, QVariant( mLayerType ) );
+    mFeatures->append( feat );
+  }
+}
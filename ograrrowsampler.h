@@ -0,0 +1,114 @@
+/***************************************************************************
+  ograrrowsampler.h
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef OGRARROWSAMPLER_H
+#define OGRARROWSAMPLER_H
+
+#include <vector>
+
+#include "gdal.h"
+
+#include "qgsfeature.h"
+
+// OGRLayer::GetArrowStream() appeared in GDAL 3.6
+#if defined(GDAL_VERSION_NUM) && GDAL_VERSION_NUM >= 3060000
+#define HAVE_OGR_ARROW_STREAM 1
+#endif
+
+class QString;
+class DerivedFeatures;
+class GDALDataset;
+class OGRCoordinateTransformation;
+class RasterFileInfo;
+
+/**
+  Reads training geometries through the OGR ArrowArrayStream interface and
+  samples raster pixels covered by them directly from WKB batches, without
+  building QgsFeature/QgsGeometry objects for the source features.
+  */
+class OgrArrowSampler
+{
+  public:
+    OgrArrowSampler( GDALDataset* raster, RasterFileInfo* rasterInfo );
+    ~OgrArrowSampler();
+
+    //! true when GDAL was built with ArrowArrayStream support
+    static bool isAvailable();
+
+    //! sample only pixels of the shard, see pixelInShard()
+    void setShard( int index, int count );
+
+    //! derived feature values are appended to the band values of every point, NULL - none
+    void setDerivedFeatures( const DerivedFeatures* features );
+
+    /** sample pixels covered by the geometries of the vector file and append
+      train points to features. Returns false when the file can't be read
+      through the Arrow stream, so the caller can fall back to QGIS iterators
+      */
+    bool sample( const QString& path, int layerType, QgsFeatureList& features );
+
+    //! sample one WKB geometry, returns false on malformed WKB
+    bool sampleWkb( const unsigned char* wkb, size_t size );
+
+  private:
+    void samplePoints();
+    void samplePolygons();
+    void sampleLines();
+
+    //! read pixel strip of all bands and emit train points for sorted columns of the row,
+    //! columns of other shards are removed from cols
+    void emitStrip( int row, std::vector<int>& cols );
+
+    //! evaluate derived features of band-sequential mStrip of width pixels into mDerivedValues
+    void deriveFeatures( int width );
+    int derivedCount() const;
+
+    //! transform collected vertices to raster CRS and pixel space
+    void toPixelSpace();
+
+    GDALDataset* mRaster;
+    RasterFileInfo* mRasterInfo;
+    OGRCoordinateTransformation* mTransform;
+
+    int mBandCount;
+    int mXSize;
+    int mYSize;
+    int mLayerType;
+    int mShardIndex;
+    int mShardCount;
+    QgsFeatureList* mFeatures;
+    const DerivedFeatures* mDerived;
+
+    //! vertex buffers reused between geometries
+    std::vector<double> mX;
+    std::vector<double> mY;
+    std::vector<double> mPx;
+    std::vector<double> mPy;
+
+    //! vertex indices of points, [begin, end) vertex ranges of lines and rings
+    std::vector<int> mPoints;
+    std::vector<int> mLines;
+    std::vector<int> mRings;
+
+    std::vector<float> mStrip;
+    std::vector<float> mDerivedValues;
+    std::vector<const float*> mBandRows;
+};
+
+#endif // OGRARROWSAMPLER_H
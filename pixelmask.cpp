@@ -0,0 +1,192 @@
+/***************************************************************************
+  pixelmask.cpp
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "gdal_priv.h"
+#include "gdal_alg.h"
+
+#include "pixelmask.h"
+
+namespace
+{
+  //! rows of polygons rasterized at once
+  const int MaskBlockRows = 256;
+}
+
+PixelMask::PixelMask( GDALDataset* raster, const QVector<int>& bands, const QStringList& maskPaths, int xOff, int xSize )
+    : mRaster( raster ),
+      mXOff( xOff ),
+      mXSize( xSize < 0 ? raster->GetRasterXSize() - xOff : xSize ),
+      mYSize( raster->GetRasterYSize() ),
+      mRow( mXSize )
+{
+  for ( int i = 0; i < bands.size(); ++i )
+  {
+    GDALRasterBand* band = raster->GetRasterBand( bands.at( i ) );
+    int flags = band->GetMaskFlags();
+    if ( flags & GMF_ALL_VALID )
+      continue;
+    if ( flags & GMF_NODATA )
+      mNodataBands.push_back( band );
+    // bands of a per-dataset mask share it
+    GDALRasterBand* maskBand = band->GetMaskBand();
+    if ( std::find( mMaskBands.begin(), mMaskBands.end(), maskBand ) == mMaskBands.end() )
+      mMaskBands.push_back( maskBand );
+  }
+
+  for ( int i = 0; i < maskPaths.size(); ++i )
+  {
+    GDALDataset* dataset = ( GDALDataset* ) GDALOpenEx( maskPaths.at( i ).toUtf8(), GDAL_OF_RASTER | GDAL_OF_VECTOR, NULL, NULL, NULL );
+    if ( dataset == NULL )
+    {
+      close();
+      throw std::runtime_error( QString( "Can't open mask %1" ).arg( maskPaths.at( i ) ).toStdString() );
+    }
+    ExternalMask mask = { dataset, NULL, -1 };
+    mMasks.push_back( mask );
+
+    QString error;
+    if ( dataset->GetRasterCount() > 0 )
+    {
+      if ( dataset->GetRasterXSize() != raster->GetRasterXSize() || dataset->GetRasterYSize() != mYSize )
+        error = QString( "Mask %1 is %2x%3, input raster is %4x%5" ).arg( maskPaths.at( i ) )
+                .arg( dataset->GetRasterXSize() ).arg( dataset->GetRasterYSize() ).arg( raster->GetRasterXSize() ).arg( mYSize );
+    }
+    else if ( dataset->GetLayerCount() == 0 )
+      error = QString( "Mask %1 has no layers" ).arg( maskPaths.at( i ) );
+    if ( !error.isEmpty() )
+    {
+      close();
+      throw std::runtime_error( error.toStdString() );
+    }
+  }
+}
+
+PixelMask::~PixelMask()
+{
+  close();
+}
+
+void PixelMask::close()
+{
+  for ( size_t i = 0; i < mMasks.size(); ++i )
+  {
+    GDALClose( ( GDALDatasetH ) mMasks[ i ].dataset );
+    if ( mMasks[ i ].block )
+      GDALClose( ( GDALDatasetH ) mMasks[ i ].block );
+  }
+  mMasks.clear();
+}
+
+bool PixelMask::readRow( int row, unsigned char* valid )
+{
+  std::fill( valid, valid + mXSize, 1 );
+
+#if GDAL_VERSION_NUM >= 2020000
+  // unwritten blocks of sparse files read as nodata. Only a shortcut, older
+  // GDAL finds the same pixels through the mask bands below
+  for ( size_t b = 0; b < mNodataBands.size(); ++b )
+  {
+    if ( mNodataBands[ b ]->GetDataCoverageStatus( mXOff, row, mXSize, 1, 0, NULL ) == GDAL_DATA_COVERAGE_STATUS_EMPTY )
+    {
+      std::fill( valid, valid + mXSize, 0 );
+      return false;
+    }
+  }
+#endif
+
+  // external masks go first, rows they mask out skip the band masks
+  for ( size_t i = 0; i < mMasks.size(); ++i )
+  {
+    ExternalMask& mask = mMasks[ i ];
+    if ( mask.dataset->GetRasterCount() > 0 )
+      readMaskRow( mask.dataset->GetRasterBand( 1 ), mXOff, row );
+    else
+    {
+      if ( mask.blockRow < 0 || row < mask.blockRow || row >= mask.blockRow + mask.block->GetRasterYSize() )
+        rasterizeBlock( mask, row );
+      readMaskRow( mask.block->GetRasterBand( 1 ), 0, row - mask.blockRow );
+    }
+    if ( !applyRow( valid ) )
+      return false;
+  }
+  for ( size_t b = 0; b < mMaskBands.size(); ++b )
+  {
+    readMaskRow( mMaskBands[ b ], mXOff, row );
+    if ( !applyRow( valid ) )
+      return false;
+  }
+  return true;
+}
+
+void PixelMask::readMaskRow( GDALRasterBand* band, int xOff, int row )
+{
+  if ( band->RasterIO( GF_Read, xOff, row, mXSize, 1, ( void* )&mRow[ 0 ], mXSize, 1, GDT_Byte, 0, 0 ) != CE_None )
+    throw std::runtime_error( QString( "Can't read mask row %1" ).arg( row ).toStdString() );
+}
+
+bool PixelMask::applyRow( unsigned char* valid ) const
+{
+  bool any = false;
+  for ( int x = 0; x < mXSize; ++x )
+  {
+    valid[ x ] &= mRow[ x ] != 0;
+    any = any || valid[ x ];
+  }
+  return any;
+}
+
+void PixelMask::rasterizeBlock( ExternalMask& mask, int row )
+{
+  mask.blockRow = row - row % MaskBlockRows;
+  int height = std::min( MaskBlockRows, mYSize - mask.blockRow );
+  if ( mask.block && mask.block->GetRasterYSize() != height )
+  {
+    GDALClose( ( GDALDatasetH ) mask.block );
+    mask.block = NULL;
+  }
+  if ( !mask.block )
+  {
+    GDALDriver* driver = GetGDALDriverManager()->GetDriverByName( "MEM" );
+    mask.block = driver->Create( "", mXSize, height, 1, GDT_Byte, NULL );
+    if ( mask.block == NULL )
+      throw std::runtime_error( "Can't create mask block" );
+    mask.block->SetProjection( mRaster->GetProjectionRef() );
+  }
+
+  // the block covers the read columns of its rows
+  double geoTransform[ 6 ];
+  mRaster->GetGeoTransform( geoTransform );
+  geoTransform[ 0 ] += mXOff * geoTransform[ 1 ] + mask.blockRow * geoTransform[ 2 ];
+  geoTransform[ 3 ] += mXOff * geoTransform[ 4 ] + mask.blockRow * geoTransform[ 5 ];
+  mask.block->SetGeoTransform( geoTransform );
+  mask.block->GetRasterBand( 1 )->Fill( 0 );
+
+  // polygons in other CRS are transformed to the raster one
+  std::vector<OGRLayerH> layers;
+  for ( int i = 0; i < mask.dataset->GetLayerCount(); ++i )
+    layers.push_back( ( OGRLayerH ) mask.dataset->GetLayer( i ) );
+  std::vector<double> burn( layers.size(), 1.0 );
+  int bandList = 1;
+  if ( GDALRasterizeLayers( ( GDALDatasetH ) mask.block, 1, &bandList, ( int )layers.size(), &layers[ 0 ],
+                            NULL, NULL, &burn[ 0 ], NULL, NULL, NULL ) != CE_None )
+    throw std::runtime_error( QString( "Can't rasterize mask rows %1..%2" ).arg( mask.blockRow ).arg( mask.blockRow + height - 1 ).toStdString() );
+}
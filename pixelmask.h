@@ -0,0 +1,89 @@
+/***************************************************************************
+  pixelmask.h
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef PIXELMASK_H
+#define PIXELMASK_H
+
+#include <vector>
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+class GDALDataset;
+class GDALRasterBand;
+
+/**
+  Valid pixels of the input raster, row by row. A pixel is masked when a
+  band it is classified on is nodata or masked by the GDAL mask band
+  (alpha, per-dataset mask), or when one of the external masks excludes
+  it: a raster on the input grid (nonzero is valid) or polygons covering the
+  valid area, rasterized in blocks of rows as the rows are asked for. Only
+  columns xOff .. xOff + xSize - 1 are read and rasterized.
+  */
+class PixelMask
+{
+  public:
+    /** bands are 1-based bands of raster, xSize -1 - up to the raster edge.
+      Throws std::runtime_error when a mask can't be opened or doesn't match
+      the raster
+      */
+    PixelMask( GDALDataset* raster, const QVector<int>& bands, const QStringList& maskPaths = QStringList(),
+               int xOff = 0, int xSize = -1 );
+    ~PixelMask();
+
+    //! true when every pixel is valid and readRow() is not needed
+    bool isEmpty() const { return mMaskBands.empty() && mNodataBands.empty() && mMasks.empty(); }
+
+    /** validity of row pixels to valid (1 - valid, 0 - masked), valid[ 0 ]
+      is column xOff. Returns false when the whole row is masked. Rows in
+      unwritten blocks of nodata bands are masked without reading. Throws
+      std::runtime_error
+      */
+    bool readRow( int row, unsigned char* valid );
+
+  private:
+    struct ExternalMask
+    {
+      GDALDataset* dataset;
+      //! rasterized polygons of rows blockRow .. blockRow + block height - 1
+      GDALDataset* block;
+      int blockRow;
+    };
+
+    void close();
+    //! xSize columns of a mask band row to mRow
+    void readMaskRow( GDALRasterBand* band, int xOff, int row );
+    //! masks valid by mRow, returns true when some pixel stays valid
+    bool applyRow( unsigned char* valid ) const;
+    void rasterizeBlock( ExternalMask& mask, int row );
+
+    GDALDataset* mRaster;
+    int mXOff;
+    int mXSize;
+    int mYSize;
+    //! distinct mask bands that can mask pixels
+    std::vector<GDALRasterBand*> mMaskBands;
+    //! bands with nodata value, whose sparse blocks are nodata
+    std::vector<GDALRasterBand*> mNodataBands;
+    std::vector<ExternalMask> mMasks;
+    std::vector<unsigned char> mRow;
+};
+
+#endif // PIXELMASK_H
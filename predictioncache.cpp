@@ -0,0 +1,47 @@
+/***************************************************************************
+  predictioncache.cpp
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "predictioncache.h"
+
+PredictionCache::PredictionCache( int keySize, int capacity )
+    : mKeySize( keySize ),
+      mMask( 0 ),
+      mKey( keySize ),
+      mSlot( 0 ),
+      mHits( 0 ),
+      mMisses( 0 )
+{
+  quint32 size = 1;
+  while ( size < ( quint32 )capacity && size < ( 1u << 30 ) )
+    size <<= 1;
+  mMask = size - 1;
+
+  mKeys.resize( ( size_t )size * keySize );
+  mValues.resize( size );
+  mConfidences.resize( size );
+  mUsed.assign( size, 0 );
+}
+
+void PredictionCache::insert( float value, float confidence )
+{
+  memcpy( &mKeys[ ( size_t )mSlot * mKeySize ], &mKey[ 0 ], mKeySize );
+  mValues[ mSlot ] = value;
+  mConfidences[ mSlot ] = confidence;
+  mUsed[ mSlot ] = 1;
+}
@@ -0,0 +1,84 @@
+/***************************************************************************
+  predictioncache.h
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef PREDICTIONCACHE_H
+#define PREDICTIONCACHE_H
+
+#include <cstring>
+#include <vector>
+
+#include <QtGlobal>
+
+/**
+  Bounded cache of predictions keyed by the raw bytes of a pixel across
+  bands. It is direct-mapped: every key has one slot and a new key replaces
+  the previous one, so memory stays at capacity entries and lookups cost a
+  hash and a compare. Not thread-safe, every classifying thread owns one.
+  */
+class PredictionCache
+{
+  public:
+    //! keySize bytes per key, capacity is rounded up to a power of two
+    PredictionCache( int keySize, int capacity );
+
+    //! buffer the caller fills with the key of the next find()
+    unsigned char* key() { return &mKey[ 0 ]; }
+
+    //! look up key(), returns true and the value with its confidence when it is cached
+    inline bool find( float& value, float& confidence );
+    //! store value for the key of the last find()
+    void insert( float value, float confidence = 0 );
+
+    qint64 hits() const { return mHits; }
+    qint64 misses() const { return mMisses; }
+    double hitRate() const { return mHits + mMisses > 0 ? ( double )mHits / ( mHits + mMisses ) : 0; }
+
+  private:
+    int mKeySize;
+    quint32 mMask;
+    std::vector<unsigned char> mKeys;
+    std::vector<float> mValues;
+    std::vector<float> mConfidences;
+    std::vector<unsigned char> mUsed;
+    std::vector<unsigned char> mKey;
+    quint32 mSlot;
+    qint64 mHits;
+    qint64 mMisses;
+};
+
+inline bool PredictionCache::find( float& value, float& confidence )
+{
+  // FNV-1a
+  quint32 hash = 2166136261u;
+  for ( int i = 0; i < mKeySize; ++i )
+    hash = ( hash ^ mKey[ i ] ) * 16777619u;
+  mSlot = hash & mMask;
+
+  if ( mUsed[ mSlot ] && memcmp( &mKeys[ ( size_t )mSlot * mKeySize ], &mKey[ 0 ], mKeySize ) == 0 )
+  {
+    value = mValues[ mSlot ];
+    confidence = mConfidences[ mSlot ];
+    mHits++;
+    return true;
+  }
+  mMisses++;
+  return false;
+}
+
+#endif // PREDICTIONCACHE_H
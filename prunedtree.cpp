@@ -0,0 +1,358 @@
+/***************************************************************************
+  prunedtree.cpp
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <stdexcept>
+
+#include <QList>
+#include <QRunnable>
+#include <QString>
+#include <QThread>
+#include <QThreadPool>
+
+#include "qgslogger.h"
+
+#include "foresttrainer.h"
+#include "prunedtree.h"
+
+namespace
+{
+  class FoldTask : public QRunnable
+  {
+    public:
+      FoldTask( PrunedDTree* tree, const CvMat* trainData, const CvMat* responses, const CvMat* sampleIdx,
+                const CvMat* varType, const CvDTreeParams& params )
+          : mTree( tree ),
+            mTrainData( trainData ),
+            mResponses( responses ),
+            mSampleIdx( sampleIdx ),
+            mVarType( varType ),
+            mParams( params ),
+            mHeldOut( 0 ),
+            mBetas( 0 ),
+            mErrors( 0 )
+      {
+        setAutoDelete( false );
+      }
+
+      //! switch the task from training to held-out evaluation
+      void setEvaluation( const std::vector<int>* heldOut, const std::vector<double>* betas, std::vector<double>* errors )
+      {
+        mHeldOut = heldOut;
+        mBetas = betas;
+        mErrors = errors;
+      }
+
+      void run()
+      {
+        try
+        {
+          if ( mErrors )
+            mTree->foldErrors( mTrainData, mResponses, *mHeldOut, *mBetas, *mErrors );
+          else
+            mTree->trainFold( mTrainData, mResponses, mSampleIdx, mVarType, mParams );
+        }
+        catch ( cv::Exception& e )
+        {
+          mError = QString::fromStdString( e.what() );
+        }
+        catch ( std::exception& e )
+        {
+          mError = QString::fromStdString( e.what() );
+        }
+      }
+
+      QString error() const { return mError; }
+
+    private:
+      PrunedDTree* mTree;
+      const CvMat* mTrainData;
+      const CvMat* mResponses;
+      const CvMat* mSampleIdx;
+      const CvMat* mVarType;
+      CvDTreeParams mParams;
+      const std::vector<int>* mHeldOut;
+      const std::vector<double>* mBetas;
+      std::vector<double>* mErrors;
+      QString mError;
+  };
+
+  QString runTasks( QList<FoldTask*>& tasks, int threadCount )
+  {
+    QThreadPool pool;
+    pool.setMaxThreadCount( qMax( 1, qMin( threadCount, tasks.size() ) ) );
+    for ( int i = 0; i < tasks.size(); ++i )
+      pool.start( tasks[ i ] );
+    pool.waitForDone();
+
+    for ( int i = 0; i < tasks.size(); ++i )
+    {
+      if ( !tasks[ i ]->error().isEmpty() )
+        return tasks[ i ]->error();
+    }
+    return QString();
+  }
+}
+
+PrunedDTree::PrunedDTree()
+    : CvDTree()
+{
+}
+
+PrunedDTree::~PrunedDTree()
+{
+}
+
+void PrunedDTree::trainPruned( const CvMat* trainData, const CvMat* responses, const CvMat* varType,
+                               CvDTreeParams params, int threadCount, quint64 seed )
+{
+  clear();
+  mAlphas.clear();
+
+  int folds = params.cv_folds;
+  bool use1seRule = params.use_1se_rule;
+  // OpenCV's own cross-validation runs folds one after another, do it here instead
+  params.cv_folds = 0;
+
+  if ( folds <= 1 )
+  {
+    trainFold( trainData, responses, 0, varType, params );
+    return;
+  }
+
+  if ( threadCount <= 0 )
+    threadCount = QThread::idealThreadCount();
+
+  int sampleCount = trainData->rows;
+  folds = qMin( folds, sampleCount );
+
+  // every tree in training owns a copy of the samples (freed once it is
+  // grown), concurrent copies share the memory cap of forest chunks
+  threadCount = qMin( threadCount, ParallelRTrees::maxConcurrentTrainData( sampleCount, trainData->cols ) );
+
+  // shuffled fold assignment, reproducible for the seed
+  std::vector<int> order( sampleCount );
+  for ( int i = 0; i < sampleCount; ++i )
+    order[ i ] = i;
+  cv::RNG rng( seed ? seed : 1 );
+  for ( int i = sampleCount - 1; i > 0; --i )
+    std::swap( order[ i ], order[ ( unsigned )rng % ( i + 1 ) ] );
+
+  std::vector< std::vector<int> > heldOut( folds );
+  for ( int i = 0; i < sampleCount; ++i )
+    heldOut[ i % folds ].push_back( order[ i ] );
+
+  QList<PrunedDTree*> foldTrees;
+  QList<CvMat*> foldIdx;
+  QList<FoldTask*> tasks;
+
+  // the full tree is trained together with the fold trees
+  tasks << new FoldTask( this, trainData, responses, 0, varType, params );
+  for ( int f = 0; f < folds; ++f )
+  {
+    CvMat* idx = cvCreateMat( 1, sampleCount - ( int )heldOut[ f ].size(), CV_32SC1 );
+    int n = 0;
+    for ( int g = 0; g < folds; ++g )
+    {
+      if ( g == f )
+        continue;
+      for ( size_t i = 0; i < heldOut[ g ].size(); ++i )
+        idx->data.i[ n++ ] = heldOut[ g ][ i ];
+    }
+    std::sort( idx->data.i, idx->data.i + n );
+
+    PrunedDTree* tree = new PrunedDTree();
+    foldTrees << tree;
+    foldIdx << idx;
+    tasks << new FoldTask( tree, trainData, responses, idx, varType, params );
+  }
+
+  QString error = runTasks( tasks, threadCount );
+
+  // subtree k of the full tree is represented by the geometric mean of its complexity interval
+  std::vector<double> betas( mAlphas.size() );
+  std::vector< std::vector<double> > errors( folds );
+  if ( error.isEmpty() )
+  {
+    for ( size_t k = 0; k < mAlphas.size(); ++k )
+      betas[ k ] = k + 1 < mAlphas.size() ? sqrt( mAlphas[ k ] * mAlphas[ k + 1 ] ) : DBL_MAX;
+
+    for ( int f = 0; f < folds; ++f )
+      tasks[ f + 1 ]->setEvaluation( &heldOut[ f ], &betas, &errors[ f ] );
+    tasks.removeFirst();
+    error = runTasks( tasks, threadCount );
+    tasks.prepend( 0 );
+  }
+
+  for ( int i = 0; i < tasks.size(); ++i )
+    delete tasks[ i ];
+  for ( int f = 0; f < folds; ++f )
+  {
+    delete foldTrees[ f ];
+    cvReleaseMat( &foldIdx[ f ] );
+  }
+
+  if ( !error.isEmpty() )
+  {
+    clear();
+    throw std::runtime_error( QString( "Decision tree training failed: %1" ).arg( error ).toStdString() );
+  }
+
+  std::vector<double> total( mAlphas.size(), 0.0 );
+  for ( int f = 0; f < folds; ++f )
+  {
+    for ( size_t k = 0; k < total.size(); ++k )
+      total[ k ] += errors[ f ][ k ];
+  }
+
+  int best = ( int )( std::min_element( total.begin(), total.end() ) - total.begin() );
+  if ( use1seRule && data->is_classifier )
+  {
+    // the simplest subtree within one standard error of the best one
+    double minError = total[ best ];
+    double se = sqrt( minError * ( sampleCount - minError ) / sampleCount );
+    for ( int k = ( int )total.size() - 1; k > best; --k )
+    {
+      if ( total[ k ] <= minError + se )
+      {
+        best = k;
+        break;
+      }
+    }
+  }
+  pruned_tree_idx = best;
+
+  QgsDebugMsg( QString( "PrunedDTree: %1 folds, subtree %2 of %3" ).arg( folds ).arg( best ).arg( mAlphas.size() ) );
+}
+
+void PrunedDTree::trainFold( const CvMat* trainData, const CvMat* responses, const CvMat* sampleIdx,
+                             const CvMat* varType, const CvDTreeParams& params )
+{
+  if ( !train( trainData, CV_ROW_SAMPLE, responses, 0, sampleIdx, varType, 0, params ) )
+    throw std::runtime_error( "Decision tree training failed" );
+
+  if ( params.cv_folds <= 1 )
+    buildPruningSequence();
+}
+
+void PrunedDTree::foldErrors( const CvMat* trainData, const CvMat* responses, const std::vector<int>& heldOut,
+                              const std::vector<double>& betas, std::vector<double>& errors )
+{
+  errors.assign( betas.size(), 0.0 );
+
+  CvMat sample;
+  int subtree = -1;
+  double subtreeError = 0;
+  for ( size_t k = 0; k < betas.size(); ++k )
+  {
+    // largest subtree of this fold whose complexity does not exceed beta
+    int j = ( int )( std::upper_bound( mAlphas.begin(), mAlphas.end(), betas[ k ] ) - mAlphas.begin() ) - 1;
+    j = qMax( 0, j );
+    if ( j != subtree )
+    {
+      subtree = j;
+      pruned_tree_idx = j;
+
+      subtreeError = 0;
+      for ( size_t i = 0; i < heldOut.size(); ++i )
+      {
+        cvGetRow( trainData, &sample, heldOut[ i ] );
+        double predicted = predict( &sample )->value;
+        double truth = cvGetReal1D( responses, heldOut[ i ] );
+        if ( data->is_classifier )
+          subtreeError += cvRound( predicted ) != cvRound( truth ) ? 1 : 0;
+        else
+          subtreeError += ( predicted - truth ) * ( predicted - truth );
+      }
+    }
+    errors[ k ] = subtreeError;
+  }
+  pruned_tree_idx = -1;
+}
+
+void PrunedDTree::buildPruningSequence()
+{
+  mAlphas.assign( 1, 0.0 );
+  pruned_tree_idx = -1;
+  if ( !root )
+    return;
+
+  // no node is cut in the full tree
+  std::vector<CvDTreeNode*> stack( 1, root );
+  while ( !stack.empty() )
+  {
+    CvDTreeNode* node = stack.back();
+    stack.pop_back();
+    node->Tn = INT_MAX;
+    if ( node->left )
+    {
+      stack.push_back( node->left );
+      stack.push_back( node->right );
+    }
+  }
+
+  // weakest link pruning: cut nodes with the smallest risk increase per removed leaf
+  for ( int step = 1; root->left && root->Tn == INT_MAX; ++step )
+  {
+    int leaves;
+    double risk;
+    double minAlpha = DBL_MAX;
+    subtreeStats( root, step - 1, leaves, risk, minAlpha );
+    cutWeakest( root, step, minAlpha * ( 1 + 1e-9 ) + 1e-12 );
+    mAlphas.push_back( qMax( minAlpha, mAlphas.back() ) );
+  }
+}
+
+void PrunedDTree::subtreeStats( CvDTreeNode* node, int step, int& leaves, double& risk, double& minAlpha )
+{
+  if ( !node->left || node->Tn <= step )
+  {
+    leaves = 1;
+    risk = node->node_risk;
+    return;
+  }
+
+  int leftLeaves, rightLeaves;
+  double leftRisk, rightRisk;
+  subtreeStats( node->left, step, leftLeaves, leftRisk, minAlpha );
+  subtreeStats( node->right, step, rightLeaves, rightRisk, minAlpha );
+  leaves = leftLeaves + rightLeaves;
+  risk = leftRisk + rightRisk;
+
+  // CvDTreeNode::alpha keeps the link strength for cutWeakest()
+  node->alpha = ( node->node_risk - risk ) / ( leaves - 1 );
+  minAlpha = qMin( minAlpha, node->alpha );
+}
+
+void PrunedDTree::cutWeakest( CvDTreeNode* node, int step, double alpha )
+{
+  if ( !node->left || node->Tn < step )
+    return;
+
+  if ( node->alpha <= alpha )
+  {
+    node->Tn = step;
+    return;
+  }
+  cutWeakest( node->left, step, alpha );
+  cutWeakest( node->right, step, alpha );
+}
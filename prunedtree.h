@@ -0,0 +1,71 @@
+/***************************************************************************
+  prunedtree.h
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef PRUNEDTREE_H
+#define PRUNEDTREE_H
+
+#include <vector>
+
+#include <QtGlobal>
+
+#include "opencv2/ml/ml.hpp"
+
+/**
+  Decision tree pruned by K-fold cross-validation where the full tree and
+  the fold trees are trained concurrently. Pruning is the cost-complexity
+  (weakest link) sequence, the chosen subtree is stored with CvDTree's own
+  pruned tree index, so predict(), save() and load() are the usual ones.
+  */
+class PrunedDTree : public CvDTree
+{
+  public:
+    PrunedDTree();
+    virtual ~PrunedDTree();
+
+    /** train tree and prune it with params.cv_folds folds (<= 1 - no pruning).
+      threadCount <= 0 means all cores, fewer threads are used when the
+      sample copies of concurrent trees would take more than 2 GB.
+      Throws std::runtime_error
+      */
+    void trainPruned( const CvMat* trainData, const CvMat* responses, const CvMat* varType,
+                      CvDTreeParams params, int threadCount, quint64 seed );
+
+    //! train unpruned tree on subset of samples and build its pruning sequence
+    void trainFold( const CvMat* trainData, const CvMat* responses, const CvMat* sampleIdx,
+                    const CvMat* varType, const CvDTreeParams& params );
+
+    /** sum of errors of held-out samples for subtrees fitting complexities
+      of the full tree, subtree k is used for betas[ k ]
+      */
+    void foldErrors( const CvMat* trainData, const CvMat* responses, const std::vector<int>& heldOut,
+                     const std::vector<double>& betas, std::vector<double>& errors );
+
+    //! complexity parameters of pruned subtrees, alphas[ 0 ] is the full tree
+    const std::vector<double>& alphas() const { return mAlphas; }
+
+  protected:
+    //! mark nodes with subtree index they are cut at (CvDTreeNode::Tn)
+    void buildPruningSequence();
+    void subtreeStats( CvDTreeNode* node, int step, int& leaves, double& risk, double& minAlpha );
+    void cutWeakest( CvDTreeNode* node, int step, double alpha );
+
+    std::vector<double> mAlphas;
+};
+
+#endif // PRUNEDTREE_H
@@ -0,0 +1,48 @@
+/***************************************************************************
+  quantizedmodel.cpp
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <climits>
+#include <cmath>
+
+#include "quantizedmodel.h"
+
+QuantizedTreeModel::QuantizedTreeModel( const TreeModel* model )
+    : mModel( model )
+{
+  const TreeSplit* splitArray = model->splits();
+  mSplits.resize( model->splitCount() );
+  for ( int i = 0; i < model->splitCount(); ++i )
+  {
+    const TreeSplit& split = splitArray[ i ];
+    QuantizedSplit& q = mSplits[ i ];
+    q.var = split.var;
+    q.inversed = split.inversed;
+    q.catBegin = split.catBegin;
+    q.catCount = split.catCount;
+
+    // thresholds outside of int range (or NaN) send every integer to one side
+    double t = std::floor( ( double )split.threshold );
+    if ( t >= INT_MAX )
+      q.threshold = INT_MAX;
+    else if ( t <= INT_MIN || t != t )
+      q.threshold = INT_MIN;
+    else
+      q.threshold = ( int )t;
+  }
+}
@@ -0,0 +1,120 @@
+/***************************************************************************
+  quantizedmodel.h
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef QUANTIZEDMODEL_H
+#define QUANTIZEDMODEL_H
+
+#include <cmath>
+#include <vector>
+
+#include "treemodel.h"
+
+//! split of QuantizedTreeModel, ordered split goes left when value <= threshold
+struct QuantizedSplit
+{
+  int var;
+  int inversed;
+  int catBegin;
+  int catCount;
+  int threshold;
+};
+
+/**
+  TreeModel with thresholds rewritten for integer samples. For an integer
+  value v, v <= t holds exactly when v <= floor(t), so every ordered split
+  gets an integer threshold and predictions on integer rasters match the
+  float model as long as the values are exact in float (|v| <= 2^24, so
+  uint8, uint16 and int16). Samples are read in their native type and
+  compared as integers, there is no conversion to float per pixel.
+  Nodes and categories are used from the source model, which must outlive
+  the quantized one.
+  */
+class QuantizedTreeModel
+{
+  public:
+    explicit QuantizedTreeModel( const TreeModel* model );
+
+    //! leaf node of the tree, feature v of the sample is sample[ v * stride ]
+    template<typename T>
+    inline int leaf( int tree, const T* sample, int stride = 1 ) const;
+
+    //! ensemble prediction, same voting as TreeModel::predict
+    template<typename T>
+    float predict( const T* sample, int stride = 1, int exitMargin = 0, float* confidence = NULL ) const;
+
+  private:
+    const TreeModel* mModel;
+    std::vector<QuantizedSplit> mSplits;
+};
+
+template<typename T>
+inline int QuantizedTreeModel::leaf( int tree, const T* sample, int stride ) const
+{
+  const TreeNode* nodeArray = mModel->nodes();
+  const QuantizedSplit* splitArray = mSplits.empty() ? 0 : &mSplits[ 0 ];
+  const TreeCategory* categoryArray = mModel->categories();
+
+  int idx = mModel->roots()[ tree ];
+  const TreeNode* node = &nodeArray[ idx ];
+  while ( node->left >= 0 )
+  {
+    int dir = 0;
+    const QuantizedSplit* split = &splitArray[ node->splitBegin ];
+    const QuantizedSplit* splitEnd = split + node->splitCount;
+    for ( ; split != splitEnd && dir == 0; ++split )
+    {
+      int value = ( int )sample[ split->var * stride ];
+      if ( split->catBegin < 0 )
+      {
+        dir = value <= split->threshold ? -1 : 1;
+      }
+      else
+      {
+        // binary search over sorted known categories
+        int a = split->catBegin, b = split->catBegin + split->catCount;
+        while ( a < b )
+        {
+          int c = ( a + b ) >> 1;
+          if ( categoryArray[ c ].value < value )
+            a = c + 1;
+          else
+            b = c;
+        }
+        if ( a < split->catBegin + split->catCount && categoryArray[ a ].value == value )
+          dir = categoryArray[ a ].dir;
+      }
+      if ( split->inversed )
+        dir = -dir;
+    }
+    if ( dir == 0 )
+      dir = node->defaultDir;
+
+    idx = dir < 0 ? node->left : node->right;
+    node = &nodeArray[ idx ];
+  }
+  return idx;
+}
+
+template<typename T>
+float QuantizedTreeModel::predict( const T* sample, int stride, int exitMargin, float* confidence ) const
+{
+  return mModel->voteLeaves( SampleLeaf<QuantizedTreeModel, T>( this, sample, stride ), exitMargin, confidence );
+}
+
+#endif // QUANTIZEDMODEL_H
@@ -0,0 +1,217 @@
+/***************************************************************************
+  segmentation.cpp
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "segmentation.h"
+
+SlicSegmenter::SlicSegmenter( int step, double compactness, int iterations )
+    : mStep( std::max( 1, step ) ),
+      mCompactness( compactness ),
+      mIterations( std::max( 1, iterations ) )
+{
+}
+
+int SlicSegmenter::segment( const float* data, const unsigned char* valid, int varCount, int width, int height, int stride, std::vector<int>& labels )
+{
+  int pixels = width * height;
+  labels.assign( pixels, 0 );
+  int validCount = pixels;
+  if ( valid )
+  {
+    for ( int y = 0; y < height; ++y )
+    {
+      for ( int x = 0; x < width; ++x )
+      {
+        if ( !valid[ ( size_t )y * stride + x ] )
+        {
+          labels[ y * width + x ] = -1;
+          validCount--;
+        }
+      }
+    }
+  }
+  if ( validCount == 0 )
+    return 0;
+
+  // standardize every value over the valid pixels of the tile, so bands of
+  // any range weigh the same and nodata values do not stretch the scale
+  mPlanes.resize( ( size_t )varCount * pixels );
+  for ( int v = 0; v < varCount; ++v )
+  {
+    double sum = 0, sumSq = 0;
+    for ( int y = 0; y < height; ++y )
+    {
+      const float* line = data + ( ( size_t )y * varCount + v ) * stride;
+      const int* lineLabels = &labels[ ( size_t )y * width ];
+      for ( int x = 0; x < width; ++x )
+      {
+        if ( lineLabels[ x ] < 0 )
+          continue;
+        sum += line[ x ];
+        sumSq += ( double )line[ x ] * line[ x ];
+      }
+    }
+    double mean = sum / validCount;
+    double variance = sumSq / validCount - mean * mean;
+    float scale = variance > 0 ? ( float )( 1 / sqrt( variance ) ) : 0.0f;
+
+    float* plane = &mPlanes[ ( size_t )v * pixels ];
+    for ( int y = 0; y < height; ++y )
+    {
+      const float* line = data + ( ( size_t )y * varCount + v ) * stride;
+      const int* lineLabels = &labels[ ( size_t )y * width ];
+      for ( int x = 0; x < width; ++x )
+        plane[ y * width + x ] = lineLabels[ x ] < 0 ? 0.0f : ( float )( ( line[ x ] - mean ) * scale );
+    }
+  }
+
+  // centers on the grid, every center is x, y and varCount values
+  int nx = std::max( 1, ( width + mStep / 2 ) / mStep );
+  int ny = std::max( 1, ( height + mStep / 2 ) / mStep );
+  int centerCount = nx * ny;
+  int centerSize = varCount + 2;
+  mCenters.resize( ( size_t )centerCount * centerSize );
+  for ( int j = 0; j < ny; ++j )
+  {
+    for ( int i = 0; i < nx; ++i )
+    {
+      double* center = &mCenters[ ( size_t )( j * nx + i ) * centerSize ];
+      center[ 0 ] = ( i + 0.5 ) * width / nx;
+      center[ 1 ] = ( j + 0.5 ) * height / ny;
+      // a masked grid pixel starts the center at the tile mean
+      int p = ( int )center[ 1 ] * width + ( int )center[ 0 ];
+      for ( int v = 0; v < varCount; ++v )
+        center[ 2 + v ] = mPlanes[ ( size_t )v * pixels + p ];
+    }
+  }
+
+  double spatialWeight = mCompactness * mCompactness / ( ( double )mStep * mStep );
+  double valueWeight = varCount > 0 ? 1.0 / varCount : 0;
+  int reach = 2 * mStep;
+  for ( int iteration = 0; iteration < mIterations; ++iteration )
+  {
+    // pixels out of reach of every center keep the previous label
+    mDistances.assign( pixels, std::numeric_limits<float>::max() );
+    for ( int k = 0; k < centerCount; ++k )
+    {
+      const double* center = &mCenters[ ( size_t )k * centerSize ];
+      int x0 = std::max( 0, ( int )center[ 0 ] - reach ), x1 = std::min( width - 1, ( int )center[ 0 ] + reach );
+      int y0 = std::max( 0, ( int )center[ 1 ] - reach ), y1 = std::min( height - 1, ( int )center[ 1 ] + reach );
+      for ( int y = y0; y <= y1; ++y )
+      {
+        double dy = y - center[ 1 ];
+        for ( int x = x0; x <= x1; ++x )
+        {
+          int p = y * width + x;
+          if ( labels[ p ] < 0 )
+            continue;
+          double dx = x - center[ 0 ];
+          double dv = 0;
+          for ( int v = 0; v < varCount; ++v )
+          {
+            double d = mPlanes[ ( size_t )v * pixels + p ] - center[ 2 + v ];
+            dv += d * d;
+          }
+          float distance = ( float )( dv * valueWeight + ( dx * dx + dy * dy ) * spatialWeight );
+          if ( distance < mDistances[ p ] )
+          {
+            mDistances[ p ] = distance;
+            labels[ p ] = k;
+          }
+        }
+      }
+    }
+
+    // centers move to the mean of their pixels, empty ones stay
+    mSums.assign( ( size_t )centerCount * centerSize, 0 );
+    mCounts.assign( centerCount, 0 );
+    for ( int y = 0; y < height; ++y )
+    {
+      for ( int x = 0; x < width; ++x )
+      {
+        int p = y * width + x;
+        if ( labels[ p ] < 0 )
+          continue;
+        double* sum = &mSums[ ( size_t )labels[ p ] * centerSize ];
+        sum[ 0 ] += x;
+        sum[ 1 ] += y;
+        for ( int v = 0; v < varCount; ++v )
+          sum[ 2 + v ] += mPlanes[ ( size_t )v * pixels + p ];
+        mCounts[ labels[ p ] ]++;
+      }
+    }
+    for ( int k = 0; k < centerCount; ++k )
+    {
+      if ( mCounts[ k ] == 0 )
+        continue;
+      for ( int c = 0; c < centerSize; ++c )
+        mCenters[ ( size_t )k * centerSize + c ] = mSums[ ( size_t )k * centerSize + c ] / mCounts[ k ];
+    }
+  }
+
+  // number segments that kept pixels consecutively
+  std::vector<int> segmentOf( centerCount, -1 );
+  int segmentCount = 0;
+  for ( int k = 0; k < centerCount; ++k )
+  {
+    if ( mCounts[ k ] > 0 )
+      segmentOf[ k ] = segmentCount++;
+  }
+  for ( int p = 0; p < pixels; ++p )
+  {
+    if ( labels[ p ] >= 0 )
+      labels[ p ] = segmentOf[ labels[ p ] ];
+  }
+  return segmentCount;
+}
+
+void SlicSegmenter::segmentMeans( const float* data, int varCount, int width, int height, int stride,
+                                  const std::vector<int>& labels, int segmentCount, std::vector<float>& means )
+{
+  std::vector<double> sums( ( size_t )segmentCount * varCount, 0 );
+  std::vector<int> counts( segmentCount, 0 );
+  for ( int y = 0; y < height; ++y )
+  {
+    const int* lineLabels = &labels[ ( size_t )y * width ];
+    for ( int x = 0; x < width; ++x )
+    {
+      if ( lineLabels[ x ] >= 0 )
+        counts[ lineLabels[ x ] ]++;
+    }
+    for ( int v = 0; v < varCount; ++v )
+    {
+      const float* line = data + ( ( size_t )y * varCount + v ) * stride;
+      for ( int x = 0; x < width; ++x )
+      {
+        if ( lineLabels[ x ] >= 0 )
+          sums[ ( size_t )lineLabels[ x ] * varCount + v ] += line[ x ];
+      }
+    }
+  }
+
+  means.resize( sums.size() );
+  for ( int s = 0; s < segmentCount; ++s )
+  {
+    for ( int v = 0; v < varCount; ++v )
+      means[ ( size_t )s * varCount + v ] = counts[ s ] > 0 ? ( float )( sums[ ( size_t )s * varCount + v ] / counts[ s ] ) : 0.0f;
+  }
+}
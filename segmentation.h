@@ -0,0 +1,65 @@
+/***************************************************************************
+  segmentation.h
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef SEGMENTATION_H
+#define SEGMENTATION_H
+
+#include <vector>
+
+/**
+  SLIC superpixels of a tile. Centers start on a grid of step pixels and
+  pixels are assigned to the nearest center within 2 * step, distance
+  combines values standardized over the tile with spatial distance:
+  D^2 = dv^2 / varCount + compactness^2 * ds^2 / step^2, so compactness 1
+  weighs one standard deviation as much as one grid step.
+
+  Tiles are laid out as Classify reads rows: every line holds varCount
+  band-sequential runs of width pixels, value v of pixel (x, y) is
+  data[ ( y * varCount + v ) * stride + x ]. Pixels with valid[ y * stride + x ]
+  of 0 (masked or nodata) are left out of the statistics, centers and means
+  and get label -1.
+  */
+class SlicSegmenter
+{
+  public:
+    SlicSegmenter( int step, double compactness, int iterations = 4 );
+
+    /** label every valid pixel of the tile with segment 0 .. count - 1 (labels[ y * width + x ]),
+      returns segment count. valid may be NULL when all pixels are valid
+      */
+    int segment( const float* data, const unsigned char* valid, int varCount, int width, int height, int stride, std::vector<int>& labels );
+
+    //! mean values of every segment, value v of segment s goes to means[ s * varCount + v ]
+    static void segmentMeans( const float* data, int varCount, int width, int height, int stride,
+                              const std::vector<int>& labels, int segmentCount, std::vector<float>& means );
+
+  private:
+    int mStep;
+    double mCompactness;
+    int mIterations;
+
+    //! standardized tile, plane v holds value v of every pixel
+    std::vector<float> mPlanes;
+    std::vector<float> mDistances;
+    std::vector<double> mCenters;
+    std::vector<double> mSums;
+    std::vector<int> mCounts;
+};
+
+#endif // SEGMENTATION_H
@@ -0,0 +1,535 @@
+/***************************************************************************
+  streamtrainer.cpp
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include <QList>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+
+#include "opencv2/core/core.hpp"
+
+#include "qgslogger.h"
+
+#include "foresttrainer.h"
+#include "histogramtrainer.h"
+#include "treemodel.h"
+#include "streamtrainer.h"
+
+namespace
+{
+  //! node waiting for its histogram
+  struct OpenNode
+  {
+    int tree;
+    int node;
+    int depth;
+    bool terminal;
+  };
+
+  //! chunk of samples and histograms of the open nodes of the current pass
+  struct PassState
+  {
+    int varCount;
+    int stats;
+    bool classifier;
+    bool bootstrap;
+    const std::vector<int>* varOffset;
+    const std::vector<quint64>* treeSeeds;
+
+    std::vector<TreeModel>* trees;
+    //! slot of open node per tree and node, -1 when node is not in the pass
+    std::vector< std::vector<int> > slotOf;
+    std::vector<size_t> slotOffset;
+    std::vector<uchar> slotTerminal;
+    std::vector<double> hist;
+
+    qint64 firstSample;
+    int rows;
+    const float* values;
+    const float* responses;
+    const int* labelIdx;
+    const uchar* bins;
+  };
+
+  class AccumulateTask : public QRunnable
+  {
+    public:
+      AccumulateTask( PassState& state, int firstTree, int lastTree )
+          : mState( state ),
+            mFirstTree( firstTree ),
+            mLastTree( lastTree )
+      {
+        setAutoDelete( false );
+      }
+
+      //! trees of the task own their slots, so tasks never write the same cell
+      void run()
+      {
+        const PassState& s = mState;
+        const std::vector<int>& varOffset = *s.varOffset;
+        for ( int t = mFirstTree; t < mLastTree; ++t )
+        {
+          const TreeModel& tree = ( *s.trees )[ t ];
+          const std::vector<int>& slotOf = s.slotOf[ t ];
+          quint64 treeSeed = ( *s.treeSeeds )[ t ];
+          for ( int i = 0; i < s.rows; ++i )
+          {
+            int weight = s.bootstrap ? StreamTreeTrainer::bagWeight( treeSeed, s.firstSample + i ) : 1;
+            if ( weight == 0 )
+              continue;
+
+            int slot = slotOf[ tree.leaf( 0, s.values + ( size_t )i * s.varCount ) ];
+            if ( slot < 0 )
+              continue;
+
+            double* base = &mState.hist[ s.slotOffset[ slot ] ];
+            int label = s.labelIdx[ i ];
+            double response = s.responses[ i ];
+            if ( s.slotTerminal[ slot ] )
+            {
+              // only totals and label weights are needed for a leaf value
+              addStats( base, weight, label, response );
+              base[ s.stats + label ] += weight;
+              continue;
+            }
+
+            const uchar* bins = s.bins + ( size_t )i * s.varCount;
+            for ( int v = 0; v < s.varCount; ++v )
+              addStats( base + varOffset[ v ] + bins[ v ] * s.stats, weight, label, response );
+            base[ varOffset[ s.varCount ] + label ] += weight;
+          }
+        }
+      }
+
+    private:
+      inline void addStats( double* cell, int weight, int label, double response ) const
+      {
+        if ( mState.classifier )
+        {
+          cell[ label ] += weight;
+        }
+        else
+        {
+          cell[ 0 ] += weight;
+          cell[ 1 ] += weight * response;
+        }
+      }
+
+      PassState& mState;
+      int mFirstTree;
+      int mLastTree;
+  };
+
+  class BinTask : public QRunnable
+  {
+    public:
+      BinTask( const std::vector< std::vector<float> >& edges, const std::vector<float>& labels,
+               const float* values, const float* responses, uchar* bins, int* labelIdx, int begin, int end )
+          : mEdges( edges ),
+            mLabels( labels ),
+            mValues( values ),
+            mResponses( responses ),
+            mBins( bins ),
+            mLabelIdx( labelIdx ),
+            mBegin( begin ),
+            mEnd( end )
+      {
+        setAutoDelete( false );
+      }
+
+      void run()
+      {
+        int varCount = ( int )mEdges.size();
+        for ( int i = mBegin; i < mEnd; ++i )
+        {
+          for ( int v = 0; v < varCount; ++v )
+          {
+            const std::vector<float>& edges = mEdges[ v ];
+            float value = mValues[ ( size_t )i * varCount + v ];
+            mBins[ ( size_t )i * varCount + v ] = ( uchar )( std::lower_bound( edges.begin(), edges.end(), value ) - edges.begin() );
+          }
+          mLabelIdx[ i ] = ( int )( std::lower_bound( mLabels.begin(), mLabels.end(), mResponses[ i ] ) - mLabels.begin() );
+        }
+      }
+
+    private:
+      const std::vector< std::vector<float> >& mEdges;
+      const std::vector<float>& mLabels;
+      const float* mValues;
+      const float* mResponses;
+      uchar* mBins;
+      int* mLabelIdx;
+      int mBegin;
+      int mEnd;
+  };
+
+  void runAll( QThreadPool& pool, QList<QRunnable*>& tasks )
+  {
+    for ( int i = 0; i < tasks.size(); ++i )
+      pool.start( tasks[ i ] );
+    pool.waitForDone();
+    for ( int i = 0; i < tasks.size(); ++i )
+      delete tasks[ i ];
+    tasks.clear();
+  }
+}
+
+StreamTreeTrainer::StreamTreeTrainer( const QString& fileName, qint64 memoryBudget, int maxBins )
+    : mReader( fileName ),
+      mMemoryBudget( memoryBudget ),
+      mMaxBins( maxBins )
+{
+  if ( mReader.sampleCount() == 0 )
+    throw std::runtime_error( "Histogram trees: empty train data" );
+  if ( maxBins < 2 || maxBins > 256 )
+    throw std::runtime_error( "Histogram trees: number of bins must be in [2, 256]" );
+
+  scan();
+}
+
+StreamTreeTrainer::~StreamTreeTrainer()
+{
+}
+
+int StreamTreeTrainer::bagWeight( quint64 treeSeed, qint64 sample )
+{
+  // inverse CDF of Poisson(1) on a hash of the sample index
+  static const double cdf[] = { 0.36787944, 0.73575888, 0.91969860, 0.98101184, 0.99634015, 0.99940582, 0.99991676 };
+  quint64 hash = ParallelRTrees::treeSeed( treeSeed ^ ( ( quint64 )sample * Q_UINT64_C( 0xD1B54A32D192ED03 ) ), 0 );
+  double u = ( hash >> 11 ) * ( 1.0 / 9007199254740992.0 );
+  int k = 0;
+  while ( k < 7 && u >= cdf[ k ] )
+    k++;
+  return k;
+}
+
+int StreamTreeTrainer::chunkRows() const
+{
+  // values, response, bins, label index and the reader's record buffer
+  qint64 rowBytes = ( qint64 )varCount() * ( 2 * sizeof( float ) + 1 ) + 3 * sizeof( float ) + sizeof( int );
+  qint64 rows = mMemoryBudget / 4 / rowBytes;
+  return ( int )qBound( ( qint64 )1024, rows, ( qint64 )( 1 << 24 ) );
+}
+
+void StreamTreeTrainer::scan()
+{
+  int varCount = mReader.varCount();
+  qint64 sampleCount = mReader.sampleCount();
+
+  // bin edges come from a uniform reservoir sample that fits in the budget
+  qint64 reservoirRows = mMemoryBudget / 4 / ( ( varCount + 1 ) * ( qint64 )sizeof( float ) * 3 );
+  int reservoirSize = ( int )qMin( sampleCount, qBound( ( qint64 )4096, reservoirRows, ( qint64 )( 1 << 22 ) ) );
+  CvMat* reservoir = cvCreateMat( reservoirSize, varCount, CV_32FC1 );
+  CvMat* reservoirResponses = cvCreateMat( reservoirSize, 1, CV_32FC1 );
+
+  int rows = chunkRows();
+  std::vector<float> values( ( size_t )rows * varCount );
+  std::vector<float> responses( rows );
+  cv::RNG rng( 1 );
+  qint64 sample = 0;
+
+  mLabels.clear();
+  mReader.rewind();
+  int n;
+  while ( ( n = mReader.read( &values[ 0 ], &responses[ 0 ], rows ) ) > 0 )
+  {
+    for ( int i = 0; i < n; ++i, ++sample )
+    {
+      std::vector<float>::iterator it = std::lower_bound( mLabels.begin(), mLabels.end(), responses[ i ] );
+      if ( it == mLabels.end() || *it != responses[ i ] )
+        mLabels.insert( it, responses[ i ] );
+
+      qint64 slot = sample < reservoirSize ? sample : ( qint64 )( ( ( quint64 )( unsigned )rng << 32 | ( unsigned )rng ) % ( sample + 1 ) );
+      if ( slot < reservoirSize )
+      {
+        memcpy( reservoir->data.fl + slot * varCount, &values[ ( size_t )i * varCount ], sizeof( float ) * varCount );
+        reservoirResponses->data.fl[ slot ] = responses[ i ];
+      }
+    }
+  }
+
+  try
+  {
+    HistogramTreeTrainer quantizer( reservoir, reservoirResponses, mMaxBins );
+    mEdges = quantizer.edges();
+  }
+  catch ( ... )
+  {
+    cvReleaseMat( &reservoir );
+    cvReleaseMat( &reservoirResponses );
+    throw;
+  }
+  cvReleaseMat( &reservoir );
+  cvReleaseMat( &reservoirResponses );
+
+  QgsDebugMsg( QString( "Stream trees: %1 samples, %2 labels, edges from %3 samples" ).arg( sampleCount ).arg( mLabels.size() ).arg( reservoirSize ) );
+}
+
+TreeModel* StreamTreeTrainer::train( const HistogramTreeParams& params, int threadCount, quint64 seed )
+{
+  if ( params.treeCount <= 0 )
+    throw std::runtime_error( "Histogram trees: number of trees must be positive" );
+
+  if ( threadCount <= 0 )
+    threadCount = QThread::idealThreadCount();
+
+  int varCount = mReader.varCount();
+  int labelCount = ( int )mLabels.size();
+  int stats = params.classifier ? labelCount : 2;
+  int activeVars = params.activeVars;
+  if ( activeVars <= 0 || activeVars > varCount )
+    activeVars = varCount;
+
+  std::vector<int> varOffset( varCount + 1, 0 );
+  for ( int v = 0; v < varCount; ++v )
+    varOffset[ v + 1 ] = varOffset[ v ] + ( int )( mEdges[ v ].size() + 1 ) * stats;
+  // label weights follow band histograms of an open node
+  size_t nodeSize = varOffset[ varCount ] + labelCount;
+  size_t leafSize = stats + labelCount;
+  size_t histBudget = ( size_t )qMax( ( qint64 )1, mMemoryBudget / 2 / ( qint64 )sizeof( double ) );
+
+  std::vector<TreeModel> trees( params.treeCount );
+  std::vector<quint64> treeSeeds( params.treeCount );
+  std::vector<cv::RNG> rngs( params.treeCount );
+  std::vector< std::vector<int> > vars( params.treeCount, std::vector<int>( varCount ) );
+  std::vector<OpenNode> open;
+  for ( int t = 0; t < params.treeCount; ++t )
+  {
+    treeSeeds[ t ] = ParallelRTrees::treeSeed( seed, t );
+    rngs[ t ] = cv::RNG( treeSeeds[ t ] );
+    for ( int v = 0; v < varCount; ++v )
+      vars[ t ][ v ] = v;
+
+    TreeNode root;
+    root.left = root.right = -1;
+    root.splitBegin = root.splitCount = 0;
+    root.defaultDir = -1;
+    root.classIdx = -1;
+    root.value = 0;
+    root.purity = 1;
+    trees[ t ].mRoots.assign( 1, 0 );
+    trees[ t ].mNodes.push_back( root );
+
+    OpenNode node = { t, 0, 0, params.maxDepth <= 0 };
+    open.push_back( node );
+  }
+
+  int rows = chunkRows();
+  std::vector<float> values( ( size_t )rows * varCount );
+  std::vector<float> responses( rows );
+  std::vector<uchar> bins( ( size_t )rows * varCount );
+  std::vector<int> labelIdx( rows );
+
+  PassState state;
+  state.varCount = varCount;
+  state.stats = stats;
+  state.classifier = params.classifier;
+  state.bootstrap = params.bootstrap;
+  state.varOffset = &varOffset;
+  state.treeSeeds = &treeSeeds;
+  state.trees = &trees;
+  state.values = &values[ 0 ];
+  state.responses = &responses[ 0 ];
+  state.labelIdx = &labelIdx[ 0 ];
+  state.bins = &bins[ 0 ];
+
+  QThreadPool pool;
+  pool.setMaxThreadCount( threadCount );
+  int passes = 0;
+
+  while ( !open.empty() )
+  {
+    std::vector<OpenNode> next;
+    size_t pos = 0;
+    while ( pos < open.size() )
+    {
+      // as many open nodes as their histograms fit into the budget
+      size_t end = pos, total = 0;
+      while ( end < open.size() )
+      {
+        size_t size = open[ end ].terminal ? leafSize : nodeSize;
+        if ( end > pos && total + size > histBudget )
+          break;
+        total += size;
+        end++;
+      }
+
+      state.slotOf.resize( params.treeCount );
+      for ( int t = 0; t < params.treeCount; ++t )
+        state.slotOf[ t ].assign( trees[ t ].mNodes.size(), -1 );
+      state.slotOffset.clear();
+      state.slotTerminal.clear();
+      size_t offset = 0;
+      for ( size_t k = pos; k < end; ++k )
+      {
+        state.slotOf[ open[ k ].tree ][ open[ k ].node ] = ( int )( k - pos );
+        state.slotOffset.push_back( offset );
+        state.slotTerminal.push_back( open[ k ].terminal );
+        offset += open[ k ].terminal ? leafSize : nodeSize;
+      }
+      state.hist.assign( offset, 0.0 );
+
+      mReader.rewind();
+      state.firstSample = 0;
+      while ( ( state.rows = mReader.read( &values[ 0 ], &responses[ 0 ], rows ) ) > 0 )
+      {
+        QList<QRunnable*> tasks;
+        int binTasks = qMax( 1, qMin( threadCount, state.rows / 1024 ) );
+        for ( int k = 0; k < binTasks; ++k )
+          tasks << new BinTask( mEdges, mLabels, &values[ 0 ], &responses[ 0 ], &bins[ 0 ], &labelIdx[ 0 ],
+                                ( int )( ( qint64 )k * state.rows / binTasks ), ( int )( ( qint64 )( k + 1 ) * state.rows / binTasks ) );
+        runAll( pool, tasks );
+
+        int treeTasks = qMin( threadCount, params.treeCount );
+        for ( int k = 0; k < treeTasks; ++k )
+          tasks << new AccumulateTask( state, k * params.treeCount / treeTasks, ( k + 1 ) * params.treeCount / treeTasks );
+        runAll( pool, tasks );
+
+        state.firstSample += state.rows;
+      }
+      passes++;
+
+      // turn histograms into leaves or splits, children are open on the next level
+      for ( size_t k = pos; k < end; ++k )
+      {
+        const OpenNode& current = open[ k ];
+        TreeModel& tree = trees[ current.tree ];
+        const double* base = &state.hist[ state.slotOffset[ k - pos ] ];
+        const double* labelWeights = base + ( current.terminal ? stats : varOffset[ varCount ] );
+
+        std::vector<double> sum( stats, 0.0 );
+        if ( current.terminal )
+        {
+          std::copy( base, base + stats, sum.begin() );
+        }
+        else
+        {
+          // node totals are the sum of any band histogram
+          for ( int b = 0; b < ( int )mEdges[ 0 ].size() + 1; ++b )
+          {
+            for ( int c = 0; c < stats; ++c )
+              sum[ c ] += base[ b * stats + c ];
+          }
+        }
+
+        double weight = 0;
+        int majority = 0;
+        for ( int c = 0; c < labelCount; ++c )
+        {
+          weight += labelWeights[ c ];
+          if ( labelWeights[ c ] > labelWeights[ majority ] )
+            majority = c;
+        }
+
+        TreeNode& node = tree.mNodes[ current.node ];
+        node.purity = weight > 0 ? ( float )( labelWeights[ majority ] / weight ) : 1.0f;
+        if ( params.classifier )
+        {
+          node.classIdx = majority;
+          node.value = mLabels[ majority ];
+        }
+        else
+        {
+          node.classIdx = -1;
+          node.value = sum[ 0 ] > 0 ? ( float )( sum[ 1 ] / sum[ 0 ] ) : 0.0f;
+        }
+
+        if ( current.terminal || weight <= params.minSampleCount || node.purity >= 1.0f )
+          continue;
+
+        // random subset of bands for forests
+        std::vector<int>& treeVars = vars[ current.tree ];
+        if ( activeVars < varCount )
+        {
+          for ( int j = 0; j < activeVars; ++j )
+            std::swap( treeVars[ j ], treeVars[ j + ( unsigned )rngs[ current.tree ] % ( varCount - j ) ] );
+        }
+
+        int bestBin = -1;
+        int bestVar = HistogramTreeTrainer::bestSplit( base, varOffset, treeVars, activeVars, stats,
+                                                       params.classifier, &sum[ 0 ], bestBin );
+        if ( bestVar < 0 )
+          continue;
+
+        double leftWeight = 0;
+        for ( int b = 0; b <= bestBin; ++b )
+        {
+          const double* cell = base + varOffset[ bestVar ] + b * stats;
+          if ( params.classifier )
+          {
+            for ( int c = 0; c < stats; ++c )
+              leftWeight += cell[ c ];
+          }
+          else
+          {
+            leftWeight += cell[ 0 ];
+          }
+        }
+
+        TreeSplit split;
+        split.var = bestVar;
+        split.inversed = 0;
+        split.catBegin = -1;
+        split.catCount = 0;
+        split.threshold = mEdges[ bestVar ][ bestBin ];
+
+        int leftIdx = ( int )tree.mNodes.size();
+        TreeNode child = tree.mNodes[ current.node ];
+        child.left = child.right = -1;
+        child.splitBegin = child.splitCount = 0;
+        tree.mNodes.push_back( child );
+        tree.mNodes.push_back( child );
+
+        // node reference may be invalidated by push_back
+        TreeNode& parent = tree.mNodes[ current.node ];
+        parent.left = leftIdx;
+        parent.right = leftIdx + 1;
+        parent.splitBegin = ( int )tree.mSplits.size();
+        parent.splitCount = 1;
+        parent.defaultDir = leftWeight >= weight - leftWeight ? -1 : 1;
+        tree.mSplits.push_back( split );
+
+        bool terminal = current.depth + 1 >= params.maxDepth;
+        OpenNode left = { current.tree, leftIdx, current.depth + 1, terminal };
+        OpenNode right = { current.tree, leftIdx + 1, current.depth + 1, terminal };
+        next.push_back( left );
+        next.push_back( right );
+      }
+      pos = end;
+    }
+    open.swap( next );
+  }
+
+  TreeModel* model = new TreeModel();
+  model->mClassifier = params.classifier;
+  model->mVarCount = varCount;
+  if ( params.classifier )
+    model->mClassLabels = mLabels;
+  for ( int t = 0; t < params.treeCount; ++t )
+    model->appendTrees( trees[ t ] );
+
+  QgsDebugMsg( QString( "Stream trees: %1 trees, %2 nodes, %3 passes over %4 samples" )
+               .arg( model->treeCount() ).arg( model->mNodes.size() ).arg( passes ).arg( sampleCount() ) );
+  return model;
+}
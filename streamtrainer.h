@@ -0,0 +1,73 @@
+/***************************************************************************
+  streamtrainer.h
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef STREAMTRAINER_H
+#define STREAMTRAINER_H
+
+#include <vector>
+
+#include <QString>
+#include <QtGlobal>
+
+#include "trainset.h"
+
+struct HistogramTreeParams;
+class TreeModel;
+
+/**
+  Out-of-core variant of HistogramTreeTrainer. Samples stay in a training-set
+  file and are read in chunks: trees grow level by level, every level is one
+  or more passes over the file accumulating bin histograms of the open nodes.
+  Chunk buffers get a quarter of the memory budget, histograms a half, so
+  peak memory does not depend on the number of samples. Forest bagging uses
+  Poisson(1) sample weights derived from the tree seed and sample index.
+  Labels are collected from every sample, so the model has the class labels
+  of HistogramTreeTrainer; a single tree is the same when the reservoir of
+  bin edges holds all samples.
+  */
+class StreamTreeTrainer
+{
+  public:
+    //! scans the training set once for bin edges and labels, memoryBudget is in bytes
+    StreamTreeTrainer( const QString& fileName, qint64 memoryBudget, int maxBins = 256 );
+    ~StreamTreeTrainer();
+
+    //! trees are accumulated on threadCount threads (<= 0 - all cores). Throws std::runtime_error
+    TreeModel* train( const HistogramTreeParams& params, int threadCount, quint64 seed );
+
+    qint64 sampleCount() const { return mReader.sampleCount(); }
+    int varCount() const { return mReader.varCount(); }
+
+    //! bootstrap multiplicity of the sample in the tree
+    static int bagWeight( quint64 treeSeed, qint64 sample );
+
+  private:
+    void scan();
+    int chunkRows() const;
+
+    TrainSetReader mReader;
+    qint64 mMemoryBudget;
+    int mMaxBins;
+
+    //! upper edges of bins, as in HistogramTreeTrainer
+    std::vector< std::vector<float> > mEdges;
+    std::vector<float> mLabels;
+};
+
+#endif // STREAMTRAINER_H
@@ -0,0 +1,231 @@
+/***************************************************************************
+  texturefeatures.cpp
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <QRegExp>
+
+#include "gdal_priv.h"
+
+#include "featureexpr.h"
+#include "texturefeatures.h"
+
+namespace
+{
+  const char* TexturePattern = "^\\s*(mean|var|range)\\s*\\((.*),\\s*(\\d+)\\s*\\)\\s*$";
+
+  /** extreme of every window [x - radius, x + radius] clipped to [0, n),
+    monotonic queue keeps candidate indices, so each value enters and
+    leaves it once
+    */
+  void slidingExtreme( const float* in, int n, int radius, bool maximum, std::vector<int>& queue, float* out )
+  {
+    queue.resize( n );
+    int head = 0, tail = 0, next = 0;
+    for ( int x = 0; x < n; ++x )
+    {
+      int hi = std::min( n - 1, x + radius );
+      for ( ; next <= hi; ++next )
+      {
+        float v = in[ next ];
+        while ( tail > head && ( maximum ? in[ queue[ tail - 1 ] ] <= v : in[ queue[ tail - 1 ] ] >= v ) )
+          tail--;
+        queue[ tail++ ] = next;
+      }
+      while ( queue[ head ] < x - radius )
+        head++;
+      out[ x ] = in[ queue[ head ] ];
+    }
+  }
+}
+
+bool TextureKernel::isTexture( const QString& text )
+{
+  return QRegExp( TexturePattern, Qt::CaseInsensitive ).exactMatch( text );
+}
+
+TextureKernel::TextureKernel( const QString& text, const QVector<int>& rasterBands )
+    : mStat( TextureMean ),
+      mBand( -1 ),
+      mRadius( 0 )
+{
+  QRegExp re( TexturePattern, Qt::CaseInsensitive );
+  if ( !re.exactMatch( text ) )
+    throw std::runtime_error( QString( "Feature \"%1\" is not a texture" ).arg( text ).toStdString() );
+
+  QString stat = re.cap( 1 ).toLower();
+  if ( stat == "var" )
+    mStat = TextureVariance;
+  else if ( stat == "range" )
+    mStat = TextureRange;
+
+  mBand = BandExpression( re.cap( 2 ), rasterBands ).singleBand();
+  if ( mBand < 0 )
+    throw std::runtime_error( QString( "Feature \"%1\": texture needs a single band like b1 or t2.b1" ).arg( text ).toStdString() );
+
+  int size = re.cap( 3 ).toInt();
+  if ( size < 3 || size % 2 == 0 )
+    throw std::runtime_error( QString( "Feature \"%1\": window size must be odd and at least 3" ).arg( text ).toStdString() );
+  mRadius = size / 2;
+}
+
+float TextureKernel::pixel( GDALDataset* raster, int col, int row ) const
+{
+  int x0 = std::max( 0, col - mRadius ), x1 = std::min( raster->GetRasterXSize() - 1, col + mRadius );
+  int y0 = std::max( 0, row - mRadius ), y1 = std::min( raster->GetRasterYSize() - 1, row + mRadius );
+  if ( x0 > x1 || y0 > y1 )
+    return 0;
+
+  int width = x1 - x0 + 1, height = y1 - y0 + 1;
+  std::vector<float> window( ( size_t )width * height );
+  if ( raster->GetRasterBand( mBand + 1 )->RasterIO( GF_Read, x0, y0, width, height, ( void* )&window[ 0 ], width, height, GDT_Float32, 0, 0 ) != CE_None )
+    throw std::runtime_error( "Can't read texture window" );
+
+  if ( mStat == TextureRange )
+  {
+    float lo = window[ 0 ], hi = window[ 0 ];
+    for ( size_t i = 1; i < window.size(); ++i )
+    {
+      lo = std::min( lo, window[ i ] );
+      hi = std::max( hi, window[ i ] );
+    }
+    return hi - lo;
+  }
+
+  double sum = 0, sumSq = 0;
+  for ( size_t i = 0; i < window.size(); ++i )
+  {
+    sum += window[ i ];
+    sumSq += ( double )window[ i ] * window[ i ];
+  }
+  double mean = sum / window.size();
+  if ( mStat == TextureMean )
+    return ( float )mean;
+  return ( float )std::max( 0.0, sumSq / window.size() - mean * mean );
+}
+
+TextureWindow::TextureWindow( GDALDataset* raster, int band, int radius, int xOff, int xSize )
+    : mRaster( raster ),
+      mBand( band ),
+      mRadius( radius ),
+      mXOff( std::max( 0, xOff - radius ) ),
+      mYSize( raster->GetRasterYSize() ),
+      mFirst( 0 ),
+      mLast( -1 )
+{
+  if ( xSize < 0 )
+    xSize = raster->GetRasterXSize() - xOff;
+  mXSize = std::min( raster->GetRasterXSize(), xOff + xSize + radius ) - mXOff;
+  mOutOff = xOff - mXOff;
+  mOutSize = xSize;
+
+  mRows.resize( ( size_t )( 2 * radius + 1 ) * mXSize );
+  mColSum.assign( mXSize, 0 );
+  mColSumSq.assign( mXSize, 0 );
+  mPrefix.resize( mXSize + 1 );
+  mPrefixSq.resize( mXSize + 1 );
+  mColMin.resize( mXSize );
+  mColMax.resize( mXSize );
+  mLows.resize( mXSize );
+  mHighs.resize( mXSize );
+}
+
+void TextureWindow::moveTo( int row )
+{
+  int first = std::max( 0, row - mRadius );
+  int last = std::min( mYSize - 1, row + mRadius );
+
+  // jumps and moves up start over, sliding down reuses the sums
+  if ( mLast < mFirst || first < mFirst || first > mLast )
+  {
+    mColSum.assign( mXSize, 0 );
+    mColSumSq.assign( mXSize, 0 );
+    mFirst = first;
+    mLast = first - 1;
+  }
+  for ( ; mFirst < first; ++mFirst )
+    addRow( mFirst, -1 );
+  while ( mLast < last )
+  {
+    ++mLast;
+    if ( mRaster->GetRasterBand( mBand + 1 )->RasterIO( GF_Read, mXOff, mLast, mXSize, 1, ( void* )ringRow( mLast ), mXSize, 1, GDT_Float32, 0, 0 ) != CE_None )
+      throw std::runtime_error( QString( "Can't read row %1 of band %2" ).arg( mLast ).arg( mBand + 1 ).toStdString() );
+    addRow( mLast, 1 );
+  }
+}
+
+void TextureWindow::addRow( int row, double sign )
+{
+  const float* data = ringRow( row );
+  double* sum = &mColSum[ 0 ];
+  double* sumSq = &mColSumSq[ 0 ];
+  for ( int x = 0; x < mXSize; ++x )
+  {
+    double v = data[ x ];
+    sum[ x ] += sign * v;
+    sumSq[ x ] += sign * v * v;
+  }
+}
+
+void TextureWindow::compute( TextureStat stat, float* out )
+{
+  int rows = mLast - mFirst + 1;
+  if ( stat == TextureRange )
+  {
+    // extremes of the columns over window rows, then along the row
+    const float* data = ringRow( mFirst );
+    std::copy( data, data + mXSize, mColMin.begin() );
+    std::copy( data, data + mXSize, mColMax.begin() );
+    for ( int r = mFirst + 1; r <= mLast; ++r )
+    {
+      data = ringRow( r );
+      for ( int x = 0; x < mXSize; ++x )
+      {
+        mColMin[ x ] = std::min( mColMin[ x ], data[ x ] );
+        mColMax[ x ] = std::max( mColMax[ x ], data[ x ] );
+      }
+    }
+    slidingExtreme( &mColMax[ 0 ], mXSize, mRadius, true, mQueue, &mHighs[ 0 ] );
+    slidingExtreme( &mColMin[ 0 ], mXSize, mRadius, false, mQueue, &mLows[ 0 ] );
+    for ( int i = 0; i < mOutSize; ++i )
+      out[ i ] = mHighs[ mOutOff + i ] - mLows[ mOutOff + i ];
+    return;
+  }
+
+  mPrefix[ 0 ] = 0;
+  mPrefixSq[ 0 ] = 0;
+  for ( int x = 0; x < mXSize; ++x )
+  {
+    mPrefix[ x + 1 ] = mPrefix[ x ] + mColSum[ x ];
+    mPrefixSq[ x + 1 ] = mPrefixSq[ x ] + mColSumSq[ x ];
+  }
+  for ( int i = 0; i < mOutSize; ++i )
+  {
+    int x = mOutOff + i;
+    int lo = std::max( 0, x - mRadius );
+    int hi = std::min( mXSize - 1, x + mRadius );
+    double n = ( double )( hi - lo + 1 ) * rows;
+    double mean = ( mPrefix[ hi + 1 ] - mPrefix[ lo ] ) / n;
+    if ( stat == TextureMean )
+      out[ i ] = ( float )mean;
+    else
+      out[ i ] = ( float )std::max( 0.0, ( mPrefixSq[ hi + 1 ] - mPrefixSq[ lo ] ) / n - mean * mean );
+  }
+}
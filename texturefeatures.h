@@ -0,0 +1,124 @@
+/***************************************************************************
+  texturefeatures.h
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef TEXTUREFEATURES_H
+#define TEXTUREFEATURES_H
+
+#include <vector>
+
+#include <QString>
+#include <QVector>
+
+class GDALDataset;
+
+enum TextureStat
+{
+  TextureMean,
+  TextureVariance,
+  TextureRange
+};
+
+/**
+  Neighborhood statistic of one band in a size x size window centered on
+  the pixel, written as "mean(b1, 5)", "var(t2.b3, 7)" or "range(b4, 3)".
+  Windows are clipped at the raster edges, statistics are taken over the
+  pixels inside.
+  */
+class TextureKernel
+{
+  public:
+    //! true when text looks like a texture feature rather than band math
+    static bool isTexture( const QString& text );
+
+    //! rasterBands as in BandExpression. Throws std::runtime_error on bad text
+    TextureKernel( const QString& text, const QVector<int>& rasterBands );
+
+    TextureStat stat() const { return mStat; }
+    //! stacked band, 0-based
+    int band() const { return mBand; }
+    int radius() const { return mRadius; }
+
+    /** statistic of a single pixel read directly from the raster, used for
+      sparse training points. Throws std::runtime_error on read error
+      */
+    float pixel( GDALDataset* raster, int col, int row ) const;
+
+  private:
+    TextureStat mStat;
+    int mBand;
+    int mRadius;
+};
+
+/**
+  Window of 2 * radius + 1 rows of one band sliding down the raster. Rows
+  are kept in a ring buffer, per-column sums and sums of squares are
+  updated by adding the entering row and subtracting the leaving one, and
+  prefix sums along the row give the window sum of every pixel, so mean and
+  variance cost O(1) per pixel whatever the window size. Range uses column
+  extremes and a monotonic queue along the row.
+
+  A window restricted to columns xOff .. xOff + xSize - 1 reads radius more
+  columns on both sides (inside the raster), so values match the ones of
+  the whole raster.
+  */
+class TextureWindow
+{
+  public:
+    //! xSize -1 - up to the raster edge
+    TextureWindow( GDALDataset* raster, int band, int radius, int xOff = 0, int xSize = -1 );
+
+    int band() const { return mBand; }
+    int radius() const { return mRadius; }
+
+    //! center the window on row, moving down by one row reads one row. Throws std::runtime_error
+    void moveTo( int row );
+    //! statistic of every pixel of the current row within the columns, out[ 0 ] is column xOff
+    void compute( TextureStat stat, float* out );
+
+  private:
+    void addRow( int row, double sign );
+    float* ringRow( int row ) { return &mRows[ ( size_t )( row % ( 2 * mRadius + 1 ) ) * mXSize ]; }
+
+    GDALDataset* mRaster;
+    int mBand;
+    int mRadius;
+    //! read columns
+    int mXOff;
+    int mXSize;
+    int mYSize;
+    //! computed columns, relative to mXOff
+    int mOutOff;
+    int mOutSize;
+    //! rows [mFirst, mLast] are in the sums
+    int mFirst;
+    int mLast;
+
+    std::vector<float> mRows;
+    std::vector<double> mColSum;
+    std::vector<double> mColSumSq;
+    std::vector<double> mPrefix;
+    std::vector<double> mPrefixSq;
+    std::vector<float> mColMin;
+    std::vector<float> mColMax;
+    std::vector<float> mLows;
+    std::vector<float> mHighs;
+    std::vector<int> mQueue;
+};
+
+#endif // TEXTUREFEATURES_H
@@ -0,0 +1,200 @@
+/***************************************************************************
+  timeseries.cpp
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <QRegExp>
+
+#include "gdal_priv.h"
+
+#include "timeseries.h"
+
+namespace
+{
+  const char* AggregatePattern = "^\\s*(min|max|mean|slope|p(\\d+))\\s*\\(\\s*ts\\.b(\\d+)\\s*\\)\\s*$";
+}
+
+TimeSeriesStack::TimeSeriesStack( const QStringList& scenes, int xSize, int ySize )
+    : mXSize( xSize ),
+      mBandCount( 0 )
+{
+  for ( int i = 0; i < scenes.size(); ++i )
+  {
+    GDALDataset* scene = ( GDALDataset* ) GDALOpen( scenes.at( i ).toUtf8(), GA_ReadOnly );
+    if ( scene == NULL )
+    {
+      close();
+      throw std::runtime_error( QString( "Can't open raster %1" ).arg( scenes.at( i ) ).toStdString() );
+    }
+    mScenes.push_back( scene );
+
+    QString error;
+    if ( scene->GetRasterXSize() != xSize || scene->GetRasterYSize() != ySize )
+      error = QString( "Scene %1 is %2x%3, input raster is %4x%5" ).arg( scenes.at( i ) )
+              .arg( scene->GetRasterXSize() ).arg( scene->GetRasterYSize() ).arg( xSize ).arg( ySize );
+    else if ( i > 0 && scene->GetRasterCount() != mBandCount )
+      error = QString( "Scene %1 has %2 bands, expected %3" ).arg( scenes.at( i ) ).arg( scene->GetRasterCount() ).arg( mBandCount );
+    if ( !error.isEmpty() )
+    {
+      close();
+      throw std::runtime_error( error.toStdString() );
+    }
+    mBandCount = scene->GetRasterCount();
+  }
+}
+
+TimeSeriesStack::~TimeSeriesStack()
+{
+  close();
+}
+
+void TimeSeriesStack::close()
+{
+  for ( size_t i = 0; i < mScenes.size(); ++i )
+    GDALClose( ( GDALDatasetH ) mScenes[ i ] );
+  mScenes.clear();
+}
+
+void TimeSeriesStack::readRow( int band, int row, float* out, int xOff, int xSize ) const
+{
+  if ( xSize < 0 )
+    xSize = mXSize - xOff;
+  for ( size_t t = 0; t < mScenes.size(); ++t )
+  {
+    if ( mScenes[ t ]->GetRasterBand( band + 1 )->RasterIO( GF_Read, xOff, row, xSize, 1, ( void* )( out + t * xSize ), xSize, 1, GDT_Float32, 0, 0 ) != CE_None )
+      throw std::runtime_error( QString( "Can't read row %1 of scene %2" ).arg( row ).arg( t + 1 ).toStdString() );
+  }
+}
+
+void TimeSeriesStack::readPixel( int band, int col, int row, float* out ) const
+{
+  for ( size_t t = 0; t < mScenes.size(); ++t )
+  {
+    if ( mScenes[ t ]->GetRasterBand( band + 1 )->RasterIO( GF_Read, col, row, 1, 1, ( void* )( out + t ), 1, 1, GDT_Float32, 0, 0 ) != CE_None )
+      throw std::runtime_error( QString( "Can't read pixel %1,%2 of scene %3" ).arg( col ).arg( row ).arg( t + 1 ).toStdString() );
+  }
+}
+
+bool TemporalAggregate::isAggregate( const QString& text )
+{
+  return QRegExp( AggregatePattern, Qt::CaseInsensitive ).exactMatch( text );
+}
+
+TemporalAggregate::TemporalAggregate( const QString& text, int seriesBands )
+    : mStat( TemporalMean ),
+      mPercentile( 0 ),
+      mBand( -1 )
+{
+  QRegExp re( AggregatePattern, Qt::CaseInsensitive );
+  if ( !re.exactMatch( text ) )
+    throw std::runtime_error( QString( "Feature \"%1\" is not a temporal aggregate" ).arg( text ).toStdString() );
+
+  QString stat = re.cap( 1 ).toLower();
+  if ( stat == "min" )
+    mStat = TemporalMin;
+  else if ( stat == "max" )
+    mStat = TemporalMax;
+  else if ( stat == "slope" )
+    mStat = TemporalSlope;
+  else if ( stat != "mean" )
+  {
+    mStat = TemporalPercentile;
+    mPercentile = re.cap( 2 ).toInt();
+    if ( mPercentile > 100 )
+      throw std::runtime_error( QString( "Feature \"%1\": percentile must be 0..100" ).arg( text ).toStdString() );
+  }
+
+  mBand = re.cap( 3 ).toInt() - 1;
+  if ( mBand < 0 || mBand >= seriesBands )
+    throw std::runtime_error( QString( "Feature \"%1\": time series has bands 1..%2" ).arg( text ).arg( seriesBands ).toStdString() );
+}
+
+void TemporalAggregate::reduce( const float* values, int sceneCount, int n, float* out, std::vector<float>& scratch ) const
+{
+  if ( sceneCount <= 0 || n <= 0 )
+    return;
+
+  switch ( mStat )
+  {
+    case TemporalMin:
+    case TemporalMax:
+    {
+      std::copy( values, values + n, out );
+      for ( int t = 1; t < sceneCount; ++t )
+      {
+        const float* scene = values + ( size_t )t * n;
+        if ( mStat == TemporalMin )
+          for ( int i = 0; i < n; ++i )
+            out[ i ] = std::min( out[ i ], scene[ i ] );
+        else
+          for ( int i = 0; i < n; ++i )
+            out[ i ] = std::max( out[ i ], scene[ i ] );
+      }
+      break;
+    }
+    case TemporalMean:
+    {
+      std::copy( values, values + n, out );
+      for ( int t = 1; t < sceneCount; ++t )
+      {
+        const float* scene = values + ( size_t )t * n;
+        for ( int i = 0; i < n; ++i )
+          out[ i ] += scene[ i ];
+      }
+      float scale = 1.0f / sceneCount;
+      for ( int i = 0; i < n; ++i )
+        out[ i ] *= scale;
+      break;
+    }
+    case TemporalSlope:
+    {
+      // scene steps centered on zero, slope = sum( x * v ) / sum( x * x )
+      double center = ( sceneCount - 1 ) / 2.0;
+      double norm = 0;
+      for ( int t = 0; t < sceneCount; ++t )
+        norm += ( t - center ) * ( t - center );
+      std::fill( out, out + n, 0.0f );
+      if ( norm == 0 )
+        break;
+      for ( int t = 0; t < sceneCount; ++t )
+      {
+        const float* scene = values + ( size_t )t * n;
+        float weight = ( float )( ( t - center ) / norm );
+        for ( int i = 0; i < n; ++i )
+          out[ i ] += weight * scene[ i ];
+      }
+      break;
+    }
+    case TemporalPercentile:
+    {
+      int rank = ( int )floor( mPercentile / 100.0 * ( sceneCount - 1 ) + 0.5 );
+      scratch.resize( sceneCount );
+      for ( int i = 0; i < n; ++i )
+      {
+        for ( int t = 0; t < sceneCount; ++t )
+          scratch[ t ] = values[ ( size_t )t * n + i ];
+        std::nth_element( scratch.begin(), scratch.begin() + rank, scratch.end() );
+        out[ i ] = scratch[ rank ];
+      }
+      break;
+    }
+  }
+}
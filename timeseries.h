@@ -0,0 +1,99 @@
+/***************************************************************************
+  timeseries.h
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef TIMESERIES_H
+#define TIMESERIES_H
+
+#include <vector>
+
+#include <QString>
+#include <QStringList>
+
+class GDALDataset;
+
+/**
+  Scenes of a time series on the grid of the input raster, in date order.
+  Scenes stay separate datasets, values of one band are read across all of
+  them for a row or a pixel at a time, so the temporal stack is never
+  built.
+  */
+class TimeSeriesStack
+{
+  public:
+    //! every scene must be xSize x ySize with the same band count. Throws std::runtime_error
+    TimeSeriesStack( const QStringList& scenes, int xSize, int ySize );
+    ~TimeSeriesStack();
+
+    int sceneCount() const { return ( int )mScenes.size(); }
+    int bandCount() const { return mBandCount; }
+
+    /** columns xOff .. xOff + xSize - 1 (xSize -1 - to the edge) of row of
+      band (0-based) of every scene, scene t goes to out[ t * xSize ].
+      Throws std::runtime_error
+      */
+    void readRow( int band, int row, float* out, int xOff = 0, int xSize = -1 ) const;
+    //! pixel of band (0-based) of every scene. Throws std::runtime_error
+    void readPixel( int band, int col, int row, float* out ) const;
+
+  private:
+    void close();
+
+    std::vector<GDALDataset*> mScenes;
+    int mXSize;
+    int mBandCount;
+};
+
+enum TemporalStat
+{
+  TemporalMin,
+  TemporalMax,
+  TemporalMean,
+  TemporalPercentile,
+  TemporalSlope
+};
+
+/**
+  Per-pixel aggregate of one band over the time series, written as
+  "min(ts.b1)", "max(ts.b1)", "mean(ts.b1)", "p90(ts.b1)" (percentile,
+  nearest rank) or "slope(ts.b1)" (least squares trend per scene step).
+  */
+class TemporalAggregate
+{
+  public:
+    static bool isAggregate( const QString& text );
+
+    //! throws std::runtime_error on bad text or band out of the series bands
+    TemporalAggregate( const QString& text, int seriesBands );
+
+    //! band of the scenes, 0-based
+    int band() const { return mBand; }
+
+    /** aggregate n pixels of sceneCount scenes, value of pixel i in scene t
+      is values[ t * n + i ]. Reductions run scene by scene over all pixels,
+      percentiles select per pixel in scratch
+      */
+    void reduce( const float* values, int sceneCount, int n, float* out, std::vector<float>& scratch ) const;
+
+  private:
+    TemporalStat mStat;
+    int mPercentile;
+    int mBand;
+};
+
+#endif // TIMESERIES_H
@@ -0,0 +1,302 @@
+/***************************************************************************
+  trainset.cpp
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <QSet>
+
+#include "trainset.h"
+
+namespace
+{
+  const char Magic[ 8 ] = { 'D', 'T', 'C', 'T', 'S', 'E', 'T', '1' };
+
+  //! records end with qint64 pixel index
+  const qint32 PixelIdsFlag = 1;
+
+  struct TrainSetHeader
+  {
+    char magic[ 8 ];
+    qint32 varCount;
+    qint32 flags;
+    qint64 sampleCount;
+  };
+
+  qint64 recordSize( int varCount, bool pixelIds )
+  {
+    return ( qint64 )sizeof( float ) * ( varCount + 1 ) + ( pixelIds ? sizeof( qint64 ) : 0 );
+  }
+
+  //! pixel ids deduplicated in memory at once by mergeTrainSets, about 100 MB of QSet
+  const qint64 MaxDedupeIds = Q_INT64_C( 4 ) << 20;
+  //! bucket files open at once, larger merges exceed MaxDedupeIds per bucket
+  const int MaxBuckets = 256;
+
+  //! pixel ids of neighbouring pixels are spread over all buckets
+  int pixelBucket( qint64 pixel, int bucketCount )
+  {
+    quint64 h = ( quint64 )pixel * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 29;
+    return ( int )( h % ( quint64 )bucketCount );
+  }
+
+  //! copy all samples of reader, skipping pixels in seen when it is not NULL
+  void appendSamples( TrainSetReader& reader, TrainSetWriter& writer, QSet<qint64>* seen )
+  {
+    const int chunkRows = 65536;
+    int varCount = reader.varCount();
+    std::vector<float> values( ( size_t )chunkRows * varCount );
+    std::vector<float> responses( chunkRows );
+    std::vector<qint64> pixels( chunkRows );
+    int rows;
+    while ( ( rows = reader.read( &values[ 0 ], &responses[ 0 ], chunkRows, &pixels[ 0 ] ) ) > 0 )
+    {
+      for ( int r = 0; r < rows; ++r )
+      {
+        if ( seen )
+        {
+          if ( seen->contains( pixels[ r ] ) )
+            continue;
+          seen->insert( pixels[ r ] );
+        }
+        writer.append( &values[ ( size_t )r * varCount ], responses[ r ], pixels[ r ] );
+      }
+    }
+  }
+}
+
+TrainSetWriter::TrainSetWriter( const QString& fileName, int varCount, bool pixelIds )
+    : mFile( fileName ),
+      mVarCount( varCount ),
+      mPixelIds( pixelIds ),
+      mSampleCount( 0 )
+{
+  if ( varCount <= 0 )
+    throw std::runtime_error( "Training set: no bands" );
+  if ( !mFile.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+    throw std::runtime_error( QString( "Can't create training set %1" ).arg( fileName ).toStdString() );
+
+  // sample count is written by close()
+  TrainSetHeader header;
+  memcpy( header.magic, Magic, sizeof( Magic ) );
+  header.varCount = varCount;
+  header.flags = pixelIds ? PixelIdsFlag : 0;
+  header.sampleCount = 0;
+  if ( mFile.write( ( const char* )&header, sizeof( header ) ) != sizeof( header ) )
+    throw std::runtime_error( QString( "Can't write training set %1" ).arg( fileName ).toStdString() );
+}
+
+TrainSetWriter::~TrainSetWriter()
+{
+  try
+  {
+    close();
+  }
+  catch ( std::exception& )
+  {
+  }
+}
+
+void TrainSetWriter::append( const float* values, float response, qint64 pixel )
+{
+  qint64 size = sizeof( float ) * mVarCount;
+  if ( mFile.write( ( const char* )values, size ) != size
+       || mFile.write( ( const char* )&response, sizeof( float ) ) != sizeof( float )
+       || ( mPixelIds && mFile.write( ( const char* )&pixel, sizeof( pixel ) ) != sizeof( pixel ) ) )
+    throw std::runtime_error( QString( "Can't write training set %1" ).arg( mFile.fileName() ).toStdString() );
+  mSampleCount++;
+}
+
+void TrainSetWriter::close()
+{
+  if ( !mFile.isOpen() )
+    return;
+
+  bool ok = mFile.seek( offsetof( TrainSetHeader, sampleCount ) )
+            && mFile.write( ( const char* )&mSampleCount, sizeof( mSampleCount ) ) == sizeof( mSampleCount );
+  mFile.close();
+  if ( !ok )
+    throw std::runtime_error( QString( "Can't write training set %1" ).arg( mFile.fileName() ).toStdString() );
+}
+
+TrainSetReader::TrainSetReader( const QString& fileName )
+    : mFile( fileName ),
+      mVarCount( 0 ),
+      mPixelIds( false ),
+      mSampleCount( 0 ),
+      mRead( 0 )
+{
+  if ( !mFile.open( QIODevice::ReadOnly ) )
+    throw std::runtime_error( QString( "Can't open training set %1" ).arg( fileName ).toStdString() );
+
+  TrainSetHeader header;
+  if ( mFile.read( ( char* )&header, sizeof( header ) ) != sizeof( header )
+       || memcmp( header.magic, Magic, sizeof( Magic ) ) != 0 || header.varCount <= 0 )
+    throw std::runtime_error( QString( "%1 is not a training set" ).arg( fileName ).toStdString() );
+
+  mVarCount = header.varCount;
+  mPixelIds = ( header.flags & PixelIdsFlag ) != 0;
+  mSampleCount = header.sampleCount;
+  if ( ( mFile.size() - ( qint64 )sizeof( header ) ) != mSampleCount * recordSize( mVarCount, mPixelIds ) )
+    throw std::runtime_error( QString( "Training set %1 is truncated" ).arg( fileName ).toStdString() );
+}
+
+bool TrainSetReader::isTrainSetFile( const QString& fileName )
+{
+  QFile file( fileName );
+  char magic[ sizeof( Magic ) ];
+  return file.open( QIODevice::ReadOnly )
+         && file.read( magic, sizeof( magic ) ) == sizeof( magic )
+         && memcmp( magic, Magic, sizeof( Magic ) ) == 0;
+}
+
+void TrainSetReader::rewind()
+{
+  if ( !mFile.seek( sizeof( TrainSetHeader ) ) )
+    throw std::runtime_error( QString( "Can't read training set %1" ).arg( mFile.fileName() ).toStdString() );
+  mRead = 0;
+}
+
+int TrainSetReader::read( float* values, float* responses, int maxRows, qint64* pixels )
+{
+  int rows = ( int )qMin( ( qint64 )maxRows, mSampleCount - mRead );
+  if ( rows <= 0 )
+    return 0;
+
+  // records are interleaved on disk, split them into values, responses and pixels
+  qint64 record = recordSize( mVarCount, mPixelIds );
+  std::vector<char> buffer( ( size_t )( rows * record ) );
+  qint64 size = ( qint64 )buffer.size();
+  if ( mFile.read( &buffer[ 0 ], size ) != size )
+    throw std::runtime_error( QString( "Can't read training set %1" ).arg( mFile.fileName() ).toStdString() );
+
+  for ( int i = 0; i < rows; ++i )
+  {
+    const char* data = &buffer[ ( size_t )( i * record ) ];
+    memcpy( values + ( size_t )i * mVarCount, data, sizeof( float ) * mVarCount );
+    memcpy( responses + i, data + sizeof( float ) * mVarCount, sizeof( float ) );
+    if ( pixels )
+    {
+      pixels[ i ] = -1;
+      if ( mPixelIds )
+        memcpy( pixels + i, data + sizeof( float ) * ( mVarCount + 1 ), sizeof( qint64 ) );
+    }
+  }
+  mRead += rows;
+  return rows;
+}
+
+qint64 mergeTrainSets( const QStringList& inputs, const QString& output )
+{
+  if ( inputs.isEmpty() )
+    throw std::runtime_error( "Training set merge: no inputs" );
+
+  // check all shards before the output is truncated
+  int varCount = 0;
+  bool pixelIds = true;
+  qint64 total = 0;
+  for ( int i = 0; i < inputs.size(); ++i )
+  {
+    TrainSetReader reader( inputs.at( i ) );
+    if ( i == 0 )
+      varCount = reader.varCount();
+    else if ( reader.varCount() != varCount )
+      throw std::runtime_error( QString( "Training set %1 has %2 bands, expected %3" )
+                                .arg( inputs.at( i ) ).arg( reader.varCount() ).arg( varCount ).toStdString() );
+    pixelIds = pixelIds && reader.hasPixelIds();
+    total += reader.sampleCount();
+  }
+
+  TrainSetWriter writer( output, varCount, pixelIds );
+  int bucketCount = pixelIds ? ( int )qBound( ( qint64 )1, ( total + MaxDedupeIds - 1 ) / MaxDedupeIds, ( qint64 )MaxBuckets ) : 1;
+  if ( bucketCount == 1 )
+  {
+    QSet<qint64> seen;
+    for ( int i = 0; i < inputs.size(); ++i )
+    {
+      TrainSetReader reader( inputs.at( i ) );
+      appendSamples( reader, writer, pixelIds ? &seen : NULL );
+    }
+    writer.close();
+    return writer.sampleCount();
+  }
+
+  // a set of every pixel id does not fit memory, samples are partitioned by
+  // pixel into bucket files first, so duplicates meet in the same bucket
+  QStringList bucketNames;
+  for ( int b = 0; b < bucketCount; ++b )
+    bucketNames << QString( "%1.%2.part" ).arg( output ).arg( b );
+
+  try
+  {
+    {
+      QList<TrainSetWriter*> buckets;
+      try
+      {
+        for ( int b = 0; b < bucketCount; ++b )
+          buckets << new TrainSetWriter( bucketNames.at( b ), varCount, true );
+
+        const int chunkRows = 65536;
+        std::vector<float> values( ( size_t )chunkRows * varCount );
+        std::vector<float> responses( chunkRows );
+        std::vector<qint64> pixels( chunkRows );
+        for ( int i = 0; i < inputs.size(); ++i )
+        {
+          TrainSetReader reader( inputs.at( i ) );
+          int rows;
+          while ( ( rows = reader.read( &values[ 0 ], &responses[ 0 ], chunkRows, &pixels[ 0 ] ) ) > 0 )
+          {
+            for ( int r = 0; r < rows; ++r )
+              buckets.at( pixelBucket( pixels[ r ], bucketCount ) )->append( &values[ ( size_t )r * varCount ], responses[ r ], pixels[ r ] );
+          }
+        }
+        for ( int b = 0; b < bucketCount; ++b )
+          buckets.at( b )->close();
+      }
+      catch ( ... )
+      {
+        qDeleteAll( buckets );
+        throw;
+      }
+      qDeleteAll( buckets );
+    }
+
+    // input order is kept within a bucket, so the first sample of a pixel wins
+    for ( int b = 0; b < bucketCount; ++b )
+    {
+      QSet<qint64> seen;
+      {
+        TrainSetReader reader( bucketNames.at( b ) );
+        appendSamples( reader, writer, &seen );
+      }
+      QFile::remove( bucketNames.at( b ) );
+    }
+  }
+  catch ( ... )
+  {
+    for ( int b = 0; b < bucketCount; ++b )
+      QFile::remove( bucketNames.at( b ) );
+    throw;
+  }
+  writer.close();
+  return writer.sampleCount();
+}
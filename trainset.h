@@ -0,0 +1,95 @@
+/***************************************************************************
+  trainset.h
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef TRAINSET_H
+#define TRAINSET_H
+
+#include <QFile>
+#include <QString>
+#include <QStringList>
+
+/**
+  Training-set file: a small header followed by samples, every sample is
+  varCount band values and the response as native floats, optionally
+  followed by the qint64 index of the raster pixel the sample came from.
+  Samples are written and read sequentially, so the file may be larger
+  than memory.
+  */
+class TrainSetWriter
+{
+  public:
+    //! throws std::runtime_error if file can't be created
+    TrainSetWriter( const QString& fileName, int varCount, bool pixelIds = false );
+    ~TrainSetWriter();
+
+    //! pixel is ignored when file has no pixel ids. Throws std::runtime_error on write error
+    void append( const float* values, float response, qint64 pixel = -1 );
+    //! write sample count into the header, called by destructor too
+    void close();
+
+    int varCount() const { return mVarCount; }
+    bool hasPixelIds() const { return mPixelIds; }
+    qint64 sampleCount() const { return mSampleCount; }
+
+  private:
+    QFile mFile;
+    int mVarCount;
+    bool mPixelIds;
+    qint64 mSampleCount;
+};
+
+class TrainSetReader
+{
+  public:
+    //! throws std::runtime_error if file is not a training set
+    TrainSetReader( const QString& fileName );
+
+    static bool isTrainSetFile( const QString& fileName );
+
+    int varCount() const { return mVarCount; }
+    bool hasPixelIds() const { return mPixelIds; }
+    qint64 sampleCount() const { return mSampleCount; }
+
+    //! start reading from the first sample
+    void rewind();
+
+    /** read up to maxRows samples, values are stored row by row. Pixel ids
+      are stored to pixels if it is not NULL (-1 when file has no ids).
+      Returns number of samples read, 0 at the end. Throws std::runtime_error
+      */
+    int read( float* values, float* responses, int maxRows, qint64* pixels = NULL );
+
+  private:
+    QFile mFile;
+    int mVarCount;
+    bool mPixelIds;
+    qint64 mSampleCount;
+    qint64 mRead;
+};
+
+/** concatenate training sets (e.g. shards extracted by different processes)
+  into output. When all inputs have pixel ids, only the first sample of every
+  pixel is written. Large inputs are deduplicated through temporary bucket
+  files next to output, so memory does not grow with the number of pixels
+  and the output is grouped by bucket instead of following input order.
+  Returns number of samples written. Throws std::runtime_error
+  */
+qint64 mergeTrainSets( const QStringList& inputs, const QString& output );
+
+#endif // TRAINSET_H
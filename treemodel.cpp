@@ -0,0 +1,876 @@
+/***************************************************************************
+  treemodel.cpp
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include <QByteArray>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QString>
+
+#include "opencv2/core/core_c.h"
+#include "opencv2/ml/ml.hpp"
+
+#include "treemodel.h"
+
+#define TREE_MODEL_NODE "TreeModel"
+
+namespace
+{
+  const char BinaryMagic[ 8 ] = { 'D', 'T', 'C', 'M', 'O', 'D', 'L', '1' };
+  const qint32 ByteOrderMark = 0x01020304;
+
+  //! binary model header, arrays follow in the order of the counts
+  struct BinaryHeader
+  {
+    char magic[ 8 ];
+    qint32 byteOrder;
+    qint32 isClassifier;
+    qint32 varCount;
+    qint32 classCount;
+    qint32 treeCount;
+    qint32 nodeCount;
+    qint32 splitCount;
+    qint32 categoryCount;
+  };
+
+  //! node of a source tree, its copy and depth
+  struct DepthItem
+  {
+    int src;
+    int dst;
+    int depth;
+  };
+
+  template <typename T>
+  void writeArray( CvFileStorage* fs, const char* name, const T* values, int count, const char* dt )
+  {
+    cvStartWriteStruct( fs, name, CV_NODE_SEQ | CV_NODE_FLOW );
+    if ( count > 0 )
+      cvWriteRawData( fs, values, count, dt );
+    cvEndWriteStruct( fs );
+  }
+
+  template <typename T>
+  bool writeBinary( QFile& file, const T* values, int count )
+  {
+    qint64 size = ( qint64 )sizeof( T ) * count;
+    return count == 0 || file.write( ( const char* )values, size ) == size;
+  }
+
+  template <typename T>
+  void readArray( CvFileStorage* fs, CvFileNode* parent, const char* name, std::vector<T>& values, const char* dt, int fieldCount )
+  {
+    CvFileNode* node = cvGetFileNodeByName( fs, parent, name );
+    if ( !node || !CV_NODE_IS_SEQ( node->tag ) )
+      throw std::runtime_error( QString( "Tree model: no %1 array" ).arg( name ).toStdString() );
+
+    int total = node->data.seq->total;
+    if ( total % fieldCount != 0 )
+      throw std::runtime_error( QString( "Tree model: broken %1 array" ).arg( name ).toStdString() );
+
+    values.resize( total / fieldCount );
+    if ( !values.empty() )
+      cvReadRawData( fs, node, &values[ 0 ], dt );
+  }
+}
+
+TreeModel::TreeModel()
+    : mClassifier( false ),
+      mVarCount( 0 )
+{
+}
+
+TreeModel::~TreeModel()
+{
+}
+
+bool TreeModel::isTreeModelFile( const QString& fileName )
+{
+  QFile file( fileName );
+  char magic[ sizeof( BinaryMagic ) ];
+  if ( file.open( QIODevice::ReadOnly ) && file.read( magic, sizeof( magic ) ) == sizeof( magic )
+       && memcmp( magic, BinaryMagic, sizeof( BinaryMagic ) ) == 0 )
+    return true;
+  file.close();
+
+  CvFileStorage* fs = cvOpenFileStorage( fileName.toUtf8(), 0, CV_STORAGE_READ );
+  if ( !fs )
+    return false;
+  bool result = cvGetFileNodeByName( fs, 0, TREE_MODEL_NODE ) != 0;
+  cvReleaseFileStorage( &fs );
+  return result;
+}
+
+bool TreeModel::isBinaryFileName( const QString& fileName )
+{
+  return QFileInfo( fileName ).suffix().compare( "dtm", Qt::CaseInsensitive ) == 0;
+}
+
+TreeModel* TreeModel::fromCvDTree( const CvDTree* tree )
+{
+  TreeModel* model = new TreeModel();
+  try
+  {
+    model->appendCvTree( tree );
+  }
+  catch ( ... )
+  {
+    delete model;
+    throw;
+  }
+  return model;
+}
+
+TreeModel* TreeModel::fromCvRTrees( const CvRTrees* forest )
+{
+  if ( forest->get_tree_count() == 0 )
+    throw std::runtime_error( "Tree model: empty OpenCV forest" );
+
+  TreeModel* model = new TreeModel();
+  try
+  {
+    for ( int t = 0; t < forest->get_tree_count(); ++t )
+      model->appendCvTree( forest->get_tree( t ) );
+  }
+  catch ( ... )
+  {
+    delete model;
+    throw;
+  }
+  return model;
+}
+
+void TreeModel::appendCvTree( const CvDTree* tree )
+{
+  const CvDTreeNode* root = tree->get_root();
+  const CvDTreeTrainData* data = const_cast<CvDTree*>( tree )->get_data();
+  if ( !root || !data )
+    throw std::runtime_error( "Tree model: empty OpenCV tree" );
+  detach();
+
+  const int* varType = data->var_type->data.i;
+  const int* varIdx = data->var_idx ? data->var_idx->data.i : 0;
+  const int* catOfs = data->cat_ofs ? data->cat_ofs->data.i : 0;
+  const int* catMap = data->cat_map ? data->cat_map->data.i : 0;
+  int catMapSize = data->cat_map ? data->cat_map->rows * data->cat_map->cols : 0;
+
+  if ( mRoots.empty() )
+  {
+    mClassifier = data->is_classifier;
+    mVarCount = data->var_all;
+  }
+  else if ( mClassifier != data->is_classifier || mVarCount != data->var_all )
+  {
+    throw std::runtime_error( "Tree model: OpenCV trees of different kinds" );
+  }
+
+  // class indices of the tree go through labels, trees may come from different train data
+  std::vector<int> classMap;
+  if ( mClassifier )
+  {
+    const int* labels = catMap + catOfs[ data->cat_var_count ];
+    int count = data->cat_count->data.i[ data->cat_var_count ];
+    for ( int c = 0; c < count; ++c )
+    {
+      std::vector<float>::iterator it = std::find( mClassLabels.begin(), mClassLabels.end(), ( float )labels[ c ] );
+      classMap.push_back( ( int )( it - mClassLabels.begin() ) );
+      if ( it == mClassLabels.end() )
+        mClassLabels.push_back( ( float )labels[ c ] );
+    }
+  }
+
+  // branches below the selected pruning level are not predicted by CvDTree
+  int prunedIdx = tree->get_pruned_tree_idx();
+
+  std::vector< std::pair<const CvDTreeNode*, int> > stack;
+  mRoots.push_back( ( int )mNodes.size() );
+  stack.push_back( std::make_pair( root, ( int )mNodes.size() ) );
+  mNodes.push_back( TreeNode() );
+  while ( !stack.empty() )
+  {
+    const CvDTreeNode* src = stack.back().first;
+    int idx = stack.back().second;
+    stack.pop_back();
+
+    TreeNode node;
+    node.left = -1;
+    node.right = -1;
+    node.splitBegin = 0;
+    node.splitCount = 0;
+    node.defaultDir = 1;
+    node.classIdx = mClassifier ? classMap[ src->class_idx ] : -1;
+    node.value = ( float )src->value;
+    // class counts are not saved in OpenCV models
+    node.purity = 1.0f;
+
+    if ( src->left && src->Tn > prunedIdx )
+    {
+      node.splitBegin = ( int )mSplits.size();
+      for ( const CvDTreeSplit* split = src->split; split; split = split->next )
+      {
+        TreeSplit out;
+        out.var = varIdx ? varIdx[ split->var_idx ] : split->var_idx;
+        out.inversed = split->inversed;
+        out.catBegin = -1;
+        out.catCount = 0;
+        out.threshold = 0;
+
+        int ci = varType[ split->var_idx ];
+        if ( ci < 0 )
+        {
+          out.threshold = split->ord.c;
+        }
+        else
+        {
+          // known categories of the variable with their subset bit
+          int begin = catOfs[ ci ];
+          int end = ci + 1 < data->cat_ofs->cols ? catOfs[ ci + 1 ] : catMapSize;
+          out.catBegin = ( int )mCategories.size();
+          out.catCount = end - begin;
+          for ( int c = begin; c < end; ++c )
+          {
+            int k = c - begin;
+            TreeCategory category;
+            category.value = catMap[ c ];
+            category.dir = ( split->subset[ k >> 5 ] & ( 1 << ( k & 31 ) ) ) ? -1 : 1;
+            mCategories.push_back( category );
+          }
+        }
+        mSplits.push_back( out );
+      }
+      node.splitCount = ( int )mSplits.size() - node.splitBegin;
+      // CvDTree::predict goes to the larger child when no split applies
+      node.defaultDir = src->right->sample_count - src->left->sample_count < 0 ? -1 : 1;
+
+      node.left = ( int )mNodes.size();
+      node.right = node.left + 1;
+      mNodes.push_back( TreeNode() );
+      mNodes.push_back( TreeNode() );
+      stack.push_back( std::make_pair( ( const CvDTreeNode* )src->right, node.right ) );
+      stack.push_back( std::make_pair( ( const CvDTreeNode* )src->left, node.left ) );
+    }
+    mNodes[ idx ] = node;
+  }
+}
+
+void TreeModel::save( const QString& fileName ) const
+{
+  if ( isBinaryFileName( fileName ) )
+  {
+    saveBinary( fileName );
+    return;
+  }
+
+  CvFileStorage* fs = cvOpenFileStorage( fileName.toUtf8(), 0, CV_STORAGE_WRITE );
+  if ( !fs )
+    throw std::runtime_error( QString( "Can't write model %1" ).arg( fileName ).toStdString() );
+
+  cvStartWriteStruct( fs, TREE_MODEL_NODE, CV_NODE_MAP );
+  cvWriteInt( fs, "is_classifier", mClassifier ? 1 : 0 );
+  cvWriteInt( fs, "var_count", mVarCount );
+  cvWriteInt( fs, "tree_count", treeCount() );
+  writeArray( fs, "class_labels", classLabels(), classCount(), "f" );
+  writeArray( fs, "roots", roots(), treeCount(), "i" );
+  writeArray( fs, "nodes", nodes(), nodeCount(), "6i2f" );
+  writeArray( fs, "splits", splits(), splitCount(), "4if" );
+  writeArray( fs, "categories", categories(), categoryCount(), "2i" );
+  cvEndWriteStruct( fs );
+
+  cvReleaseFileStorage( &fs );
+}
+
+void TreeModel::saveBinary( const QString& fileName ) const
+{
+  QFile file( fileName );
+  if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+    throw std::runtime_error( QString( "Can't write model %1" ).arg( fileName ).toStdString() );
+
+  BinaryHeader header;
+  memcpy( header.magic, BinaryMagic, sizeof( BinaryMagic ) );
+  header.byteOrder = ByteOrderMark;
+  header.isClassifier = mClassifier ? 1 : 0;
+  header.varCount = mVarCount;
+  header.classCount = classCount();
+  header.treeCount = treeCount();
+  header.nodeCount = nodeCount();
+  header.splitCount = splitCount();
+  header.categoryCount = categoryCount();
+
+  bool ok = file.write( ( const char* )&header, sizeof( header ) ) == sizeof( header )
+            && writeBinary( file, classLabels(), classCount() )
+            && writeBinary( file, roots(), treeCount() )
+            && writeBinary( file, nodes(), nodeCount() )
+            && writeBinary( file, splits(), splitCount() )
+            && writeBinary( file, categories(), categoryCount() );
+  file.close();
+  if ( !ok )
+    throw std::runtime_error( QString( "Can't write model %1" ).arg( fileName ).toStdString() );
+}
+
+void TreeModel::load( const QString& fileName )
+{
+  mMap.clear();
+  mClassLabels.clear();
+  mRoots.clear();
+  mNodes.clear();
+  mSplits.clear();
+  mCategories.clear();
+
+  QFile file( fileName );
+  char magic[ sizeof( BinaryMagic ) ];
+  bool binary = file.open( QIODevice::ReadOnly ) && file.read( magic, sizeof( magic ) ) == sizeof( magic )
+                && memcmp( magic, BinaryMagic, sizeof( BinaryMagic ) ) == 0;
+  file.close();
+
+  if ( binary )
+    loadBinary( fileName );
+  else
+    loadYaml( fileName );
+  validate();
+}
+
+void TreeModel::loadBinary( const QString& fileName )
+{
+  QSharedPointer<QFile> file( new QFile( fileName ) );
+  if ( !file->open( QIODevice::ReadOnly ) )
+    throw std::runtime_error( QString( "Can't read model %1" ).arg( fileName ).toStdString() );
+
+  // read-only shared mapping, pages are shared by all processes using the model
+  qint64 size = file->size();
+  const uchar* data = size >= ( qint64 )sizeof( BinaryHeader ) ? file->map( 0, size ) : 0;
+  if ( !data )
+    throw std::runtime_error( QString( "Can't map model %1" ).arg( fileName ).toStdString() );
+
+  BinaryHeader header;
+  memcpy( &header, data, sizeof( header ) );
+  if ( header.byteOrder != ByteOrderMark )
+    throw std::runtime_error( QString( "Model %1 was saved on a machine with other byte order" ).arg( fileName ).toStdString() );
+  if ( header.classCount < 0 || header.treeCount < 0 || header.nodeCount < 0
+       || header.splitCount < 0 || header.categoryCount < 0 )
+    throw std::runtime_error( QString( "Model %1 is broken" ).arg( fileName ).toStdString() );
+
+  qint64 expected = sizeof( BinaryHeader )
+                    + ( qint64 )sizeof( float ) * header.classCount
+                    + ( qint64 )sizeof( int ) * header.treeCount
+                    + ( qint64 )sizeof( TreeNode ) * header.nodeCount
+                    + ( qint64 )sizeof( TreeSplit ) * header.splitCount
+                    + ( qint64 )sizeof( TreeCategory ) * header.categoryCount;
+  if ( size != expected )
+    throw std::runtime_error( QString( "Model %1 is truncated" ).arg( fileName ).toStdString() );
+
+  // all records are 4-byte aligned, mapping is page aligned
+  QSharedPointer<Mapping> map( new Mapping() );
+  map->file = file;
+  map->classCount = header.classCount;
+  map->treeCount = header.treeCount;
+  map->nodeCount = header.nodeCount;
+  map->splitCount = header.splitCount;
+  map->categoryCount = header.categoryCount;
+
+  const uchar* p = data + sizeof( BinaryHeader );
+  map->classLabels = ( const float* )p;
+  p += sizeof( float ) * header.classCount;
+  map->roots = ( const int* )p;
+  p += sizeof( int ) * header.treeCount;
+  map->nodes = ( const TreeNode* )p;
+  p += sizeof( TreeNode ) * header.nodeCount;
+  map->splits = ( const TreeSplit* )p;
+  p += sizeof( TreeSplit ) * header.splitCount;
+  map->categories = ( const TreeCategory* )p;
+
+  mClassifier = header.isClassifier != 0;
+  mVarCount = header.varCount;
+  mMap = map;
+}
+
+void TreeModel::loadYaml( const QString& fileName )
+{
+  CvFileStorage* fs = cvOpenFileStorage( fileName.toUtf8(), 0, CV_STORAGE_READ );
+  if ( !fs )
+    throw std::runtime_error( QString( "Can't read model %1" ).arg( fileName ).toStdString() );
+
+  CvFileNode* root = cvGetFileNodeByName( fs, 0, TREE_MODEL_NODE );
+  if ( !root )
+  {
+    cvReleaseFileStorage( &fs );
+    throw std::runtime_error( QString( "%1 is not a tree model" ).arg( fileName ).toStdString() );
+  }
+
+  try
+  {
+    mClassifier = cvReadIntByName( fs, root, "is_classifier", 0 ) != 0;
+    mVarCount = cvReadIntByName( fs, root, "var_count", 0 );
+    readArray( fs, root, "class_labels", mClassLabels, "f", 1 );
+    readArray( fs, root, "roots", mRoots, "i", 1 );
+    readArray( fs, root, "nodes", mNodes, "6i2f", 8 );
+    readArray( fs, root, "splits", mSplits, "4if", 5 );
+    readArray( fs, root, "categories", mCategories, "2i", 2 );
+
+    if ( ( int )mRoots.size() != cvReadIntByName( fs, root, "tree_count", -1 ) )
+      throw std::runtime_error( "Tree model: tree count mismatch" );
+  }
+  catch ( std::runtime_error& )
+  {
+    cvReleaseFileStorage( &fs );
+    throw;
+  }
+  cvReleaseFileStorage( &fs );
+}
+
+void TreeModel::validate() const
+{
+  int nodeCount = this->nodeCount();
+  int splitCount = this->splitCount();
+  int categoryCount = this->categoryCount();
+  const int* rootArray = roots();
+  const TreeNode* nodeArray = nodes();
+  const TreeSplit* splitArray = splits();
+
+  for ( int t = 0; t < treeCount(); ++t )
+  {
+    if ( rootArray[ t ] < 0 || rootArray[ t ] >= nodeCount )
+      throw std::runtime_error( "Tree model: bad tree root" );
+  }
+  for ( int i = 0; i < nodeCount; ++i )
+  {
+    const TreeNode& node = nodeArray[ i ];
+    if ( mClassifier && ( node.classIdx < 0 || node.classIdx >= classCount() ) )
+      throw std::runtime_error( "Tree model: bad class index" );
+    if ( node.left < 0 )
+      continue;
+    if ( node.left >= nodeCount || node.right < 0 || node.right >= nodeCount
+         || node.splitBegin < 0 || node.splitCount < 0 || node.splitBegin + node.splitCount > splitCount )
+      throw std::runtime_error( "Tree model: bad node" );
+  }
+  for ( int i = 0; i < splitCount; ++i )
+  {
+    const TreeSplit& split = splitArray[ i ];
+    if ( split.var < 0 || split.var >= mVarCount
+         || ( split.catBegin >= 0 && split.catBegin + split.catCount > categoryCount ) )
+      throw std::runtime_error( "Tree model: bad split" );
+  }
+}
+
+void TreeModel::detach()
+{
+  if ( !mMap )
+    return;
+
+  QSharedPointer<Mapping> map = mMap;
+  mMap.clear();
+  mClassLabels.assign( map->classLabels, map->classLabels + map->classCount );
+  mRoots.assign( map->roots, map->roots + map->treeCount );
+  mNodes.assign( map->nodes, map->nodes + map->nodeCount );
+  mSplits.assign( map->splits, map->splits + map->splitCount );
+  mCategories.assign( map->categories, map->categories + map->categoryCount );
+}
+
+void TreeModel::truncate( int count )
+{
+  if ( count >= treeCount() )
+    return;
+  keepTrees( 0, std::max( count, 0 ) );
+}
+
+void TreeModel::removeFirst( int count )
+{
+  if ( count <= 0 )
+    return;
+  count = std::min( count, treeCount() );
+  keepTrees( count, treeCount() - count );
+}
+
+void TreeModel::keepTrees( int first, int count )
+{
+  detach();
+
+  // copy nodes reachable from the kept roots, subtrees shared after compact()
+  // stay shared, so node order of the source does not matter
+  std::vector<int> copied( mNodes.size(), -1 );
+  std::vector<int> roots;
+  std::vector<TreeNode> nodes;
+  std::vector<TreeSplit> splits;
+  std::vector<TreeCategory> categories;
+
+  std::vector< std::pair<int, int> > stack;
+  for ( int t = first; t < first + count; ++t )
+  {
+    int root = mRoots[ t ];
+    if ( copied[ root ] < 0 )
+    {
+      copied[ root ] = ( int )nodes.size();
+      nodes.push_back( mNodes[ root ] );
+      stack.push_back( std::make_pair( root, copied[ root ] ) );
+    }
+    roots.push_back( copied[ root ] );
+
+    while ( !stack.empty() )
+    {
+      int src = stack.back().first;
+      int dst = stack.back().second;
+      stack.pop_back();
+
+      const TreeNode& node = mNodes[ src ];
+      if ( node.left < 0 )
+        continue;
+
+      nodes[ dst ].splitBegin = ( int )splits.size();
+      for ( int s = node.splitBegin; s < node.splitBegin + node.splitCount; ++s )
+      {
+        TreeSplit split = mSplits[ s ];
+        if ( split.catBegin >= 0 )
+        {
+          split.catBegin = ( int )categories.size();
+          categories.insert( categories.end(), mCategories.begin() + mSplits[ s ].catBegin,
+                             mCategories.begin() + mSplits[ s ].catBegin + split.catCount );
+        }
+        splits.push_back( split );
+      }
+
+      int children[ 2 ] = { node.left, node.right };
+      for ( int c = 0; c < 2; ++c )
+      {
+        if ( copied[ children[ c ] ] < 0 )
+        {
+          copied[ children[ c ] ] = ( int )nodes.size();
+          nodes.push_back( mNodes[ children[ c ] ] );
+          stack.push_back( std::make_pair( children[ c ], copied[ children[ c ] ] ) );
+        }
+      }
+      nodes[ dst ].left = copied[ node.left ];
+      nodes[ dst ].right = copied[ node.right ];
+    }
+  }
+
+  mRoots.swap( roots );
+  mNodes.swap( nodes );
+  mSplits.swap( splits );
+  mCategories.swap( categories );
+}
+
+void TreeModel::limitDepth( int maxDepth )
+{
+  detach();
+
+  // every path is copied, so subtrees shared after compact() are cut at the
+  // depth of each parent separately
+  std::vector<int> roots;
+  std::vector<TreeNode> nodes;
+  std::vector<TreeSplit> splits;
+  std::vector<TreeCategory> categories;
+
+  std::vector<DepthItem> stack;
+  for ( size_t t = 0; t < mRoots.size(); ++t )
+  {
+    roots.push_back( ( int )nodes.size() );
+    DepthItem root = { mRoots[ t ], ( int )nodes.size(), 0 };
+    nodes.push_back( mNodes[ root.src ] );
+    stack.push_back( root );
+
+    while ( !stack.empty() )
+    {
+      DepthItem item = stack.back();
+      stack.pop_back();
+
+      const TreeNode& node = mNodes[ item.src ];
+      if ( node.left < 0 || item.depth >= maxDepth )
+      {
+        // inner nodes keep value and purity of their samples, so they are leaves as is
+        nodes[ item.dst ].left = -1;
+        nodes[ item.dst ].right = -1;
+        nodes[ item.dst ].splitBegin = 0;
+        nodes[ item.dst ].splitCount = 0;
+        continue;
+      }
+
+      nodes[ item.dst ].splitBegin = ( int )splits.size();
+      for ( int s = node.splitBegin; s < node.splitBegin + node.splitCount; ++s )
+      {
+        TreeSplit split = mSplits[ s ];
+        if ( split.catBegin >= 0 )
+        {
+          split.catBegin = ( int )categories.size();
+          categories.insert( categories.end(), mCategories.begin() + mSplits[ s ].catBegin,
+                             mCategories.begin() + mSplits[ s ].catBegin + split.catCount );
+        }
+        splits.push_back( split );
+      }
+
+      DepthItem left = { node.left, ( int )nodes.size(), item.depth + 1 };
+      DepthItem right = { node.right, left.dst + 1, item.depth + 1 };
+      nodes[ item.dst ].left = left.dst;
+      nodes[ item.dst ].right = right.dst;
+      nodes.push_back( mNodes[ left.src ] );
+      nodes.push_back( mNodes[ right.src ] );
+      stack.push_back( right );
+      stack.push_back( left );
+    }
+  }
+
+  mRoots.swap( roots );
+  mNodes.swap( nodes );
+  mSplits.swap( splits );
+  mCategories.swap( categories );
+}
+
+void TreeModel::compact()
+{
+  detach();
+
+  std::vector<int> canon( mNodes.size(), -1 );
+  std::vector<int> roots;
+  std::vector<TreeNode> nodes;
+  std::vector<TreeSplit> splits;
+  std::vector<TreeCategory> categories;
+  QHash<QByteArray, int> unique;
+
+  // children are rebuilt before parents, so equal subtrees get equal ids
+  std::vector<int> stack;
+  for ( size_t t = 0; t < mRoots.size(); ++t )
+  {
+    stack.push_back( mRoots[ t ] );
+    while ( !stack.empty() )
+    {
+      int i = stack.back();
+      if ( canon[ i ] >= 0 )
+      {
+        stack.pop_back();
+        continue;
+      }
+
+      TreeNode node = mNodes[ i ];
+      if ( node.left >= 0 && ( canon[ node.left ] < 0 || canon[ node.right ] < 0 ) )
+      {
+        if ( canon[ node.left ] < 0 )
+          stack.push_back( node.left );
+        if ( canon[ node.right ] < 0 )
+          stack.push_back( node.right );
+        continue;
+      }
+      stack.pop_back();
+
+      QByteArray key;
+      if ( node.left >= 0 )
+      {
+        int left = canon[ node.left ];
+        int right = canon[ node.right ];
+        const TreeNode& l = nodes[ left ];
+        const TreeNode& r = nodes[ right ];
+        if ( l.left < 0 && r.left < 0 && l.classIdx == r.classIdx && l.value == r.value )
+        {
+          // split of leaves with the same outcome is a leaf with the purity
+          // of all its samples, which the parent node already has
+          float purity = node.purity;
+          node = l;
+          node.purity = purity;
+        }
+        else
+        {
+          // a split whose branches lead to one subtree stays, so inner nodes
+          // keep their depth, value and purity for limitDepth() and confidence
+          node.left = left;
+          node.right = right;
+          key.append( 'N' );
+          key.append( ( const char* )&node.defaultDir, sizeof( node.defaultDir ) );
+          key.append( ( const char* )&node.classIdx, sizeof( node.classIdx ) );
+          key.append( ( const char* )&node.value, sizeof( node.value ) );
+          key.append( ( const char* )&node.purity, sizeof( node.purity ) );
+          key.append( ( const char* )&left, sizeof( left ) );
+          key.append( ( const char* )&right, sizeof( right ) );
+          for ( int s = node.splitBegin; s < node.splitBegin + node.splitCount; ++s )
+          {
+            const TreeSplit& split = mSplits[ s ];
+            key.append( ( const char* )&split.var, sizeof( split.var ) );
+            key.append( ( const char* )&split.inversed, sizeof( split.inversed ) );
+            key.append( ( const char* )&split.threshold, sizeof( split.threshold ) );
+            key.append( ( const char* )&split.catCount, sizeof( split.catCount ) );
+            if ( split.catBegin >= 0 )
+              key.append( ( const char* )&mCategories[ split.catBegin ], sizeof( TreeCategory ) * split.catCount );
+          }
+        }
+      }
+      if ( node.left < 0 )
+      {
+        key.append( 'L' );
+        key.append( ( const char* )&node.classIdx, sizeof( node.classIdx ) );
+        key.append( ( const char* )&node.value, sizeof( node.value ) );
+        key.append( ( const char* )&node.purity, sizeof( node.purity ) );
+      }
+
+      QHash<QByteArray, int>::const_iterator it = unique.constFind( key );
+      if ( it != unique.constEnd() )
+      {
+        canon[ i ] = it.value();
+        continue;
+      }
+
+      if ( node.left >= 0 )
+      {
+        int splitBegin = ( int )splits.size();
+        for ( int s = node.splitBegin; s < node.splitBegin + node.splitCount; ++s )
+        {
+          TreeSplit split = mSplits[ s ];
+          if ( split.catBegin >= 0 )
+          {
+            split.catBegin = ( int )categories.size();
+            categories.insert( categories.end(), mCategories.begin() + mSplits[ s ].catBegin,
+                               mCategories.begin() + mSplits[ s ].catBegin + split.catCount );
+          }
+          splits.push_back( split );
+        }
+        node.splitBegin = splitBegin;
+      }
+      else
+      {
+        node.right = -1;
+        node.splitBegin = 0;
+        node.splitCount = 0;
+      }
+      canon[ i ] = ( int )nodes.size();
+      unique.insert( key, canon[ i ] );
+      nodes.push_back( node );
+    }
+    roots.push_back( canon[ mRoots[ t ] ] );
+  }
+
+  mRoots.swap( roots );
+  mNodes.swap( nodes );
+  mSplits.swap( splits );
+  mCategories.swap( categories );
+}
+
+void TreeModel::appendTrees( const TreeModel& other )
+{
+  detach();
+  int nodeOffset = ( int )mNodes.size();
+  int splitOffset = ( int )mSplits.size();
+  int categoryOffset = ( int )mCategories.size();
+
+  for ( int t = 0; t < other.treeCount(); ++t )
+    mRoots.push_back( nodeOffset + other.roots()[ t ] );
+  for ( int i = 0; i < other.nodeCount(); ++i )
+  {
+    TreeNode node = other.nodes()[ i ];
+    if ( node.left >= 0 )
+    {
+      node.left += nodeOffset;
+      node.right += nodeOffset;
+      node.splitBegin += splitOffset;
+    }
+    mNodes.push_back( node );
+  }
+  for ( int i = 0; i < other.splitCount(); ++i )
+  {
+    TreeSplit split = other.splits()[ i ];
+    if ( split.catBegin >= 0 )
+      split.catBegin += categoryOffset;
+    mSplits.push_back( split );
+  }
+  mCategories.insert( mCategories.end(), other.categories(), other.categories() + other.categoryCount() );
+}
+
+void TreeModel::splitCounts( std::vector<int>& primary, std::vector<int>& surrogate ) const
+{
+  primary.assign( mVarCount, 0 );
+  surrogate.assign( mVarCount, 0 );
+
+  const TreeNode* nodeArray = nodes();
+  const TreeSplit* splitArray = splits();
+  for ( int i = 0; i < nodeCount(); ++i )
+  {
+    const TreeNode& node = nodeArray[ i ];
+    if ( node.left < 0 )
+      continue;
+    // ordered split always decides, splits after it are never tried
+    for ( int s = 0; s < node.splitCount; ++s )
+    {
+      const TreeSplit& split = splitArray[ node.splitBegin + s ];
+      if ( split.var < 0 || split.var >= mVarCount )
+        continue;
+      if ( s == 0 )
+        primary[ split.var ]++;
+      else
+        surrogate[ split.var ]++;
+      if ( split.catBegin < 0 )
+        break;
+    }
+  }
+}
+
+std::vector<int> TreeModel::usedVars() const
+{
+  std::vector<int> primary, surrogate;
+  splitCounts( primary, surrogate );
+
+  std::vector<int> vars;
+  for ( int v = 0; v < mVarCount; ++v )
+  {
+    if ( primary[ v ] > 0 || surrogate[ v ] > 0 )
+      vars.push_back( v );
+  }
+  return vars;
+}
+
+void TreeModel::remapVars( const std::vector<int>& varMap, int newVarCount )
+{
+  detach();
+  for ( size_t i = 0; i < mSplits.size(); ++i )
+    mSplits[ i ].var = varMap[ mSplits[ i ].var ];
+  mVarCount = newVarCount;
+}
+
+void TreeModel::appendModel( const TreeModel& other )
+{
+  if ( other.mVarCount != mVarCount )
+    throw std::runtime_error( QString( "Tree model: %1 bands expected, got %2" ).arg( mVarCount ).arg( other.mVarCount ).toStdString() );
+  if ( other.mClassifier != mClassifier )
+    throw std::runtime_error( "Tree model: can't combine classification and regression trees" );
+
+  detach();
+  size_t nodeOffset = mNodes.size();
+  appendTrees( other );
+  if ( !mClassifier )
+    return;
+
+  // classes seen only in the new samples get new indices
+  std::vector<int> classMap( other.classCount() );
+  for ( int c = 0; c < other.classCount(); ++c )
+  {
+    float label = other.classLabels()[ c ];
+    std::vector<float>::const_iterator it = std::find( mClassLabels.begin(), mClassLabels.end(), label );
+    classMap[ c ] = ( int )( it - mClassLabels.begin() );
+    if ( it == mClassLabels.end() )
+      mClassLabels.push_back( label );
+  }
+  for ( size_t i = nodeOffset; i < mNodes.size(); ++i )
+  {
+    if ( mNodes[ i ].classIdx >= 0 )
+      mNodes[ i ].classIdx = classMap[ mNodes[ i ].classIdx ];
+  }
+}
+
+float TreeModel::predict( const float* sample, int stride, int exitMargin, float* confidence ) const
+{
+  return voteLeaves( SampleLeaf<TreeModel, float>( this, sample, stride ), exitMargin, confidence );
+}
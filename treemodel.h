@@ -0,0 +1,369 @@
+/***************************************************************************
+  treemodel.h
+  Raster classification using decision tree
+  -------------------
+  begin                : Oct 19, 2026
+  copyright            : (C) 2026 by NextGIS
+  email                : info@nextgis.com
+
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef TREEMODEL_H
+#define TREEMODEL_H
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include <QSharedPointer>
+
+class QFile;
+class QString;
+class CvDTree;
+class CvRTrees;
+
+//! node of a flattened tree, children are indices in the same node array
+struct TreeNode
+{
+  int left;        // -1 for leaf
+  int right;
+  int splitBegin;  // primary split followed by surrogates
+  int splitCount;
+  int defaultDir;  // -1 left, 1 right when no split can be applied
+  int classIdx;    // index in class labels, -1 for regression
+  float value;
+  float purity;    // share of train samples of the majority class in the node
+};
+
+struct TreeSplit
+{
+  int var;
+  int inversed;
+  int catBegin;    // -1 for ordered split
+  int catCount;
+  float threshold; // ordered split goes left when value <= threshold
+};
+
+//! known category of a categorical split, unknown values try the next split
+struct TreeCategory
+{
+  int value;
+  int dir;
+};
+
+/**
+  Decision tree or random forest stored as flat node arrays. Single tree
+  predicts its leaf value, forests vote like CvRTrees (classification) or
+  average leaf values (regression).
+
+  Besides YAML the model has a binary format (*.dtm): a header followed by
+  the arrays as they are in memory. Binary files are memory-mapped by load(),
+  so there is no parsing and processes loading the same file share pages.
+  The public arrays are empty while the model is mapped, use the accessors;
+  modifying methods copy mapped arrays first.
+  */
+class TreeModel
+{
+  public:
+    TreeModel();
+    ~TreeModel();
+
+    //! true if file contains TreeModel (YAML or binary) and not a CvDTree/CvRTrees
+    static bool isTreeModelFile( const QString& fileName );
+    //! true if file name has the binary model extension
+    static bool isBinaryFileName( const QString& fileName );
+
+    //! flatten OpenCV tree, pruned branches are dropped. Throws std::runtime_error
+    static TreeModel* fromCvDTree( const CvDTree* tree );
+    //! flatten OpenCV forest. Throws std::runtime_error
+    static TreeModel* fromCvRTrees( const CvRTrees* forest );
+
+    //! binary format for *.dtm files, YAML otherwise. Throws std::runtime_error
+    void save( const QString& fileName ) const;
+    //! throws std::runtime_error
+    void saveBinary( const QString& fileName ) const;
+    //! binary files are mapped, YAML files are read. Throws std::runtime_error
+    void load( const QString& fileName );
+
+    //! check indices of loaded arrays, throws std::runtime_error
+    void validate() const;
+
+    //! keep the first count trees
+    void truncate( int count );
+
+    //! delete the first count trees
+    void removeFirst( int count );
+
+    /** nodes at maxDepth (the root is at 0) become leaves predicting their
+      own value, the same tree a depth limited trainer grows from the node
+      values HistogramTreeTrainer and OpenCV store in inner nodes
+      */
+    void limitDepth( int maxDepth );
+
+    /** collapse splits whose children predict the same class or value and
+      share identical subtrees within and across trees. Prediction of every
+      sample is unchanged, nodes may be shared by several parents afterwards.
+      A collapsed split keeps the purity of its node, so single tree
+      confidence of its samples is the purity of both children together.
+      Subtrees are shared only when their inner nodes hold the same values,
+      so limitDepth() of a compacted model cuts the same leaves as before
+      */
+    void compact();
+
+    //! append trees of other model after own trees
+    void appendTrees( const TreeModel& other );
+
+    /** append trees of a separately trained model, its class indices are
+      mapped to own class labels. Throws std::runtime_error when models
+      use different bands or one is a classifier and the other is not
+      */
+    void appendModel( const TreeModel& other );
+
+    /** number of primary and surrogate splits on every band over all nodes.
+      Surrogates are counted only when prediction can reach them, i.e. all
+      splits before them are categorical
+      */
+    void splitCounts( std::vector<int>& primary, std::vector<int>& surrogate ) const;
+
+    //! sorted bands read by prediction (see splitCounts)
+    std::vector<int> usedVars() const;
+
+    //! band v of splits becomes varMap[ v ], varCount becomes newVarCount
+    void remapVars( const std::vector<int>& varMap, int newVarCount );
+
+    //! leaf node of the tree, feature v of the sample is sample[ v * stride ]
+    inline int leaf( int tree, const float* sample, int stride = 1 ) const;
+
+    /** ensemble prediction for a sample, see leaf() for stride. Forest
+      voting stops as soon as the winner is decided; exitMargin > 0 stops
+      it earlier, when the leading class is that many votes ahead.
+      confidence (if not NULL) gets leaf purity of a single tree, the vote
+      share of the winner or the share of regression trees near the mean
+      */
+    float predict( const float* sample, int stride = 1, int exitMargin = 0, float* confidence = NULL ) const;
+
+    /** voting of predict() over leaves found by leafOf( tree ), so models
+      that walk the trees their own way (QuantizedTreeModel) vote the same
+      */
+    template<class Leaf>
+    float voteLeaves( const Leaf& leafOf, int exitMargin, float* confidence ) const;
+
+    int treeCount() const { return mMap ? mMap->treeCount : ( int )mRoots.size(); }
+    int nodeCount() const { return mMap ? mMap->nodeCount : ( int )mNodes.size(); }
+    int splitCount() const { return mMap ? mMap->splitCount : ( int )mSplits.size(); }
+    int categoryCount() const { return mMap ? mMap->categoryCount : ( int )mCategories.size(); }
+    int varCount() const { return mVarCount; }
+    bool isClassifier() const { return mClassifier; }
+    int classCount() const { return mMap ? mMap->classCount : ( int )mClassLabels.size(); }
+
+    //! arrays of the model, mapped or own
+    const float* classLabels() const { return mMap ? mMap->classLabels : ( mClassLabels.empty() ? 0 : &mClassLabels[ 0 ] ); }
+    const int* roots() const { return mMap ? mMap->roots : ( mRoots.empty() ? 0 : &mRoots[ 0 ] ); }
+    const TreeNode* nodes() const { return mMap ? mMap->nodes : ( mNodes.empty() ? 0 : &mNodes[ 0 ] ); }
+    const TreeSplit* splits() const { return mMap ? mMap->splits : ( mSplits.empty() ? 0 : &mSplits[ 0 ] ); }
+    const TreeCategory* categories() const { return mMap ? mMap->categories : ( mCategories.empty() ? 0 : &mCategories[ 0 ] ); }
+
+    bool mClassifier;
+    int mVarCount;
+    std::vector<float> mClassLabels;
+
+    std::vector<int> mRoots;
+    std::vector<TreeNode> mNodes;
+    std::vector<TreeSplit> mSplits;
+    std::vector<TreeCategory> mCategories;
+
+  private:
+    //! arrays of a mapped binary file, shared by copies of the model
+    struct Mapping
+    {
+      QSharedPointer<QFile> file;
+      int treeCount;
+      int nodeCount;
+      int splitCount;
+      int categoryCount;
+      int classCount;
+      const float* classLabels;
+      const int* roots;
+      const TreeNode* nodes;
+      const TreeSplit* splits;
+      const TreeCategory* categories;
+    };
+    QSharedPointer<Mapping> mMap;
+
+    void loadBinary( const QString& fileName );
+    void loadYaml( const QString& fileName );
+    //! copy mapped arrays to own vectors before modification
+    void detach();
+
+    //! keep trees [first, first + count) and only the nodes they reach
+    void keepTrees( int first, int count );
+    //! append nodes of OpenCV tree as the next tree
+    void appendCvTree( const CvDTree* tree );
+};
+
+//! leaves of one sample in the trees of a model, for TreeModel::voteLeaves()
+template<class Model, typename T>
+struct SampleLeaf
+{
+  SampleLeaf( const Model* model, const T* sample, int stride )
+      : model( model ), sample( sample ), stride( stride ) {}
+
+  int operator()( int tree ) const { return model->leaf( tree, sample, stride ); }
+
+  const Model* model;
+  const T* sample;
+  int stride;
+};
+
+inline int TreeModel::leaf( int tree, const float* sample, int stride ) const
+{
+  const TreeNode* nodeArray = nodes();
+  const TreeSplit* splitArray = splits();
+  const TreeCategory* categoryArray = categories();
+
+  int idx = roots()[ tree ];
+  const TreeNode* node = &nodeArray[ idx ];
+  while ( node->left >= 0 )
+  {
+    int dir = 0;
+    const TreeSplit* split = &splitArray[ node->splitBegin ];
+    const TreeSplit* splitEnd = split + node->splitCount;
+    for ( ; split != splitEnd && dir == 0; ++split )
+    {
+      float value = sample[ split->var * stride ];
+      if ( split->catBegin < 0 )
+      {
+        dir = value <= split->threshold ? -1 : 1;
+      }
+      else
+      {
+        // binary search over sorted known categories
+        int ival = ( int )( value >= 0 ? value + 0.5f : value - 0.5f );
+        int a = split->catBegin, b = split->catBegin + split->catCount;
+        while ( a < b )
+        {
+          int c = ( a + b ) >> 1;
+          if ( categoryArray[ c ].value < ival )
+            a = c + 1;
+          else
+            b = c;
+        }
+        if ( a < split->catBegin + split->catCount && categoryArray[ a ].value == ival )
+          dir = categoryArray[ a ].dir;
+      }
+      if ( split->inversed )
+        dir = -dir;
+    }
+    if ( dir == 0 )
+      dir = node->defaultDir;
+
+    idx = dir < 0 ? node->left : node->right;
+    node = &nodeArray[ idx ];
+  }
+  return idx;
+}
+
+template<class Leaf>
+float TreeModel::voteLeaves( const Leaf& leafOf, int exitMargin, float* confidence ) const
+{
+  int trees = treeCount();
+  const TreeNode* nodeArray = nodes();
+  if ( trees == 1 )
+  {
+    const TreeNode& node = nodeArray[ leafOf( 0 ) ];
+    if ( confidence )
+      *confidence = node.purity;
+    return node.value;
+  }
+
+  if ( mClassifier )
+  {
+    // same tie breaking as CvRTrees::predict: first class reaching the max wins
+    int votes[ 256 ] = { 0 };
+    std::vector<int> manyVotes;
+    int* counts = votes;
+    if ( classCount() > 256 )
+    {
+      manyVotes.assign( classCount(), 0 );
+      counts = &manyVotes[ 0 ];
+    }
+
+    // voting stops when the other classes can't catch up with the remaining
+    // trees (unless confidence is asked for) or, with exitMargin > 0, when the
+    // leader is that many votes ahead
+    int maxVotes = 0;
+    int leader = -1;
+    int runnerUp = 0;
+    int evaluated = trees;
+    float result = 0;
+    for ( int t = 0; t < trees; ++t )
+    {
+      const TreeNode& node = nodeArray[ leafOf( t ) ];
+      int n = ++counts[ node.classIdx ];
+      if ( n > maxVotes )
+      {
+        if ( node.classIdx != leader )
+          runnerUp = maxVotes;
+        maxVotes = n;
+        leader = node.classIdx;
+        result = node.value;
+      }
+      else if ( n > runnerUp )
+      {
+        runnerUp = n;
+      }
+
+      int lead = maxVotes - runnerUp;
+      if ( ( !confidence && lead >= trees - t ) || ( exitMargin > 0 && lead >= exitMargin ) )
+      {
+        evaluated = t + 1;
+        break;
+      }
+    }
+    if ( confidence )
+      *confidence = ( float )maxVotes / evaluated;
+    return result;
+  }
+
+  // confidence of regression is the share of trees within 0.5 of the mean
+  float leafValues[ 256 ];
+  std::vector<float> manyValues;
+  float* values = leafValues;
+  if ( confidence && trees > 256 )
+  {
+    manyValues.resize( trees );
+    values = &manyValues[ 0 ];
+  }
+
+  double sum = 0;
+  for ( int t = 0; t < trees; ++t )
+  {
+    float value = nodeArray[ leafOf( t ) ].value;
+    sum += value;
+    if ( confidence )
+      values[ t ] = value;
+  }
+  float result = ( float )( sum / trees );
+  if ( confidence )
+  {
+    int agree = 0;
+    for ( int t = 0; t < trees; ++t )
+    {
+      if ( fabs( values[ t ] - result ) <= 0.5f )
+        agree++;
+    }
+    *confidence = ( float )agree / trees;
+  }
+  return result;
+}
+
+#endif // TREEMODEL_H